@@ -0,0 +1,31 @@
+#!/bin/sh
+# Build the firmware with avr-gcc and run it under the simavr benchmark.
+#
+#   bench/run.sh [simbench options...]
+#
+# Environment: AVR_CC (avr-gcc), HOST_CC (cc), MCU (atmega169p),
+# BENCH_CFLAGS (extra firmware flags, e.g. -DTT_TIME24 to compare kernel
+# options) and OUT (build directory, bench/out).
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC="$HERE/../lab5_avr"
+OUT=${OUT:-"$HERE/out"}
+MCU=${MCU:-atmega169p}
+AVR_CC=${AVR_CC:-avr-gcc}
+HOST_CC=${HOST_CC:-cc}
+
+mkdir -p "$OUT"
+
+"$AVR_CC" -mmcu="$MCU" -Os -std=gnu99 -funsigned-char -funsigned-bitfields \
+	-DTT_STATS $BENCH_CFLAGS -I"$SRC" -Wl,-Map,"$OUT/lab5_avr.map" \
+	-o "$OUT/lab5_avr.elf" "$SRC"/*.c "$SRC"/objects/*.c
+
+SIMAVR_FLAGS=$(pkg-config --cflags --libs simavr 2>/dev/null || echo "-lsimavr -lelf")
+"$HOST_CC" -O2 -o "$OUT/simbench" "$HERE/simbench.c" $SIMAVR_FLAGS
+
+HWM=$(avr-nm "$OUT/lab5_avr.elf" | awk '$3 == "msgsHighWater" { print "0x" $1 }')
+ASYNC=$(avr-nm "$OUT/lab5_avr.elf" | awk '$3 == "async" { print "0x" $1 }')
+
+exec "$OUT/simbench" --firmware "$OUT/lab5_avr.elf" --mcu "$MCU" \
+	--hwm-addr "${HWM:-0}" --async-addr "${ASYNC:-0}" --thresholds "$HERE/thresholds.txt" "$@"
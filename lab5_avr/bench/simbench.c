@@ -0,0 +1,390 @@
+/*
+ * Cycle-accurate benchmark of the lab5 firmware under simavr.
+ *
+ * Runs the firmware ELF on a simulated ATmega169 and plays the part of the
+ * bridge simulator on USART0: once the kernel has enabled interrupts, cars
+ * arrive at random, enter the bridge one per second while their light is
+ * green and leave it after five seconds.
+ * At the end it prints one "metric value" line per measurement and, when
+ * given a thresholds file, fails if any metric is outside its limit.
+ *
+ *   simbench --firmware lab5_avr.elf [--seconds 600] [--rate 12] [--seed 1]
+ *            [--hwm-addr 0x800123] [--async-addr 0x12a]
+ *            [--thresholds thresholds.txt] [--mcu atmega169p]
+ *
+ * --rate is the number of arriving cars per minute in each direction and
+ * --hwm-addr the address of msgsHighWater (firmware built with TT_STATS).
+ * --async-addr is the flash address of async(): every call is timed from
+ * its first instruction to the return that pops the stack pointer back
+ * above where it was, giving async_cycles (the mean) and async_max_cycles.
+ * Build with BENCH_CFLAGS=-DTT_TIME24, or at another revision, to compare.
+ *
+ * For the USART0 receive and data register empty interrupts it takes the
+ * latency, from the interrupt becoming pending to its vector being taken,
+ * and the cycles per byte, from the vector to the reti. The latency
+ * includes every stretch the interrupt waited with interrupts off. Compare
+ * builds with and without INSTALL_FAST or TT_STATIC_IRQ to see what the
+ * fast paths save.
+ * irq_off_max_cycles is the longest stretch with interrupts disabled,
+ * interrupt handlers included; the address where it began is printed after
+ * the metrics. Raise --rate to see how it grows with the queues.
+ * bench/run.sh builds everything and fills in the addresses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_io.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_uart.h>
+
+// Protocol bits, see lab5_avr/common.h.
+#define NB_CAR_ARRIVAL  0
+#define NB_BRIDGE_ENTRY 1
+#define SB_CAR_ARRIVAL  2
+#define SB_BRIDGE_ENTRY 3
+#define NB_GREEN 0
+#define SB_GREEN 2
+
+// ATmega169 vectors.
+#define VECTOR_USART0_RX   13
+#define VECTOR_USART0_UDRE 14
+
+#define TICK_USEC       10000     // peer model resolution
+#define ENTRY_USEC      1000000   // one car per second on green
+#define CROSS_USEC      5000000   // time to cross the bridge
+#define MAX_ON_BRIDGE   64
+
+struct lane {
+	int queue;                    // cars waiting at the light
+	avr_cycle_count_t last_entry; // cycle of the last car entering
+	int green;
+};
+
+struct peer {
+	avr_t* avr;
+	avr_irq_t* uart_in;
+	struct lane lane[2];
+	avr_cycle_count_t exit_at[MAX_ON_BRIDGE]; // bridge occupants, 0 = free slot
+	int exit_dir[MAX_ON_BRIDGE];
+	uint32_t rate_per_tick;       // arrival probability per tick, 1/2^32 units
+	uint64_t rng;
+	unsigned long events;         // sensor activations sent
+	unsigned long lights;         // light bytes received
+	unsigned long violations;     // opposite directions on the bridge at once
+	int started;                  // interrupts enabled, kernel is running
+};
+
+// Latency and handler cycles of one interrupt vector.
+struct vector_timing {
+	avr_t* avr;
+	avr_cycle_count_t raised;     // cycle it became pending
+	avr_cycle_count_t entered;    // cycle its vector was taken
+	avr_cycle_count_t latency_total, latency_max, handler_total;
+	unsigned long latency_count, handler_count;
+};
+
+static void vector_pending(struct avr_irq_t* irq, uint32_t value, void* param) {
+	struct vector_timing* v = param;
+	(void)irq;
+	if (value) {
+		v->raised = v->avr->cycle;
+	}
+}
+
+static void vector_running(struct avr_irq_t* irq, uint32_t value, void* param) {
+	struct vector_timing* v = param;
+	(void)irq;
+	if (value) {
+		v->entered = v->avr->cycle;
+		if (v->raised) {
+			avr_cycle_count_t latency = v->entered - v->raised;
+			v->latency_total += latency;
+			v->latency_count++;
+			if (latency > v->latency_max) {
+				v->latency_max = latency;
+			}
+			v->raised = 0;
+		}
+	} else if (v->entered) {
+		v->handler_total += v->avr->cycle - v->entered;
+		v->handler_count++;
+		v->entered = 0;
+	}
+}
+
+static void time_vector(avr_t* avr, uint8_t vector, struct vector_timing* v) {
+	avr_irq_t* irq = avr_get_interrupt_irq(avr, vector);
+	memset(v, 0, sizeof(*v));
+	v->avr = avr;
+	avr_irq_register_notify(irq + AVR_INT_IRQ_PENDING, vector_pending, v);
+	avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING, vector_running, v);
+}
+
+static double mean(avr_cycle_count_t total, unsigned long n) {
+	return n ? (double)total / n : 0;
+}
+
+static uint32_t next_random(struct peer* p) {
+	// xorshift64*
+	p->rng ^= p->rng >> 12;
+	p->rng ^= p->rng << 25;
+	p->rng ^= p->rng >> 27;
+	return (uint32_t)((p->rng * 2685821657736338717ULL) >> 32);
+}
+
+static void uart_out(struct avr_irq_t* irq, uint32_t value, void* param) {
+	struct peer* p = param;
+	(void)irq;
+	p->lane[0].green = (value >> NB_GREEN) & 1;
+	p->lane[1].green = (value >> SB_GREEN) & 1;
+	p->lights++;
+}
+
+static avr_cycle_count_t peer_tick(avr_t* avr, avr_cycle_count_t when, void* param) {
+	struct peer* p = param;
+	avr_cycle_count_t entry = avr_usec_to_cycles(avr, ENTRY_USEC);
+	uint8_t data = 0;
+	int dir, i;
+
+	// Cars come only once the controller can hear of them: initiate() sends
+	// the red lights before the kernel runs.
+	if (!p->started) {
+		return when + avr_usec_to_cycles(avr, TICK_USEC);
+	}
+	for (i = 0; i < MAX_ON_BRIDGE; i++) {
+		if (p->exit_at[i] && p->exit_at[i] <= when) {
+			p->exit_at[i] = 0;
+		}
+	}
+
+	for (dir = 0; dir < 2; dir++) {
+		struct lane* l = &p->lane[dir];
+		if (next_random(p) < p->rate_per_tick) {
+			l->queue++;
+			data |= 1 << (dir == 0 ? NB_CAR_ARRIVAL : SB_CAR_ARRIVAL);
+		}
+		if (l->green && l->queue > 0 && when - l->last_entry >= entry) {
+			l->queue--;
+			l->last_entry = when;
+			data |= 1 << (dir == 0 ? NB_BRIDGE_ENTRY : SB_BRIDGE_ENTRY);
+			for (i = 0; i < MAX_ON_BRIDGE; i++) {
+				if (p->exit_at[i] && p->exit_dir[i] != dir) {
+					p->violations++;
+				}
+			}
+			for (i = 0; i < MAX_ON_BRIDGE && p->exit_at[i]; i++)
+				;
+			if (i < MAX_ON_BRIDGE) {
+				p->exit_at[i] = when + avr_usec_to_cycles(avr, CROSS_USEC);
+				p->exit_dir[i] = dir;
+			}
+		}
+	}
+
+	if (data) {
+		for (i = 0; i < 4; i++) {
+			p->events += (data >> i) & 1;
+		}
+		avr_raise_irq(p->uart_in, data);
+	}
+	return when + avr_usec_to_cycles(avr, TICK_USEC);
+}
+
+static unsigned stack_pointer(avr_t* avr) {
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+struct metric {
+	const char* name;
+	double value;
+};
+
+// Threshold lines are "<metric> max <value>" or "<metric> min <value>",
+// '#' starts a comment line. Returns the number of metrics outside their
+// limits, -1 on error.
+static int check_thresholds(const char* path, const struct metric* m, int n) {
+	FILE* f = fopen(path, "r");
+	char line[128], name[64], kind[8];
+	double limit;
+	int failed = 0, i;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || sscanf(line, "%63s %7s %lf", name, kind, &limit) != 3) {
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (strcmp(name, m[i].name) != 0) {
+				continue;
+			}
+			if ((!strcmp(kind, "max") && m[i].value > limit) ||
+			    (!strcmp(kind, "min") && m[i].value < limit)) {
+				fprintf(stderr, "REGRESSION: %s = %.2f, %s %.2f\n", name, m[i].value, kind, limit);
+				failed++;
+			}
+		}
+	}
+	fclose(f);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	const char* firmware = NULL;
+	const char* thresholds = NULL;
+	const char* mcu = "atmega169p";
+	unsigned long hwm_addr = 0, async_addr = 0;
+	double seconds = 600, rate = 12;
+	unsigned long seed = 1;
+	elf_firmware_t f;
+	struct peer p;
+	struct vector_timing rx, udre;
+	uint32_t flags = 0;
+	avr_cycle_count_t end, irq_off_start = 0, irq_off_max = 0, sleep_cycles = 0, last;
+	avr_cycle_count_t async_start = 0, async_total = 0, async_max = 0;
+	unsigned long async_calls = 0;
+	unsigned async_sp = 0;
+	int in_async = 0;
+	avr_flashaddr_t pc, irq_off_start_pc = 0, irq_off_max_pc = 0;
+	int i, state;
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "--firmware")) firmware = argv[i + 1];
+		else if (!strcmp(argv[i], "--thresholds")) thresholds = argv[i + 1];
+		else if (!strcmp(argv[i], "--mcu")) mcu = argv[i + 1];
+		else if (!strcmp(argv[i], "--hwm-addr")) hwm_addr = strtoul(argv[i + 1], NULL, 0);
+		else if (!strcmp(argv[i], "--async-addr")) async_addr = strtoul(argv[i + 1], NULL, 0);
+		else if (!strcmp(argv[i], "--seconds")) seconds = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--rate")) rate = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--seed")) seed = strtoul(argv[i + 1], NULL, 0);
+		else break;
+	}
+	if (!firmware || i < argc) {
+		fprintf(stderr, "usage: %s --firmware file.elf [--seconds s] [--rate cars/min] "
+		        "[--seed n] [--hwm-addr addr] [--async-addr addr] [--thresholds file] [--mcu name]\n", argv[0]);
+		return 2;
+	}
+
+	memset(&f, 0, sizeof(f));
+	if (elf_read_firmware(firmware, &f) != 0) {
+		fprintf(stderr, "%s: cannot read firmware\n", firmware);
+		return 2;
+	}
+	memset(&p, 0, sizeof(p));
+	p.avr = avr_make_mcu_by_name(mcu);
+	if (!p.avr) {
+		fprintf(stderr, "%s: unknown mcu\n", mcu);
+		return 2;
+	}
+	avr_init(p.avr);
+	avr_load_firmware(p.avr, &f);
+	p.avr->frequency = 8000000;
+	p.rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+	p.rate_per_tick = (uint32_t)(rate / 60.0 * TICK_USEC / 1e6 * 4294967296.0);
+
+	// Keep simavr from echoing the light bytes on stdout.
+	avr_ioctl(p.avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+	flags &= ~AVR_UART_FLAG_STDIO;
+	avr_ioctl(p.avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+	p.uart_in = avr_io_getirq(p.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+	avr_irq_register_notify(avr_io_getirq(p.avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+	                        uart_out, &p);
+	avr_cycle_timer_register_usec(p.avr, TICK_USEC, peer_tick, &p);
+	time_vector(p.avr, VECTOR_USART0_RX, &rx);
+	time_vector(p.avr, VECTOR_USART0_UDRE, &udre);
+
+	end = (avr_cycle_count_t)(seconds * p.avr->frequency);
+	last = p.avr->cycle;
+	do {
+		int was_sleeping = p.avr->state == cpu_Sleeping;
+		pc = p.avr->pc;
+		if (async_addr && !in_async && pc == async_addr && p.avr->state == cpu_Running) {
+			in_async = 1;
+			async_start = p.avr->cycle;
+			async_sp = stack_pointer(p.avr);
+		}
+		state = avr_run(p.avr);
+		// async() runs with interrupts off, so the first time the stack
+		// pointer is above its value on entry is after its own ret.
+		if (in_async && stack_pointer(p.avr) > async_sp) {
+			in_async = 0;
+			async_calls++;
+			async_total += p.avr->cycle - async_start;
+			if (p.avr->cycle - async_start > async_max) {
+				async_max = p.avr->cycle - async_start;
+			}
+		}
+		if (was_sleeping) {
+			sleep_cycles += p.avr->cycle - last;
+		}
+		// TINYTIMBER enables interrupts for the first time.
+		if (p.avr->sreg[S_I]) {
+			p.started = 1;
+		}
+		// Interrupts-off spans, counted once the kernel has started. An
+		// interrupt handler runs with I cleared, so it counts as well.
+		if (p.started && p.avr->state == cpu_Running) {
+			if (!p.avr->sreg[S_I]) {
+				if (!irq_off_start) {
+					irq_off_start = last;
+					irq_off_start_pc = pc;
+				}
+				if (p.avr->cycle - irq_off_start > irq_off_max) {
+					irq_off_max = p.avr->cycle - irq_off_start;
+					irq_off_max_pc = irq_off_start_pc;
+				}
+			} else {
+				irq_off_start = 0;
+			}
+		}
+		last = p.avr->cycle;
+	} while (state != cpu_Done && state != cpu_Crashed && p.avr->cycle < end);
+
+	if (state == cpu_Crashed) {
+		fprintf(stderr, "firmware crashed at cycle %llu\n", (unsigned long long)p.avr->cycle);
+		return 1;
+	}
+
+	struct metric m[] = {
+		{ "cycles_per_event", p.events ? (double)(p.avr->cycle - sleep_cycles) / p.events : 0 },
+		{ "irq_off_max_cycles", (double)irq_off_max },
+		{ "sleep_residency_pct", 100.0 * sleep_cycles / p.avr->cycle },
+		{ "msg_pool_high_water", hwm_addr ? p.avr->data[hwm_addr & 0xffff] : 0 },
+		{ "sensor_events", (double)p.events },
+		{ "light_updates", (double)p.lights },
+		{ "safety_violations", (double)p.violations },
+		{ "async_cycles", mean(async_total, async_calls) },
+		{ "async_max_cycles", (double)async_max },
+		{ "rx_latency_cycles", mean(rx.latency_total, rx.latency_count) },
+		{ "rx_latency_max_cycles", (double)rx.latency_max },
+		{ "rx_cycles_per_byte", mean(rx.handler_total, rx.handler_count) },
+		{ "udre_latency_cycles", mean(udre.latency_total, udre.latency_count) },
+		{ "udre_latency_max_cycles", (double)udre.latency_max },
+		{ "udre_cycles_per_byte", mean(udre.handler_total, udre.handler_count) },
+	};
+	int n = sizeof(m) / sizeof(m[0]);
+	for (i = 0; i < n; i++) {
+		printf("%-24s %.2f\n", m[i].name, m[i].value);
+	}
+	// Where the longest span began, for avr-addr2line or the map file: the
+	// cli, or the instruction that an interrupt handler interrupted.
+	printf("# irq_off_max_cycles began at pc 0x%04x\n", (unsigned)irq_off_max_pc);
+
+	if (thresholds) {
+		int failed = check_thresholds(thresholds, m, n);
+		if (failed != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
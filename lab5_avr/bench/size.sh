@@ -0,0 +1,197 @@
+#!/bin/sh
+# Flash and cycle cost of every firmware function, and a gate that keeps
+# libgcc arithmetic helpers out of the hot paths.
+#
+#   bench/size.sh [firmware.elf]
+#
+# Builds the firmware with avr-gcc as bench/run.sh does, without TT_STATS,
+# unless an ELF is given. For every function it prints the flash bytes (from
+# the symbol table) and the cycles of its instructions counted once each,
+# from the avr-objdump disassembly: a straight-line cost that leaves out
+# loops and taken branches but shows what a function costs to pass through
+# and what a change adds to it.
+#
+# Then it follows the direct calls and jumps from each function named
+# "hot" in bench/budget.txt. Reaching a libgcc arithmetic helper (32-bit
+# multiply, divide and modulo, shifts, soft float) from one of them fails
+# the gate, and the chain of calls that got there is printed. Functions
+# named "cold" are not followed: they are reachable from a hot path but
+# only run rarely, such as when a setting changes. Calls through function
+# pointers, as the kernel makes to methods, are not followed either, so
+# methods are listed as hot themselves. The gate also fails when flash,
+# RAM or the straight-line cycles of a hot function are over their limits.
+#
+# Environment: AVR_CC (avr-gcc), AVR_OBJDUMP (avr-objdump), AVR_NM (avr-nm),
+# AVR_SIZE (avr-size), MCU (atmega169p), SIZE_CFLAGS (extra firmware flags,
+# e.g. -DTT_TIME24) and OUT (build directory, bench/out).
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC="$HERE/../lab5_avr"
+OUT=${OUT:-"$HERE/out"}
+MCU=${MCU:-atmega169p}
+AVR_CC=${AVR_CC:-avr-gcc}
+AVR_OBJDUMP=${AVR_OBJDUMP:-avr-objdump}
+AVR_NM=${AVR_NM:-avr-nm}
+AVR_SIZE=${AVR_SIZE:-avr-size}
+BUDGET="$HERE/budget.txt"
+
+mkdir -p "$OUT"
+
+if [ $# -gt 0 ]; then
+	ELF=$1
+else
+	ELF="$OUT/lab5_avr_size.elf"
+	"$AVR_CC" -mmcu="$MCU" -Os -std=gnu99 -funsigned-char -funsigned-bitfields \
+		$SIZE_CFLAGS -I"$SRC" -Wl,-Map,"$OUT/lab5_avr_size.map" \
+		-o "$ELF" "$SRC"/*.c "$SRC"/objects/*.c
+fi
+
+"$AVR_NM" -S --size-sort "$ELF" > "$OUT/size.nm"
+"$AVR_OBJDUMP" -d --no-show-raw-insn "$ELF" > "$OUT/size.dis"
+# text data bss dec hex filename
+"$AVR_SIZE" "$ELF" | awk 'NR == 2 { print "flash_bytes", $1 + $2; print "ram_bytes", $2 + $3 }' > "$OUT/size.totals"
+
+exec awk -v budget="$BUDGET" -v totals="$OUT/size.totals" -v nm="$OUT/size.nm" '
+# Cycles of one instruction on the ATmega169 (16-bit program counter).
+# Branches and skips are counted as not taken.
+function cycles(op) {
+	if (op in cost) {
+		return cost[op]
+	}
+	return 1
+}
+
+function helper(name) {
+	return name ~ /^__(u?s?mul|u?div|u?mod|u?divmod|ashl|ashr|lshr|neg|cmp|ucmp|clz|ctz|ffs|popcount|parity|bswap|fix|float|extend|trunc|fp_|(add|sub|mul|div|cmp|eq|ne|lt|le|gt|ge|unord)[sd]f)/
+}
+
+BEGIN {
+	split("adiw sbiw mul muls mulsu fmul fmuls fmulsu rjmp ijmp ld ldd st std lds sts push pop cbi sbi", two)
+	for (i in two) cost[two[i]] = 2
+	split("jmp rcall icall lpm elpm", three)
+	for (i in three) cost[three[i]] = 3
+	split("call ret reti", four)
+	for (i in four) cost[four[i]] = 4
+
+	while ((getline line < nm) > 0) {
+		n = split(line, f, " ")
+		if (n == 4 && f[3] ~ /^[tTwW]$/) {
+			bytes[f[4]] = ("0x" f[2]) + 0
+		}
+	}
+	while ((getline line < totals) > 0) {
+		split(line, f, " ")
+		metric[f[1]] = f[2]
+	}
+	while ((getline line < budget) > 0) {
+		sub(/#.*/, "", line)
+		n = split(line, f, " ")
+		if (n == 2 && f[1] == "hot") {
+			hot[++n_hot] = f[2]
+		} else if (n == 2 && f[1] == "cold") {
+			cold[f[2]] = 1
+		} else if (n == 3 && f[2] == "max") {
+			limit[f[1]] = f[3]
+		}
+	}
+}
+
+# 0000012a <async>:
+/^[0-9a-f]+ <[^>]+>:$/ {
+	fn = $2
+	gsub(/[<>:]/, "", fn)
+	order[++n_fn] = fn
+	total[fn] = 0
+	next
+}
+
+# "     12c:	push	r28" and "     130:	call	0x1f2	; 0x1f2 <__udivmodsi4>"
+fn != "" && /^ +[0-9a-f]+:\t/ {
+	split($0, f, "\t")
+	op = f[2]
+	sub(/ .*/, "", op)
+	total[fn] += cycles(op)
+	if (op ~ /^(call|rcall|jmp|rjmp)$/ && match($0, /<[^>+]+/)) {
+		to = substr($0, RSTART + 1, RLENGTH - 1)
+		if (to != fn && !((fn, to) in edge)) {
+			edge[fn, to] = 1
+			callees[fn] = callees[fn] " " to
+		}
+	}
+}
+
+END {
+	printf "%-36s %6s %7s\n", "function", "bytes", "cycles"
+	for (i = 1; i <= n_fn; i++) {
+		fn = order[i]
+		if (fn in bytes) {
+			printf "%-36s %6d %7d%s\n", fn, bytes[fn], total[fn], helper(fn) ? "  libgcc" : ""
+		}
+	}
+	printf "\n"
+
+	failed = 0
+	for (m in limit) {
+		if (m == "hot_cycles") {
+			continue
+		}
+		if (!(m in metric)) {
+			printf "%s: no such measurement\n", m
+			failed = 1
+		} else if (metric[m] + 0 > limit[m] + 0) {
+			printf "%s %d, over the limit of %d\n", m, metric[m], limit[m]
+			failed = 1
+		} else {
+			printf "%s %d (limit %d)\n", m, metric[m], limit[m]
+		}
+	}
+
+	for (h = 1; h <= n_hot; h++) {
+		root = hot[h]
+		if (!(root in total)) {
+			printf "hot %s: not in the firmware (inlined or renamed?)\n", root
+			failed = 1
+			continue
+		}
+		if ("hot_cycles" in limit && total[root] > limit["hot_cycles"] + 0) {
+			printf "hot %s: %d cycles, over the limit of %d\n", root, total[root], limit["hot_cycles"]
+			failed = 1
+		}
+		# Breadth first over the direct calls, remembering where each
+		# function was reached from.
+		delete from
+		delete queue
+		from[root] = ""
+		queue[1] = root
+		head = 1
+		tail = 1
+		while (head <= tail) {
+			fn = queue[head++]
+			if (helper(fn)) {
+				path = fn
+				for (p = from[fn]; p != ""; p = from[p]) {
+					path = p " -> " path
+				}
+				printf "hot %s: calls libgcc %s (%s)\n", root, fn, path
+				failed = 1
+				continue
+			}
+			if (fn in cold) {
+				continue
+			}
+			n = split(callees[fn], next_fn, " ")
+			for (i = 1; i <= n; i++) {
+				if (!(next_fn[i] in from)) {
+					from[next_fn[i]] = fn
+					queue[++tail] = next_fn[i]
+				}
+			}
+		}
+	}
+	if (!failed) {
+		printf "%d hot functions, no libgcc arithmetic helpers reached\n", n_hot
+	}
+	exit failed
+}
+' "$OUT/size.dis"
@@ -0,0 +1,256 @@
+/*
+ * Streaming analyzer for binary event logs (eventlog.h).
+ *
+ * One pass over the mapped file with memory that does not grow with it:
+ *   - per window (--window minutes): cars through in each direction,
+ *     arrivals, light switches and the median and 99th percentile wait,
+ *   - over the whole run: throughput, wait percentiles per direction,
+ *     switches of the green direction, all-red periods, unsafe entries
+ *     and starved queues.
+ * Waits are matched from arrival to entry in FIFO order per direction,
+ * with a ring the size of the largest queue depth a record can hold.
+ * Percentiles come from log-linear histograms with 16 sub-buckets per
+ * power of two, so they are within 1/16 of the true value. Pages already
+ * read are dropped from the mapping as it goes, so multi-GB logs do not
+ * stay resident.
+ *
+ *   analyze [--window minutes] [--quiet] file
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "eventlog.h"
+
+#define SUB_BITS 4
+#define N_BUCKETS ((64 - SUB_BITS + 1) << SUB_BITS)
+#define RING 65536                        // queue depths are 16 bits
+#define DROP_BEHIND (16UL << 20)          // unmap after this many bytes
+
+struct histogram {
+	unsigned long long count[N_BUCKETS];
+	unsigned long long total;
+	uint64_t max;
+};
+
+struct window {
+	unsigned long long entries[2];
+	unsigned long long arrivals;
+	unsigned long long switches;
+	struct histogram wait;
+};
+
+static int bucket(uint64_t v) {
+	int shift;
+	if (v < (1 << SUB_BITS)) {
+		return (int)v;
+	}
+	shift = 63 - __builtin_clzll(v) - SUB_BITS;
+	return ((shift + 1) << SUB_BITS) + (int)((v >> shift) - (1 << SUB_BITS));
+}
+
+// Upper end of bucket `b`.
+static uint64_t bucket_high(int b) {
+	int shift;
+	if (b < (1 << SUB_BITS)) {
+		return b;
+	}
+	shift = (b >> SUB_BITS) - 1;
+	return ((((uint64_t)(b & ((1 << SUB_BITS) - 1)) + (1 << SUB_BITS) + 1) << shift) - 1);
+}
+
+static void record(struct histogram* h, uint64_t v) {
+	h->count[bucket(v)]++;
+	h->total++;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+static double percentile(const struct histogram* h, double p, double ticks_per_sec) {
+	unsigned long long want, seen = 0;
+	int b;
+	if (!h->total) {
+		return 0;
+	}
+	want = (unsigned long long)(p * h->total);
+	if (want >= h->total) {
+		return h->max / ticks_per_sec;
+	}
+	for (b = 0; b < N_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen > want) {
+			uint64_t high = bucket_high(b);
+			return (high < h->max ? high : h->max) / ticks_per_sec;
+		}
+	}
+	return h->max / ticks_per_sec;
+}
+
+static void print_window(struct window* w, uint64_t start, uint64_t length, double tps, int quiet) {
+	if (!quiet) {
+		double scale = 3600 * tps / length;
+		printf("%10.2f %7.1f %7.1f %8llu %8llu %8.1fs %8.1fs\n", start / tps / 3600,
+		       w->entries[NORTHBOUND] * scale, w->entries[SOUTHBOUND] * scale,
+		       w->arrivals, w->switches, percentile(&w->wait, 0.5, tps), percentile(&w->wait, 0.99, tps));
+	}
+	memset(w, 0, sizeof(*w));
+}
+
+// Direction with green in a light byte, -1 for none.
+static int green_dir(uint8_t lights) {
+	if (lights & (1 << NB_GREEN)) {
+		return NORTHBOUND;
+	}
+	if (lights & (1 << SB_GREEN)) {
+		return SOUTHBOUND;
+	}
+	return -1;
+}
+
+int main(int argc, char** argv) {
+	static uint64_t arrived[2][RING];
+	static struct histogram wait[2], all;
+	static struct window win;
+	struct EventLogHeader h;
+	struct stat st;
+	const char* path = NULL;
+	const unsigned char* map;
+	double window_min = 60, tps;
+	uint64_t window, next_window, last_time = 0, dropped_to = 0;
+	unsigned long long n, i, entries[2] = { 0, 0 }, arrivals[2] = { 0, 0 };
+	unsigned long long switches = 0, all_red = 0, unsafe = 0, starved = 0, unmatched = 0;
+	unsigned int head[2] = { 0, 0 }, tail[2] = { 0, 0 };
+	int quiet = 0, fd, green = -1, lights = -1, dir;
+
+	for (i = 1; i < (unsigned)argc; i++) {
+		if (i + 1 < (unsigned)argc && !strcmp(argv[i], "--window")) window_min = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--quiet")) quiet = 1;
+		else if (!path && argv[i][0] != '-') path = argv[i];
+		else {
+			path = NULL;
+			break;
+		}
+	}
+	if (!path || window_min <= 0) {
+		fprintf(stderr, "usage: %s [--window minutes] [--quiet] file\n", argv[0]);
+		return 2;
+	}
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		return 2;
+	}
+	if ((size_t)st.st_size < sizeof(h)) {
+		fprintf(stderr, "%s: too short for an event log\n", path);
+		return 2;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror(path);
+		return 2;
+	}
+	madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+	memcpy(&h, map, sizeof(h));
+	if (memcmp(h.magic, EVENTLOG_MAGIC, sizeof(h.magic)) || h.version != EVENTLOG_VERSION ||
+	    h.record_size != sizeof(struct EventLogRecord) || h.byte_order != EVENTLOG_BYTE_ORDER) {
+		fprintf(stderr, "%s: not a version %d event log written in this byte order\n", path, EVENTLOG_VERSION);
+		return 2;
+	}
+	tps = h.ticks_per_sec;
+	window = (uint64_t)(window_min * 60 * tps);
+	next_window = window;
+	n = (st.st_size - sizeof(h)) / sizeof(struct EventLogRecord);
+
+	if (!quiet) {
+		printf("%10s %7s %7s %8s %8s %9s %9s\n", "hour", "N/h", "S/h", "arrivals", "switches", "p50 wait", "p99 wait");
+	}
+	for (i = 0; i < n; i++) {
+		const struct EventLogRecord* r = (const struct EventLogRecord*)(map + sizeof(h)) + i;
+
+		while (r->time >= next_window) {
+			print_window(&win, next_window - window, window, tps, quiet);
+			next_window += window;
+		}
+
+		dir = r->dir & 1;
+		switch (r->kind) {
+		case BRIDGE_ARRIVAL:
+			arrived[dir][head[dir]++ % RING] = r->time;
+			arrivals[dir]++;
+			win.arrivals++;
+			break;
+		case BRIDGE_ENTRY:
+			if (tail[dir] != head[dir]) {
+				uint64_t w = r->time - arrived[dir][tail[dir]++ % RING];
+				record(&wait[dir], w);
+				record(&all, w);
+				record(&win.wait, w);
+			} else {
+				unmatched++;
+			}
+			entries[dir]++;
+			win.entries[dir]++;
+			break;
+		case BRIDGE_LIGHTS:
+			if (r->lights != lights) {
+				int g = green_dir(r->lights);
+				if (g >= 0 && green >= 0 && g != green) {
+					switches++;
+					win.switches++;
+				}
+				if (g < 0 && lights >= 0 && green_dir(lights) >= 0) {
+					all_red++;
+				}
+				if (g >= 0) {
+					green = g;
+				}
+				lights = r->lights;
+			}
+			break;
+		case BRIDGE_UNSAFE:
+			unsafe++;
+			break;
+		case BRIDGE_STARVED:
+			starved++;
+			break;
+		}
+		last_time = r->time;
+
+		// Let go of what has been read, so the resident set stays small.
+		if ((i + 1) * sizeof(*r) + sizeof(h) - dropped_to >= DROP_BEHIND) {
+			uint64_t upto = ((i + 1) * sizeof(*r) + sizeof(h)) & ~(uint64_t)(DROP_BEHIND - 1);
+			madvise((void*)(map + dropped_to), upto - dropped_to, MADV_DONTNEED);
+			dropped_to = upto;
+		}
+	}
+
+	// The last window is only partly covered by the log.
+	if (win.arrivals || win.entries[NORTHBOUND] || win.entries[SOUTHBOUND]) {
+		print_window(&win, next_window - window, last_time + 1 - (next_window - window), tps, quiet);
+	}
+
+	printf("%llu records, %.2f hours\n", n, last_time / tps / 3600);
+	for (dir = 0; dir < 2; dir++) {
+		printf("%s: %llu arrivals, %llu through (%.1f/h), wait p50 %.1f s, p90 %.1f s, p99 %.1f s, p99.9 %.1f s, max %.1f s\n",
+		       dir == NORTHBOUND ? "northbound" : "southbound", arrivals[dir], entries[dir],
+		       last_time ? entries[dir] * 3600 * tps / last_time : 0.0,
+		       percentile(&wait[dir], 0.5, tps), percentile(&wait[dir], 0.9, tps),
+		       percentile(&wait[dir], 0.99, tps), percentile(&wait[dir], 0.999, tps),
+		       wait[dir].max / tps);
+	}
+	printf("all: wait p50 %.1f s, p99 %.1f s, max %.1f s\n",
+	       percentile(&all, 0.5, tps), percentile(&all, 0.99, tps), all.max / tps);
+	printf("%llu switches of the green direction, %llu all-red periods\n", switches, all_red);
+	printf("%llu unsafe entries, %llu starved queues", unsafe, starved);
+	if (unmatched) {
+		printf(", %llu entries without an arrival", unmatched);
+	}
+	printf("\n");
+	munmap((void*)map, st.st_size);
+	return unsafe ? 1 : 0;
+}
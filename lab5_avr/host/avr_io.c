@@ -0,0 +1,35 @@
+/*
+ * Register file behind the host <avr/io.h>.
+ */
+
+#include <avr/io.h>
+
+_Thread_local volatile uint8_t host_lcd_regs[19];
+_Thread_local volatile uint8_t host_lcd_ctrl[4];
+_Thread_local volatile uint8_t host_usart_regs[6];
+_Thread_local volatile uint8_t host_ee_regs[2];
+_Thread_local volatile uint8_t host_timer2_regs[5];
+_Thread_local volatile uint8_t host_portb_regs[4] = { 0xff };
+_Thread_local volatile uint16_t host_eear;
+_Thread_local volatile uint8_t host_sreg;
+_Thread_local uint8_t host_eeprom[512];
+
+volatile uint8_t* host_eecr(void) {
+	uint8_t c = host_ee_regs[0];
+	if (c & (1 << EEWE)) {
+		// Without EEMWE set before it, EEWE writes nothing.
+		if (c & (1 << EEMWE)) {
+			host_eeprom[host_eear % sizeof(host_eeprom)] = host_ee_regs[1];
+		}
+		host_ee_regs[0] = c & ~((1 << EEWE) | (1 << EEMWE));
+	}
+	return &host_ee_regs[0];
+}
+
+volatile uint8_t* host_eedr(void) {
+	if (host_ee_regs[0] & (1 << EERE)) {
+		host_ee_regs[1] = host_eeprom[host_eear % sizeof(host_eeprom)];
+		host_ee_regs[0] &= ~(1 << EERE);
+	}
+	return &host_ee_regs[1];
+}
@@ -0,0 +1,310 @@
+/*
+ * Bridge environment model, see bridge.h.
+ */
+
+#include "bridge.h"
+
+#include <math.h>
+#include <avr/io.h>
+#include "common.h"
+
+#define GREEN_BIT(dir) ((dir) == NORTHBOUND ? NB_GREEN : SB_GREEN)
+#define ARRIVAL_BIT(dir) ((dir) == NORTHBOUND ? NB_CAR_ARRIVAL : SB_CAR_ARRIVAL)
+#define ENTRY_BIT(dir) ((dir) == NORTHBOUND ? NB_BRIDGE_ENTRY : SB_BRIDGE_ENTRY)
+#define OTHER(dir) ((dir) == NORTHBOUND ? SOUTHBOUND : NORTHBOUND)
+
+static uint64_t next_u64(struct Bridge* b) {
+	// xorshift64*
+	b->rng ^= b->rng >> 12;
+	b->rng ^= b->rng << 25;
+	b->rng ^= b->rng >> 27;
+	return b->rng * 2685821657736338717ULL;
+}
+
+Time bridge_random(struct Bridge* b, Time lo, Time hi) {
+	if (hi <= lo) {
+		return lo;
+	}
+	return lo + (Time)((next_u64(b) >> 16) % (uint64_t)(hi - lo + 1));
+}
+
+static Time next_arrival(struct Bridge* b, int dir) {
+	Time mean = b->cfg.mean_arrival[dir];
+	double u;
+	if (mean <= 0) {
+		return TIME_INFINITY;
+	}
+	// Exponential inter-arrival times (Poisson traffic).
+	u = ((next_u64(b) >> 11) + 1) * (1.0 / 9007199254740993.0);
+	return tt_host_now() + 1 + (Time)(-log(u) * mean);
+}
+
+static void trace(struct Bridge* b, int kind, int dir, Time wait) {
+	struct BridgeEvent e;
+	if (!b->trace) {
+		return;
+	}
+	e.time = tt_host_now();
+	e.kind = kind;
+	e.dir = dir;
+	e.lights = b->lights;
+	e.on_bridge = b->on_bridge;
+	e.queue[NORTHBOUND] = b->queue[NORTHBOUND];
+	e.queue[SOUTHBOUND] = b->queue[SOUTHBOUND];
+	e.wait = wait;
+	b->trace(b->trace_ctx, &e);
+}
+
+// Deliver one sensor byte to the controller as a receive interrupt.
+static void send(struct Bridge* b, int bit) {
+	if (b->serial) {
+		b->serial(b->serial_ctx, CAPTURE_RX, 1 << bit, tt_host_now());
+	}
+	UDR0 = 1 << bit;
+	tt_host_irq(IRQ_USART0_RX);
+}
+
+static int is_green(struct Bridge* b, int dir) {
+	return (b->lights >> GREEN_BIT(dir)) & 1;
+}
+
+// Count the time since the last call towards all_red, if both lights were
+// red and cars were waiting. Called before the lights or the queues change.
+static void account(struct Bridge* b) {
+	Time now = tt_host_now();
+	if (!is_green(b, NORTHBOUND) && !is_green(b, SOUTHBOUND) &&
+	    (b->queue[NORTHBOUND] > 0 || b->queue[SOUTHBOUND] > 0)) {
+		b->all_red += now - b->accounted;
+	}
+	b->accounted = now;
+}
+
+static void schedule_entry(struct Bridge* b, int dir) {
+	Time t;
+	if (!is_green(b, dir) || b->queue[dir] == 0 || b->next_entry[dir] != TIME_INFINITY) {
+		return;
+	}
+	t = tt_host_now() + bridge_random(b, b->cfg.entry_min, b->cfg.entry_max);
+	if (b->entries[dir] && t < b->last_entry[dir] + b->cfg.gap) {
+		t = b->last_entry[dir] + b->cfg.gap;
+	}
+	b->next_entry[dir] = t;
+}
+
+static void set_lights(struct Bridge* b, uint8_t lights) {
+	int dir;
+	account(b);
+	b->lights = lights;
+	for (dir = 0; dir < 2; dir++) {
+		if (is_green(b, dir)) {
+			schedule_entry(b, dir);
+		} else {
+			b->next_entry[dir] = TIME_INFINITY;
+		}
+	}
+	trace(b, BRIDGE_LIGHTS, 0, 0);
+}
+
+static void transmit(void* ctx, Time now, uint8_t data, Time latency) {
+	struct Bridge* b = ctx;
+	if (b->serial) {
+		// A COM_CAPTURE build records the time of the decision.
+		b->serial(b->serial_ctx, CAPTURE_TX, data, now - latency);
+	}
+	set_lights(b, data);
+}
+
+static void arrive(struct Bridge* b, int dir) {
+	Time now = tt_host_now();
+	if (b->queue[dir] < BRIDGE_MAX_QUEUE) {
+		account(b);
+		b->arrived[dir][(b->head[dir] + b->queue[dir]) % BRIDGE_MAX_QUEUE] = now;
+		if (b->queue[dir] == 0) {
+			b->head_since[dir] = now;
+		}
+		b->queue[dir]++;
+		b->arrivals[dir]++;
+		trace(b, BRIDGE_ARRIVAL, dir, 0);
+		send(b, ARRIVAL_BIT(dir));
+		schedule_entry(b, dir);
+	}
+	b->next_arrival[dir] = next_arrival(b, dir);
+}
+
+static void enter(struct Bridge* b, int dir) {
+	Time now = tt_host_now();
+	Time wait = now - b->arrived[dir][b->head[dir]];
+	int i;
+
+	account(b);
+	b->next_entry[dir] = TIME_INFINITY;
+	b->head[dir] = (b->head[dir] + 1) % BRIDGE_MAX_QUEUE;
+	b->queue[dir]--;
+	b->head_since[dir] = now;
+	b->starved[dir] = 0;
+	if (wait > b->max_wait[dir]) {
+		b->max_wait[dir] = wait;
+	}
+
+	for (i = 0; i < b->on_bridge; i++) {
+		if (b->cars[i].dir != dir) {
+			b->unsafe++;
+			trace(b, BRIDGE_UNSAFE, dir, wait);
+			break;
+		}
+	}
+	if (b->on_bridge < BRIDGE_MAX_CARS) {
+		b->cars[b->on_bridge].dir = dir;
+		b->cars[b->on_bridge].exit = now + bridge_random(b, b->cfg.cross_min, b->cfg.cross_max);
+		b->on_bridge++;
+	}
+	b->entries[dir]++;
+	b->last_entry[dir] = now;
+	trace(b, BRIDGE_ENTRY, dir, wait);
+	send(b, ENTRY_BIT(dir));
+	schedule_entry(b, dir);
+}
+
+static void leave(struct Bridge* b, int car) {
+	int dir = b->cars[car].dir;
+	b->cars[car] = b->cars[--b->on_bridge];
+	trace(b, BRIDGE_EXIT, dir, 0);
+}
+
+static Time starve_time(struct Bridge* b, int dir) {
+	if (b->queue[dir] == 0 || b->starved[dir] || b->cfg.wait_bound <= 0) {
+		return TIME_INFINITY;
+	}
+	return b->head_since[dir] + b->cfg.wait_bound + 1;
+}
+
+static void starve(struct Bridge* b, int dir) {
+	b->starved[dir] = 1;
+	b->starvations++;
+	trace(b, BRIDGE_STARVED, dir, tt_host_now() - b->head_since[dir]);
+}
+
+// Time of the next environment event and what it is: 0..1 arrival,
+// 2..3 entry, 4..5 starvation check, 6 + i exit of car i.
+static Time next_event(struct Bridge* b, int* which) {
+	Time t = TIME_INFINITY;
+	int dir, i;
+	for (dir = 0; dir < 2; dir++) {
+		if (b->next_arrival[dir] < t) {
+			t = b->next_arrival[dir];
+			*which = dir;
+		}
+		if (b->next_entry[dir] < t) {
+			t = b->next_entry[dir];
+			*which = 2 + dir;
+		}
+		if (starve_time(b, dir) < t) {
+			t = starve_time(b, dir);
+			*which = 4 + dir;
+		}
+	}
+	for (i = 0; i < b->on_bridge; i++) {
+		if (b->cars[i].exit < t) {
+			t = b->cars[i].exit;
+			*which = 6 + i;
+		}
+	}
+	return t;
+}
+
+void bridge_default_config(struct BridgeConfig* cfg) {
+	cfg->mean_arrival[NORTHBOUND] = SEC(5);
+	cfg->mean_arrival[SOUTHBOUND] = SEC(5);
+	cfg->entry_min = 0;
+	cfg->entry_max = 0;
+	cfg->gap = MSEC(DELAY_CROSSING);
+	cfg->cross_min = MSEC(TIME_CROSS_BRIDGE);
+	cfg->cross_max = MSEC(TIME_CROSS_BRIDGE);
+	cfg->wait_bound = SEC(60);
+}
+
+void bridge_init(struct Bridge* b, const struct BridgeConfig* cfg, uint64_t seed,
+                 struct Communicator* com, struct Traffichandler* ctrl) {
+	struct Communicator c = initCommunicator(ctrl);
+	struct Traffichandler t = initTraffichandler(com);
+	int dir;
+
+	*com = c;
+	*ctrl = t;
+
+	b->cfg = *cfg;
+	b->rng = seed * 0x9e3779b97f4a7c15ULL + 0x2545f4914f6cdd1dULL;
+	b->lights = 0;
+	b->on_bridge = 0;
+	b->unsafe = 0;
+	b->starvations = 0;
+	b->all_red = 0;
+	b->accounted = 0;
+	b->com = com;
+	b->ctrl = ctrl;
+	b->trace = NULL;
+	b->serial = NULL;
+	for (dir = 0; dir < 2; dir++) {
+		b->queue[dir] = 0;
+		b->head[dir] = 0;
+		b->head_since[dir] = 0;
+		b->next_entry[dir] = TIME_INFINITY;
+		b->last_entry[dir] = 0;
+		b->starved[dir] = 0;
+		b->arrivals[dir] = 0;
+		b->entries[dir] = 0;
+		b->max_wait[dir] = 0;
+	}
+
+	tt_host_reset();
+	tt_host_on_transmit(transmit, b);
+	UCSR0A = 1 << UDRE0;   // the transmitter is always ready on the host
+	INSTALL(com, com_receive_ready, IRQ_USART0_RX);
+	INSTALL_FAST(com, com_data_register_ready, IRQ_USART0_UDRE);
+	TINYTIMBER(ctrl, traffichandler_init, 0);
+
+	for (dir = 0; dir < 2; dir++) {
+		b->next_arrival[dir] = next_arrival(b, dir);
+	}
+}
+
+void bridge_restart(struct Bridge* b, const struct JournalState* s) {
+	struct Communicator c = initCommunicator(b->ctrl);
+	struct Traffichandler t = initTraffichandler(b->com);
+
+	tt_host_load(NULL, 0, tt_host_now());
+	*b->com = c;
+	*b->ctrl = t;
+	set_lights(b, (1 << NB_RED) | (1 << SB_RED));
+	if (s) {
+		traffichandler_restore(b->ctrl, s);
+	}
+	TINYTIMBER(b->ctrl, traffichandler_init, 0);
+}
+
+void bridge_run(struct Bridge* b, Time until) {
+	for (;;) {
+		int which = 0;
+		Time te = next_event(b, &which);
+		Time tk = tt_host_next();
+		if (tk > until && te > until) {
+			break;
+		}
+		if (tk < te || (tk == te && (next_u64(b) >> 63))) {
+			tt_host_step();
+			continue;
+		}
+		tt_host_advance(te);
+		if (which < 2) {
+			arrive(b, which);
+		} else if (which < 4) {
+			enter(b, which - 2);
+		} else if (which < 6) {
+			starve(b, which - 4);
+		} else {
+			leave(b, which - 6);
+		}
+	}
+	tt_host_advance(until);
+	account(b);
+}
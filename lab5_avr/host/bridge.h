@@ -0,0 +1,126 @@
+#ifndef BRIDGE_H_
+#define BRIDGE_H_
+
+/* Bridge environment model
+Plays the part of the lab's bridge simulator against the host build of the
+controller: cars arrive at both ends, wait for green, enter the bridge one at
+a time and leave it again after the crossing time. Sensor activations are fed
+to the Communicator as USART0 receive interrupts, and light changes are taken
+from the bytes the Communicator sends (tt_host_on_transmit).
+
+The model also keeps the statistics and the checks needed by the host tools:
+cars of opposite directions on the bridge at once, and how long the car at the
+head of each queue has been waiting since it got there, and how long both
+lights were red while cars were waiting. Under overload the
+total wait grows without bound whatever the controller does, so starvation
+is judged on the head of the queue only.
+*/
+
+#include <stdint.h>
+#include "tinytimber_host.h"
+#include "common.h"
+#include "objects/communicator.h"
+#include "objects/traffichandler.h"
+#include "objects/capture.h"
+
+struct JournalState;
+
+#define BRIDGE_MAX_QUEUE 256   // cars waiting in one direction
+#define BRIDGE_MAX_CARS  32    // cars on the bridge at once
+
+enum BridgeEventKind {
+	BRIDGE_ARRIVAL,   // a car joined the queue
+	BRIDGE_ENTRY,     // a car entered the bridge
+	BRIDGE_EXIT,      // a car left the bridge
+	BRIDGE_LIGHTS,    // the controller wrote a new light byte
+	BRIDGE_UNSAFE,    // a car entered with the other direction on the bridge
+	BRIDGE_STARVED,   // the head of a queue waited longer than the bound
+};
+
+struct BridgeEvent {
+	Time time;
+	uint8_t kind;      // enum BridgeEventKind
+	uint8_t dir;       // NORTHBOUND or SOUTHBOUND
+	uint8_t lights;    // light byte in effect after the event
+	uint8_t on_bridge; // cars on the bridge after the event
+	int16_t queue[2];  // queue lengths after the event
+	Time wait;         // BRIDGE_ENTRY: time since arrival, BRIDGE_STARVED: time at the head
+};
+
+typedef void (*BridgeTrace)(void* ctx, const struct BridgeEvent* e);
+
+// Called for every byte on the serial link, with the time a COM_CAPTURE
+// build would record for it: CAPTURE_RX for sensor bytes, CAPTURE_TX for
+// light bytes written by the controller.
+typedef void (*BridgeSerial)(void* ctx, uint8_t kind, uint8_t data, Time t);
+
+struct BridgeConfig {
+	Time mean_arrival[2];     // mean time between arrivals, 0 = no traffic
+	Time entry_min, entry_max;// reaction time from green to entering
+	Time gap;                 // least time between cars entering from one side
+	Time cross_min, cross_max;// time it takes to cross the bridge
+	Time wait_bound;          // report heads of queue waiting longer than this
+};
+
+struct BridgeCar {
+	uint8_t dir;
+	Time exit;
+};
+
+struct Bridge {
+	struct BridgeConfig cfg;
+	uint64_t rng;
+	uint8_t lights;                  // last byte written by the controller
+	int16_t queue[2];
+	Time arrived[2][BRIDGE_MAX_QUEUE]; // arrival times, ring per direction
+	int16_t head[2];
+	Time head_since[2];              // when the current head reached the head
+	Time next_arrival[2];
+	Time next_entry[2];              // TIME_INFINITY while nobody may enter
+	Time last_entry[2];
+	struct BridgeCar cars[BRIDGE_MAX_CARS];
+	int on_bridge;
+	int starved[2];                  // head already reported as starved
+
+	// Statistics.
+	unsigned long arrivals[2];
+	unsigned long entries[2];
+	unsigned long unsafe;
+	unsigned long starvations;
+	Time max_wait[2];
+	Time all_red;                    // both lights red with cars queued
+	Time accounted;                  // all_red is counted up to here
+
+	struct Communicator* com;
+	struct Traffichandler* ctrl;
+	BridgeTrace trace;
+	void* trace_ctx;
+	BridgeSerial serial;
+	void* serial_ctx;
+};
+
+// Default timing of the lab simulator: 1 s between cars, 5 s on the bridge.
+void bridge_default_config(struct BridgeConfig* cfg);
+
+// Set up the model, the kernel and the two controller objects. The kernel
+// is reset, the receive handler installed and the controller started, like
+// main() does on the target.
+void bridge_init(struct Bridge* b, const struct BridgeConfig* cfg, uint64_t seed,
+                 struct Communicator* com, struct Traffichandler* ctrl);
+
+// Reset the controller at the current time, as the watchdog would: the
+// pending messages are lost, both objects start afresh and the lights go
+// red, as initiate() sends them. If `s` is not NULL the controller takes
+// over that journal state, as after a crash. The installed handlers and
+// the cars of the model are kept.
+void bridge_restart(struct Bridge* b, const struct JournalState* s);
+
+// Run the controller and the environment together up to time `until`.
+// Messages and environment events due at the same time are interleaved
+// in a random order.
+void bridge_run(struct Bridge* b, Time until);
+
+// Uniform random number in [lo, hi] from the model's generator.
+Time bridge_random(struct Bridge* b, Time lo, Time hi);
+
+#endif /* BRIDGE_H_ */
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Build the host simulation tools into host/out.
+#
+#   host/build.sh [tool...]      (default: all tools)
+#
+# Environment: CC (cc), CFLAGS (-O2 -g) and OUT (host/out).
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC="$HERE/../lab5_avr"
+OUT=${OUT:-"$HERE/out"}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-O2 -g"}
+
+# The application objects, built unmodified against the host kernel.
+APP="$SRC/objects/traffichandler.c $SRC/objects/communicator.c $SRC/objects/config.c $SRC/objects/storage.c $SRC/objects/display.c $SRC/objects/calibration.c $SRC/lcd.c"
+KERNEL="$HERE/tinytimber_host.c $HERE/avr_io.c"
+# The harness is handed the latency of every light state (COM_TRANSMIT), so
+# the communicator keeps its latency stamps.
+FLAGS="-std=gnu11 -Wall -DTT_TIME64 -DMSG_PAYLOAD=16 -DCOM_LATENCY_STATS -I$HERE/include -I$HERE -I$SRC"
+
+TOOLS=${*:-"explore modelcheck replay simlog analyze sweep fleet soabench latency profile lcdcheck restart journal"}
+mkdir -p "$OUT"
+for tool in $TOOLS; do
+	DEFS=""
+	case $tool in
+	explore) EXTRA="$HERE/bridge.c $HERE/capture_file.c" ;;
+	modelcheck) EXTRA="" ;;
+	replay) EXTRA="$HERE/capture_file.c" ;;
+	simlog) EXTRA="$HERE/bridge.c $HERE/eventlog.c" ;;
+	analyze) EXTRA="" ;;
+	sweep) EXTRA="$HERE/bridge.c" ;;
+	fleet) EXTRA="$HERE/bridge.c" ;;
+	soabench) EXTRA="$HERE/soa.c" ;;
+	latency) EXTRA="" ;;
+	profile) EXTRA="" ;;
+	lcdcheck) EXTRA="$HERE/bridge.c"; DEFS="-DTT_STATS" ;;
+	restart) EXTRA="$HERE/bridge.c" ;;
+	journal) EXTRA="" ;;
+	*) echo "unknown tool: $tool" >&2; exit 2 ;;
+	esac
+	$CC $CFLAGS $FLAGS $DEFS -o "$OUT/$tool" "$HERE/$tool.c" $EXTRA $KERNEL $APP -lm -pthread
+done
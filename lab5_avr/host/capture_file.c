@@ -0,0 +1,47 @@
+/*
+ * Capture file records, see capture_file.h and objects/capture.h.
+ */
+
+#include "capture_file.h"
+
+void capture_write(struct CaptureWriter* w, uint8_t kind, uint8_t data, Time t) {
+	int64_t delta = (int64_t)(t - w->last);
+	uint64_t z = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+	uint64_t v = (z << 2) | kind;
+
+	w->last = t;
+	while (v >= 0x80) {
+		fputc((int)(v & 0x7f) | 0x80, w->f);
+		v >>= 7;
+	}
+	fputc((int)v, w->f);
+	fputc(data, w->f);
+}
+
+int capture_read(FILE* f, Time* last, struct CaptureRecord* r) {
+	uint64_t v = 0, z;
+	int shift = 0, c;
+
+	while ((c = fgetc(f)) != EOF) {
+		if (shift > 56) {
+			return -1;
+		}
+		v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+		if (!(c & 0x80)) {
+			break;
+		}
+	}
+	if (c == EOF) {
+		return shift ? -1 : 0;
+	}
+	if ((c = fgetc(f)) == EOF) {
+		return -1;
+	}
+	z = v >> 2;
+	*last += (Time)((int64_t)(z >> 1) ^ -(int64_t)(z & 1));
+	r->time = *last;
+	r->kind = v & 3;
+	r->data = (uint8_t)c;
+	return 1;
+}
@@ -0,0 +1,33 @@
+#ifndef CAPTURE_FILE_H_
+#define CAPTURE_FILE_H_
+
+/* Capture files
+Reads and writes the record stream of objects/capture.h: the bytes shifted
+out of the USI by a COM_CAPTURE build, saved to a file as they came, or
+written by the host tools in the same format.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include "TinyTimber.h"
+#include "objects/capture.h"
+
+struct CaptureRecord {
+	Time time;       // absolute, the sum of the deltas so far
+	uint8_t kind;    // CAPTURE_RX, CAPTURE_TX or CAPTURE_DROPPED
+	uint8_t data;
+};
+
+struct CaptureWriter {
+	FILE* f;
+	Time last;
+};
+
+void capture_write(struct CaptureWriter* w, uint8_t kind, uint8_t data, Time t);
+
+// Read the next record into `r`, `last` holds the time of the previous
+// one (0 at the start). Returns 1 on success, 0 at the end of the file and
+// -1 on a truncated or malformed record.
+int capture_read(FILE* f, Time* last, struct CaptureRecord* r);
+
+#endif /* CAPTURE_FILE_H_ */
@@ -0,0 +1,49 @@
+/*
+ * Binary event log writer, see eventlog.h.
+ */
+
+#include "eventlog.h"
+
+#include <string.h>
+
+_Static_assert(sizeof(struct EventLogHeader) == 32, "event log header layout");
+_Static_assert(sizeof(struct EventLogRecord) == 16, "event log record layout");
+
+int eventlog_open(struct EventLog* log, const char* path, uint64_t seed) {
+	struct EventLogHeader h;
+
+	if (!(log->f = fopen(path, "wb"))) {
+		return -1;
+	}
+	// Records are small; write them in large blocks.
+	setvbuf(log->f, NULL, _IOFBF, 1 << 20);
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, EVENTLOG_MAGIC, sizeof(h.magic));
+	h.version = EVENTLOG_VERSION;
+	h.record_size = sizeof(struct EventLogRecord);
+	h.ticks_per_sec = TICKS_PER_SEC;
+	h.byte_order = EVENTLOG_BYTE_ORDER;
+	h.seed = seed;
+	log->records = 0;
+	return fwrite(&h, sizeof(h), 1, log->f) == 1 ? 0 : -1;
+}
+
+void eventlog_append(void* ctx, const struct BridgeEvent* e) {
+	struct EventLog* log = ctx;
+	struct EventLogRecord r;
+
+	r.time = (uint64_t)e->time;
+	r.kind = e->kind;
+	r.dir = e->dir;
+	r.lights = e->lights;
+	r.on_bridge = e->on_bridge;
+	r.queue[0] = (uint16_t)e->queue[0];
+	r.queue[1] = (uint16_t)e->queue[1];
+	fwrite(&r, sizeof(r), 1, log->f);
+	log->records++;
+}
+
+int eventlog_close(struct EventLog* log) {
+	int failed = ferror(log->f);
+	return (fclose(log->f) || failed) ? -1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef EVENTLOG_H_
+#define EVENTLOG_H_
+
+/* Binary event log
+Bridge events of a host simulation as fixed-size records, for runs far too
+long for text logs. The file is a 32-byte header followed by 16-byte
+records in time order, in the byte order of the machine that wrote it
+(checked through `byte_order`). It is only ever appended to and the header
+holds no record count, so the file of a run that was stopped is still
+valid up to its last whole record; the count is (size - header) / 16.
+Records are naturally aligned, so the file can be mapped and read in
+place as an array.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include "bridge.h"
+
+#define EVENTLOG_MAGIC      "TTEVLOG"   // with the terminating NUL, 8 bytes
+#define EVENTLOG_VERSION    1
+#define EVENTLOG_BYTE_ORDER 0x01020304u
+
+struct EventLogHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;     // sizeof(struct EventLogRecord)
+	uint32_t ticks_per_sec;   // unit of `time`
+	uint32_t byte_order;      // EVENTLOG_BYTE_ORDER as written
+	uint64_t seed;            // of the simulation, for reproducing it
+};
+
+struct EventLogRecord {
+	uint64_t time;            // ticks since the start of the run
+	uint8_t kind;             // enum BridgeEventKind
+	uint8_t dir;              // NORTHBOUND or SOUTHBOUND
+	uint8_t lights;           // light byte in effect after the event
+	uint8_t on_bridge;        // cars on the bridge after the event
+	uint16_t queue[2];        // queue depths after the event
+};
+
+struct EventLog {
+	FILE* f;
+	unsigned long long records;
+};
+
+// Create `path` and write the header. Returns 0 on success, -1 with errno
+// set otherwise.
+int eventlog_open(struct EventLog* log, const char* path, uint64_t seed);
+
+// Append one event. Usable directly as the trace hook of a Bridge, with
+// the EventLog as its context.
+void eventlog_append(void* ctx, const struct BridgeEvent* e);
+
+// Flush and close. Returns 0 if every record was written.
+int eventlog_close(struct EventLog* log);
+
+#endif /* EVENTLOG_H_ */
@@ -0,0 +1,237 @@
+/*
+ * Randomized schedule explorer for the traffic controller.
+ *
+ * Runs the real Traffichandler/Communicator objects on the host kernel
+ * against the bridge model, over many episodes with random traffic,
+ * random driver reaction times and crossing times, and random ordering of
+ * events that happen at the same instant. Every episode is checked for
+ * the requirements listed in traffichandler.h:
+ *   - safety: a car entered while the other direction was on the bridge,
+ *   - progress/starvation: a car waited at the head of its queue longer than a bound,
+ *   - any failed ASSERT or kernel error in the controller.
+ * Episodes are spread over worker threads. Each episode is reproducible
+ * from its seed; run it again with --first <seed> --episodes 1 --trace.
+ * With --capture, the serial traffic of a single episode is written to a
+ * file in the format of objects/capture.h, for host/replay.
+ *
+ *   explore [--threads n] [--episodes n] [--minutes m] [--first seed]
+ *           [--wait-bound s] [--trace] [--capture file]
+ */
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+
+#include "bridge.h"
+#include "capture_file.h"
+
+#define TRACE_LEN 48
+#define MAX_REPORTS 5
+
+struct options {
+	int threads;
+	unsigned long episodes;
+	unsigned long first;
+	double minutes;
+	double wait_bound;
+	int trace;
+	const char* capture;
+};
+
+struct episode {
+	struct Bridge bridge;
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	struct BridgeEvent ring[TRACE_LEN];
+	unsigned long events;
+	const char* failure;   // NULL while the episode is fine
+	char what[160];
+	jmp_buf abort;
+};
+
+static struct options opt = { 0, 100000, 1, 10, 60, 0, NULL };
+static struct CaptureWriter capture;
+static atomic_ulong next_episode;
+static atomic_ulong total_events;
+static atomic_ulong failed_episodes;
+static atomic_int reports;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* kind_name[] = { "arrival", "entry", "exit", "lights", "UNSAFE", "STARVED" };
+
+static void record(void* ctx, const struct BridgeEvent* e) {
+	struct episode* ep = ctx;
+	ep->ring[ep->events % TRACE_LEN] = *e;
+	ep->events++;
+	if (e->kind == BRIDGE_UNSAFE && !ep->failure) {
+		ep->failure = "opposite directions on the bridge";
+	} else if (e->kind == BRIDGE_STARVED && !ep->failure) {
+		ep->failure = "queue waited beyond the bound";
+	}
+}
+
+static void serial(void* ctx, uint8_t kind, uint8_t data, Time t) {
+	capture_write(ctx, kind, data, t);
+}
+
+static void on_failure(void* ctx, const char* what, const char* file, int line) {
+	struct episode* ep = ctx;
+	snprintf(ep->what, sizeof(ep->what), "%s (%s:%d)", what, file, line);
+	ep->failure = ep->what;
+	longjmp(ep->abort, 1);
+}
+
+static void print_event(const struct BridgeEvent* e) {
+	printf("  %10.3f s  %-8s %s  lights=%x  queue N=%d S=%d  bridge=%d",
+	       (double)e->time / TICKS_PER_SEC, kind_name[e->kind],
+	       e->kind == BRIDGE_LIGHTS ? " " : (e->dir == NORTHBOUND ? "N" : "S"),
+	       e->lights, e->queue[NORTHBOUND], e->queue[SOUTHBOUND], e->on_bridge);
+	if (e->kind == BRIDGE_ENTRY || e->kind == BRIDGE_STARVED || e->kind == BRIDGE_UNSAFE) {
+		printf("  wait=%.3f s", (double)e->wait / TICKS_PER_SEC);
+	}
+	printf("\n");
+}
+
+static void report(struct episode* ep, unsigned long seed) {
+	unsigned long i, n = ep->events < TRACE_LEN ? ep->events : TRACE_LEN;
+	pthread_mutex_lock(&report_lock);
+	printf("episode %lu: %s\n", seed, ep->failure);
+	printf("  mean arrival N=%.1f s S=%.1f s, entry %.2f-%.2f s, crossing %.2f-%.2f s\n",
+	       (double)ep->bridge.cfg.mean_arrival[NORTHBOUND] / TICKS_PER_SEC,
+	       (double)ep->bridge.cfg.mean_arrival[SOUTHBOUND] / TICKS_PER_SEC,
+	       (double)ep->bridge.cfg.entry_min / TICKS_PER_SEC,
+	       (double)ep->bridge.cfg.entry_max / TICKS_PER_SEC,
+	       (double)ep->bridge.cfg.cross_min / TICKS_PER_SEC,
+	       (double)ep->bridge.cfg.cross_max / TICKS_PER_SEC);
+	printf("  last %lu events:\n", n);
+	for (i = ep->events - n; i < ep->events; i++) {
+		print_event(&ep->ring[i % TRACE_LEN]);
+	}
+	pthread_mutex_unlock(&report_lock);
+}
+
+// Draw the traffic and timing of one episode from its seed.
+static void random_config(struct Bridge* b, struct BridgeConfig* cfg) {
+	int dir;
+	bridge_default_config(cfg);
+	for (dir = 0; dir < 2; dir++) {
+		// From saturated to sparse traffic, occasionally none at all.
+		cfg->mean_arrival[dir] = bridge_random(b, 0, 7) == 0 ? 0 : bridge_random(b, MSEC(300), SEC(60));
+	}
+	cfg->entry_min = bridge_random(b, 0, MSEC(500));
+	cfg->entry_max = cfg->entry_min + bridge_random(b, 0, SEC(2));
+	// Cars may be a little faster than the 5 s the controller assumes, never slower.
+	cfg->cross_max = MSEC(TIME_CROSS_BRIDGE);
+	cfg->cross_min = cfg->cross_max - bridge_random(b, 0, MSEC(500));
+	cfg->wait_bound = (Time)(opt.wait_bound * TICKS_PER_SEC);
+}
+
+static void run_episode(struct episode* ep, unsigned long seed) {
+	struct BridgeConfig cfg;
+	Time end = (Time)(opt.minutes * 60 * TICKS_PER_SEC);
+
+	// A throwaway generator picks the configuration, then the model is seeded.
+	ep->bridge.rng = seed * 0xd1b54a32d192ed03ULL + 1;
+	random_config(&ep->bridge, &cfg);
+
+	ep->events = 0;
+	ep->failure = NULL;
+	bridge_init(&ep->bridge, &cfg, seed, &ep->com, &ep->ctrl);
+	ep->bridge.trace = record;
+	ep->bridge.trace_ctx = ep;
+	if (capture.f) {
+		ep->bridge.serial = serial;
+		ep->bridge.serial_ctx = &capture;
+	}
+	tt_host_on_failure(on_failure, ep);
+
+	if (setjmp(ep->abort) == 0) {
+		Time t;
+		// Stop at the first failure so the trace ends where it happened.
+		for (t = 0; t < end && !ep->failure; t += SEC(10)) {
+			bridge_run(&ep->bridge, t + SEC(10));
+		}
+	}
+}
+
+static void* worker(void* arg) {
+	struct episode* ep = malloc(sizeof(*ep));
+	unsigned long i;
+	(void)arg;
+	while ((i = atomic_fetch_add(&next_episode, 1)) < opt.episodes) {
+		unsigned long seed = opt.first + i;
+		run_episode(ep, seed);
+		atomic_fetch_add(&total_events, ep->events);
+		if (ep->failure) {
+			atomic_fetch_add(&failed_episodes, 1);
+			if (opt.trace || atomic_fetch_add(&reports, 1) < MAX_REPORTS) {
+				report(ep, seed);
+			}
+		}
+	}
+	free(ep);
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	struct timespec t0, t1;
+	pthread_t* threads;
+	double secs;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--trace")) opt.trace = 1;
+		else if (i + 1 < argc && !strcmp(argv[i], "--threads")) opt.threads = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--episodes")) opt.episodes = strtoul(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "--first")) opt.first = strtoul(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "--minutes")) opt.minutes = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--wait-bound")) opt.wait_bound = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--capture")) opt.capture = argv[++i];
+		else {
+			fprintf(stderr, "usage: %s [--threads n] [--episodes n] [--minutes m] "
+			        "[--first seed] [--wait-bound s] [--trace] [--capture file]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (opt.capture) {
+		if (opt.episodes != 1) {
+			fprintf(stderr, "--capture needs --episodes 1\n");
+			return 2;
+		}
+		if (!(capture.f = fopen(opt.capture, "wb"))) {
+			perror(opt.capture);
+			return 2;
+		}
+		opt.threads = 1;
+	}
+	if (opt.threads <= 0) {
+		opt.threads = get_nprocs();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	threads = calloc(opt.threads, sizeof(*threads));
+	for (i = 0; i < opt.threads; i++) {
+		pthread_create(&threads[i], NULL, worker, NULL);
+	}
+	for (i = 0; i < opt.threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (capture.f) {
+		fclose(capture.f);
+	}
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("%lu episodes of %.1f simulated minutes on %d threads in %.2f s\n",
+	       opt.episodes, opt.minutes, opt.threads, secs);
+	printf("%.0f episodes/s, %.0f environment events/s\n",
+	       opt.episodes / secs, atomic_load(&total_events) / secs);
+	printf("%lu episodes failed\n", atomic_load(&failed_episodes));
+	return atomic_load(&failed_episodes) ? 1 : 0;
+}
@@ -0,0 +1,296 @@
+/*
+ * Many independent controllers advanced together in virtual time.
+ *
+ * Every instance is a bridge with its own controller, Communicator and
+ * kernel context (see tt_host_new), with traffic from one of a few arrival
+ * rates and its own seed. All instances are advanced in rounds of one
+ * slice of virtual time. The instances are split into one shard per
+ * thread; a thread runs the instances of its own shard, and once that is
+ * done it takes the remaining instances of the other shards, so a thread
+ * that got the slow instances does not hold up a round.
+ *
+ * The application objects keep some state in thread-local globals
+ * (traffic_params, storage, display, calibration) and in the thread-local
+ * registers of <avr/io.h>. Those are copied into the thread that runs an
+ * instance before its slice and back out after it, and pending messages to
+ * storage and display are redirected when the instance changed threads.
+ *
+ * Results depend only on the seeds, not on the number of threads or on
+ * which thread ran what.
+ *
+ *   fleet [--instances n] [--hours h] [--slice s] [--threads n]
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+#include <avr/io.h>
+
+#include "bridge.h"
+#include "objects/storage.h"
+#include "objects/display.h"
+#include "objects/calibration.h"
+
+// Mean seconds between cars, northbound and southbound.
+static const double traffic[][2] = {
+	{ 3, 3 }, { 5, 5 }, { 4, 12 }, { 15, 4 }, { 10, 10 }, { 30, 45 },
+};
+#define N_TRAFFIC (int)(sizeof(traffic) / sizeof(traffic[0]))
+
+// The thread-local state of one instance while it is not running.
+struct globals {
+	struct TrafficParams params;
+	struct Storage storage;
+	struct Display display;
+	struct Calibration calibration;
+	uint8_t lcd_regs[sizeof(host_lcd_regs)];
+	uint8_t lcd_ctrl[sizeof(host_lcd_ctrl)];
+	uint8_t usart_regs[sizeof(host_usart_regs)];
+	uint8_t ee_regs[sizeof(host_ee_regs)];
+	uint8_t timer2_regs[sizeof(host_timer2_regs)];
+	uint16_t eear;
+	uint8_t sreg;
+};
+
+struct instance {
+	TTKernel* kernel;
+	struct Bridge bridge;
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	struct globals saved;
+	Object* storage_at;        // where storage and display were in the last
+	Object* display_at;        // thread, NULL before the first slice
+};
+
+// Instances [next, end) of one thread, not yet run in this round.
+struct shard {
+	atomic_int next;
+	int begin, end;
+	char pad[64 - sizeof(atomic_int) - 2 * sizeof(int)];
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long ran, stolen;
+};
+
+struct options {
+	int instances;
+	double hours;
+	double slice;              // seconds
+	int threads;
+};
+
+static struct options opt = { 10000, 1, 600, 0 };
+static struct instance* fleet;
+static struct shard* shards;
+static struct globals initial;   // the globals as the program starts
+static pthread_barrier_t round_start, round_end;
+static Time round_until;         // -1 when there are no more rounds
+
+static void copy_regs(uint8_t* to, const volatile uint8_t* from, size_t n) {
+	while (n--) {
+		*to++ = *from++;
+	}
+}
+
+static void load_regs(volatile uint8_t* to, const uint8_t* from, size_t n) {
+	while (n--) {
+		*to++ = *from++;
+	}
+}
+
+static void save_globals(struct globals* g) {
+	g->params = traffic_params;
+	g->storage = storage;
+	g->display = display;
+	g->calibration = calibration;
+	copy_regs(g->lcd_regs, host_lcd_regs, sizeof(g->lcd_regs));
+	copy_regs(g->lcd_ctrl, host_lcd_ctrl, sizeof(g->lcd_ctrl));
+	copy_regs(g->usart_regs, host_usart_regs, sizeof(g->usart_regs));
+	copy_regs(g->ee_regs, host_ee_regs, sizeof(g->ee_regs));
+	copy_regs(g->timer2_regs, host_timer2_regs, sizeof(g->timer2_regs));
+	g->eear = host_eear;
+	g->sreg = host_sreg;
+}
+
+static void load_globals(const struct globals* g) {
+	traffic_params = g->params;
+	storage = g->storage;
+	display = g->display;
+	calibration = g->calibration;
+	load_regs(host_lcd_regs, g->lcd_regs, sizeof(g->lcd_regs));
+	load_regs(host_lcd_ctrl, g->lcd_ctrl, sizeof(g->lcd_ctrl));
+	load_regs(host_usart_regs, g->usart_regs, sizeof(g->usart_regs));
+	load_regs(host_ee_regs, g->ee_regs, sizeof(g->ee_regs));
+	load_regs(host_timer2_regs, g->timer2_regs, sizeof(g->timer2_regs));
+	host_eear = g->eear;
+	host_sreg = g->sreg;
+}
+
+static void run_slice(struct instance* in, int index, Time until) {
+	TTKernel* prev = tt_host_use(in->kernel);
+
+	load_globals(&in->saved);
+	if (in->storage_at == NULL) {
+		struct BridgeConfig cfg;
+		const double* mean = traffic[index % N_TRAFFIC];
+		bridge_default_config(&cfg);
+		cfg.mean_arrival[NORTHBOUND] = (Time)(mean[NORTHBOUND] * TICKS_PER_SEC);
+		cfg.mean_arrival[SOUTHBOUND] = (Time)(mean[SOUTHBOUND] * TICKS_PER_SEC);
+		cfg.entry_max = MSEC(500);
+		bridge_init(&in->bridge, &cfg, index + 1, &in->com, &in->ctrl);
+	} else {
+		if (in->storage_at != (Object*)&storage) {
+			tt_host_retarget(in->storage_at, (Object*)&storage);
+		}
+		if (in->display_at != (Object*)&display) {
+			tt_host_retarget(in->display_at, (Object*)&display);
+		}
+	}
+	bridge_run(&in->bridge, until);
+	in->storage_at = (Object*)&storage;
+	in->display_at = (Object*)&display;
+	save_globals(&in->saved);
+
+	tt_host_use(prev);
+}
+
+// Next instance of shard `s` in this round, -1 if there is none left.
+static int claim(struct shard* s) {
+	int i;
+	if (atomic_load_explicit(&s->next, memory_order_relaxed) >= s->end) {
+		return -1;
+	}
+	i = atomic_fetch_add(&s->next, 1);
+	return i < s->end ? i : -1;
+}
+
+static void* worker(void* arg) {
+	struct worker* w = arg;
+	int i, s;
+
+	for (;;) {
+		pthread_barrier_wait(&round_start);
+		if (round_until < 0) {
+			return NULL;
+		}
+		while ((i = claim(&shards[w->id])) >= 0) {
+			run_slice(&fleet[i], i, round_until);
+			w->ran++;
+		}
+		for (s = (w->id + 1) % opt.threads; s != w->id; s = (s + 1) % opt.threads) {
+			while ((i = claim(&shards[s])) >= 0) {
+				run_slice(&fleet[i], i, round_until);
+				w->ran++;
+				w->stolen++;
+			}
+		}
+		pthread_barrier_wait(&round_end);
+	}
+}
+
+int main(int argc, char** argv) {
+	struct timespec t0, t1;
+	struct worker* workers;
+	Time end, slice, t, max_wait = 0, all_red = 0;
+	unsigned long arrivals = 0, entries = 0, unsafe = 0, starvations = 0, ran = 0, stolen = 0;
+	double secs;
+	int i, dir;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--instances")) opt.instances = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--hours")) opt.hours = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--slice")) opt.slice = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--threads")) opt.threads = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--instances n] [--hours h] [--slice s] [--threads n]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (opt.threads <= 0) {
+		opt.threads = get_nprocs();
+	}
+	if (opt.instances <= 0 || opt.hours <= 0 || opt.slice <= 0) {
+		fprintf(stderr, "--instances, --hours and --slice must be positive\n");
+		return 2;
+	}
+	end = (Time)(opt.hours * 3600 * TICKS_PER_SEC);
+	slice = (Time)(opt.slice * TICKS_PER_SEC);
+	if (slice <= 0) {
+		slice = 1;
+	}
+
+	fleet = calloc(opt.instances, sizeof(*fleet));
+	shards = calloc(opt.threads, sizeof(*shards));
+	workers = calloc(opt.threads, sizeof(*workers));
+	if (!fleet || !shards || !workers) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	save_globals(&initial);
+	for (i = 0; i < opt.instances; i++) {
+		fleet[i].kernel = tt_host_new();
+		fleet[i].saved = initial;
+	}
+	for (i = 0; i < opt.threads; i++) {
+		shards[i].begin = (long)opt.instances * i / opt.threads;
+		shards[i].end = (long)opt.instances * (i + 1) / opt.threads;
+	}
+
+	pthread_barrier_init(&round_start, NULL, opt.threads + 1);
+	pthread_barrier_init(&round_end, NULL, opt.threads + 1);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < opt.threads; i++) {
+		workers[i].id = i;
+		pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+	}
+	for (t = 0; t < end; t += slice) {
+		round_until = t + slice < end ? t + slice : end;
+		for (i = 0; i < opt.threads; i++) {
+			atomic_store(&shards[i].next, shards[i].begin);
+		}
+		pthread_barrier_wait(&round_start);
+		pthread_barrier_wait(&round_end);
+	}
+	round_until = -1;
+	pthread_barrier_wait(&round_start);
+	for (i = 0; i < opt.threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ran += workers[i].ran;
+		stolen += workers[i].stolen;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	for (i = 0; i < opt.instances; i++) {
+		struct Bridge* b = &fleet[i].bridge;
+		for (dir = 0; dir < 2; dir++) {
+			arrivals += b->arrivals[dir];
+			entries += b->entries[dir];
+			if (b->max_wait[dir] > max_wait) {
+				max_wait = b->max_wait[dir];
+			}
+		}
+		unsafe += b->unsafe;
+		all_red += b->all_red;
+		starvations += b->starvations;
+		tt_host_delete(fleet[i].kernel);
+	}
+
+	printf("%d instances x %g h in slices of %g s on %d threads in %.1f s (%.0f simulated h/s)\n",
+	       opt.instances, opt.hours, opt.slice, opt.threads, secs, opt.instances * opt.hours / secs);
+	printf("%lu slices run, %lu (%.1f%%) taken from another thread's shard\n",
+	       ran, stolen, ran ? 100.0 * stolen / ran : 0.0);
+	printf("%lu arrivals, %lu entries (%.1f cars/h per bridge), max wait %.1f s\n",
+	       arrivals, entries, entries / (opt.instances * opt.hours), (double)max_wait / TICKS_PER_SEC);
+	printf("all lights red with cars waiting %.1f s/h per bridge\n",
+	       (double)all_red / TICKS_PER_SEC / (opt.instances * opt.hours));
+	printf("%lu unsafe entries, %lu starved heads of queue\n", unsafe, starvations);
+	return unsafe > 0 || starvations > 0;
+}
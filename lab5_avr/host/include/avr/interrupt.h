@@ -0,0 +1,14 @@
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+/* Host stand-in for <avr/interrupt.h>
+Simulated interrupts never preempt application code, so masking them only
+has to keep SREG consistent.
+*/
+
+#include <avr/io.h>
+
+#define cli() (SREG = SREG & ~(1 << 7))
+#define sei() (SREG = SREG | (1 << 7))
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
@@ -0,0 +1,145 @@
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+/* Host stand-in for <avr/io.h>
+The registers used by the application objects are plain variables here, one
+copy per thread so that independent simulations can run side by side. The
+LCD data registers are kept in one array, in the same order as on the
+ATmega169 (LCDDR0 at 0xEC ... LCDDR18 at 0xFE), so address arithmetic on
+them works as on the target. Bit positions are those of the ATmega169.
+*/
+
+#include <stdint.h>
+
+extern _Thread_local volatile uint8_t host_lcd_regs[19];
+extern _Thread_local volatile uint8_t host_lcd_ctrl[4];
+extern _Thread_local volatile uint8_t host_usart_regs[6];
+extern _Thread_local volatile uint8_t host_ee_regs[2];
+extern _Thread_local volatile uint8_t host_timer2_regs[5];
+extern _Thread_local volatile uint8_t host_portb_regs[4];
+extern _Thread_local volatile uint16_t host_eear;
+extern _Thread_local volatile uint8_t host_sreg;
+extern _Thread_local uint8_t host_eeprom[512];
+
+volatile uint8_t* host_eecr(void);
+volatile uint8_t* host_eedr(void);
+
+// LCD data registers.
+#define LCDDR0  host_lcd_regs[0]
+#define LCDDR1  host_lcd_regs[1]
+#define LCDDR2  host_lcd_regs[2]
+#define LCDDR3  host_lcd_regs[3]
+#define LCDDR5  host_lcd_regs[5]
+#define LCDDR6  host_lcd_regs[6]
+#define LCDDR7  host_lcd_regs[7]
+#define LCDDR8  host_lcd_regs[8]
+#define LCDDR10 host_lcd_regs[10]
+#define LCDDR11 host_lcd_regs[11]
+#define LCDDR12 host_lcd_regs[12]
+#define LCDDR13 host_lcd_regs[13]
+#define LCDDR15 host_lcd_regs[15]
+#define LCDDR16 host_lcd_regs[16]
+#define LCDDR17 host_lcd_regs[17]
+#define LCDDR18 host_lcd_regs[18]
+
+// LCD control registers.
+#define LCDCRA  host_lcd_ctrl[0]
+#define LCDCRB  host_lcd_ctrl[1]
+#define LCDFRR  host_lcd_ctrl[2]
+#define LCDCCR  host_lcd_ctrl[3]
+
+#define LCDEN   7
+#define LCDAB   6
+#define LCDIF   4
+#define LCDIE   3
+#define LCDCS   7
+#define LCDMUX1 5
+#define LCDMUX0 4
+#define LCDPM2  2
+#define LCDPM1  1
+#define LCDPM0  0
+#define LCDCD2  2
+#define LCDCD1  1
+#define LCDCD0  0
+#define LCDCC3  3
+#define LCDCC2  2
+#define LCDCC1  1
+#define LCDCC0  0
+
+// USART0.
+#define UDR0    host_usart_regs[0]
+#define UCSR0A  host_usart_regs[1]
+#define UCSR0B  host_usart_regs[2]
+#define UCSR0C  host_usart_regs[3]
+#define UBRR0H  host_usart_regs[4]
+#define UBRR0L  host_usart_regs[5]
+
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ01  2
+#define UCSZ00  1
+
+// Status register. Interrupts are raised by the harness between messages,
+// so the I bit is only kept for code that saves and restores it.
+#define SREG    host_sreg
+
+// EEPROM, in host_eeprom. A read is done when EEDR is next used after EERE
+// is set, a write (EEMWE and EEWE) when EECR is next used, so EEWE never
+// stays set for long. IRQ_EE_READY is only raised by the harness.
+#define EECR    (*host_eecr())
+#define EEDR    (*host_eedr())
+#define EEAR    host_eear
+
+#define EERIE   3
+#define EEMWE   2
+#define EEWE    1
+#define EERE    0
+
+// Timer/Counter2. It never counts on the host, so the clock is never
+// calibrated and stays exact.
+#define TCCR2A  host_timer2_regs[0]
+#define TCNT2   host_timer2_regs[1]
+#define ASSR    host_timer2_regs[2]
+#define TIMSK2  host_timer2_regs[3]
+#define TIFR2   host_timer2_regs[4]
+
+#define CS22    2
+#define CS21    1
+#define CS20    0
+#define AS2     3
+#define TCN2UB  2
+#define OCR2UB  1
+#define TCR2UB  0
+#define TOIE2   0
+#define TOV2    0
+
+// Port B and its pin change interrupt. The pins read high, as pulled up,
+// until the harness sets PINB.
+#define PINB    host_portb_regs[0]
+#define PORTB   host_portb_regs[1]
+#define PCMSK1  host_portb_regs[2]
+#define EIMSK   host_portb_regs[3]
+
+#define PB4     4
+#define PCINT12 4
+#define PCIE1   7
+
+// Bytes the Communicator sends are handed to the harness, which plays the
+// part of the transmitter (see tt_host_on_transmit).
+void tt_host_transmit(uint8_t data, int32_t latency);
+#define COM_TRANSMIT(data, latency) tt_host_transmit(data, (int32_t)(latency))
+
+// Failed assertions in the application are reported to the host harness
+// instead of locking up the display.
+void tt_host_assert(const char* expr, const char* file, int line);
+#define ASSERT(expr) if (!(expr)) tt_host_assert(#expr, __FILE__, __LINE__)
+
+#endif /* HOST_AVR_IO_H_ */
@@ -0,0 +1,16 @@
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+/* Host stand-in for <avr/pgmspace.h>
+There is one address space on the host, so tables kept in flash on the
+target are ordinary constants and read as such.
+*/
+
+#include <stdint.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
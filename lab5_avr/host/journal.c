@@ -0,0 +1,211 @@
+/*
+ * Check of the journal in EEPROM: save, load and restore.
+ *
+ * The storage object writes the host EEPROM (host_eeprom), with IRQ_EE_READY
+ * raised as long as EERIE is set, as the interrupt would be. A reset starts
+ * storage afresh and loads the journal as initiate() does; a crash reset
+ * keeps the time, and so UPTIME(), a power-on usually starts it from 0.
+ * Checked:
+ *
+ *   ring      more records than the ring has slots, each followed by a crash
+ *             reset: the newest is loaded, the controller takes it over with
+ *             traffichandler_restore, and the next record goes to the slot
+ *             after it,
+ *   power-on  nothing is restored, even from a record written just before,
+ *             but the journal carries on after the newest record,
+ *   stale     a crash more than JOURNAL_MAX_AGE after the last record, and
+ *             one soon after a power-on, with the record from before it,
+ *             restore nothing,
+ *   torn      a record cut short by a reset is passed over for the one
+ *             before it.
+ *
+ * Fails on the first check that does not hold.
+ *
+ *   journal
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+
+#include "tinytimber_host.h"
+#include "objects/storage.h"
+#include "objects/traffichandler.h"
+
+#define PERIOD ((Time)1 << 16)   // of UPTIME()
+
+static const CrashRecord watchdog = { CRASH_WATCHDOG, 1, 0, NULL, NULL };
+static struct Storage fresh;
+static unsigned long checks;
+
+static void fail(const char* what) {
+	printf("%s\n", what);
+	exit(1);
+}
+
+// A state that differs from those of the `n` before it.
+static struct JournalState state(unsigned n) {
+	struct JournalState s;
+	memset(&s, 0, sizeof(s));
+	s.in_queue[NORTHBOUND] = n % 7;
+	s.in_queue[SOUTHBOUND] = n % 5;
+	s.on_bridge = n % 3;
+	s.last_green_direction = n % 2 ? SOUTHBOUND : NORTHBOUND;
+	s.passed_before_change = n;
+	s.stats.served[NORTHBOUND] = n;
+	s.stats.served[SOUTHBOUND] = 2 * n;
+	s.stats.switches = n / 2;
+	s.stats.max_wait = n;
+	return s;
+}
+
+// Note `s`, and write it out once the interval is up, all of it or only
+// the first `bytes` that differ.
+static void save(const struct JournalState* s, int bytes) {
+	storage_journal(s);
+	tt_host_run_until(tt_host_now() + JOURNAL_INTERVAL);
+	while ((EECR & (1 << EERIE)) && bytes-- != 0) {
+		tt_host_irq(IRQ_EE_READY);
+	}
+}
+
+// A reset at `now`, by the crash `last` or a power-on (NULL). Returns what
+// storage_load_journal returns.
+static int reset(const CrashRecord* last, Time now, struct JournalState* s) {
+	storage = fresh;
+	EECR = 0;
+	tt_host_load(NULL, 0, now);
+	INSTALL(&storage, storage_ee_ready, IRQ_EE_READY);
+	return storage_load_journal(s, last);
+}
+
+static int crash_reset(struct JournalState* s) {
+	return reset(&watchdog, tt_host_now(), s);
+}
+
+static void expect_state(const char* what, const struct JournalState* got, const struct JournalState* want) {
+	if (memcmp(got, want, sizeof(*want)) != 0) {
+		printf("%s: restored queues %d %d, on the bridge %u, served %lu %lu; expected %d %d, %u, %lu %lu\n",
+		       what, got->in_queue[NORTHBOUND], got->in_queue[SOUTHBOUND], got->on_bridge,
+		       (unsigned long)got->stats.served[NORTHBOUND], (unsigned long)got->stats.served[SOUTHBOUND],
+		       want->in_queue[NORTHBOUND], want->in_queue[SOUTHBOUND], want->on_bridge,
+		       (unsigned long)want->stats.served[NORTHBOUND], (unsigned long)want->stats.served[SOUTHBOUND]);
+		exit(1);
+	}
+	checks++;
+}
+
+static void expect_restored(const char* what, int loaded, const struct JournalState* got,
+                            const struct JournalState* want) {
+	if (!loaded) {
+		printf("%s: nothing restored\n", what);
+		exit(1);
+	}
+	expect_state(what, got, want);
+}
+
+static void expect_nothing(const char* what, int loaded) {
+	if (loaded) {
+		printf("%s: a record was restored\n", what);
+		exit(1);
+	}
+	checks++;
+}
+
+// The controller takes over what was loaded.
+static void check_restore(const struct JournalState* s) {
+	struct Traffichandler t;
+	memset(&t, 0, sizeof(t));
+	traffichandler_restore(&t, s);
+	if (t.lane[NORTHBOUND].in_queue != s->in_queue[NORTHBOUND] ||
+	    t.lane[SOUTHBOUND].in_queue != s->in_queue[SOUTHBOUND] || t.on_bridge != s->on_bridge ||
+	    t.last_green_direction != s->last_green_direction ||
+	    t.passed_before_change != s->passed_before_change ||
+	    memcmp(&t.stats, &s->stats, sizeof(t.stats)) != 0) {
+		fail("ring: the controller did not take over the restored state");
+	}
+	checks++;
+}
+
+static void check_ring(void) {
+	struct JournalState s, want;
+	unsigned n;
+
+	memset(host_eeprom, 0xff, sizeof(host_eeprom));
+	expect_nothing("blank EEPROM, crash", crash_reset(&s));
+	for (n = 1; n <= 2 * JOURNAL_SLOTS + 3; n++) {
+		want = state(n);
+		save(&want, -1);
+		tt_host_advance(tt_host_now() + SEC(1));
+		expect_restored("ring", crash_reset(&s), &s, &want);
+		if (storage.journal_slot != n % JOURNAL_SLOTS) {
+			printf("ring: record %u loaded from slot %u, written to %u\n", n, storage.journal_slot,
+			       (unsigned)(n % JOURNAL_SLOTS));
+			exit(1);
+		}
+		check_restore(&s);
+	}
+}
+
+static void check_power_on(void) {
+	struct JournalState s, want = state(1000);
+
+	tt_host_advance(tt_host_now() + 100 * PERIOD);
+	save(&want, -1);
+	expect_nothing("power-on, fresh record", reset(NULL, tt_host_now(), &s));
+	expect_nothing("power-on", reset(NULL, 0, &s));
+	// Crash soon after, before anything new was written: the record is from
+	// before the power-on.
+	tt_host_advance(SEC(1));
+	expect_nothing("crash soon after a power-on", crash_reset(&s));
+
+	want = state(1001);
+	save(&want, -1);
+	expect_restored("a record after the power-on", crash_reset(&s), &s, &want);
+}
+
+static void check_stale(void) {
+	struct JournalState s, want = state(2000);
+
+	save(&want, -1);
+	tt_host_advance(tt_host_now() + JOURNAL_MAX_AGE * PERIOD - SEC(1));
+	expect_restored("just under JOURNAL_MAX_AGE", crash_reset(&s), &s, &want);
+	tt_host_advance(tt_host_now() + 2 * PERIOD);
+	expect_nothing("over JOURNAL_MAX_AGE", crash_reset(&s));
+}
+
+static void check_torn(void) {
+	struct JournalState s, want = state(3000), cut = state(3001);
+	int bytes;
+
+	save(&want, -1);
+	for (bytes = 0; bytes < (int)sizeof(struct JournalRecord); bytes++) {
+		// Each try cuts the next record one byte later.
+		expect_restored("before the torn record", crash_reset(&s), &s, &want);
+		save(&cut, bytes);
+		if (!memcmp(host_eeprom + JOURNAL_ADDR + storage.journal_slot * sizeof(storage.journal),
+		            &storage.journal, sizeof(storage.journal))) {
+			break;
+		}
+		expect_restored("torn record", crash_reset(&s), &s, &want);
+	}
+	if (bytes == 0) {
+		fail("torn: the record was written in one go");
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return 2;
+	}
+	fresh = storage;
+	tt_host_reset();
+	check_ring();
+	check_power_on();
+	check_stale();
+	check_torn();
+	printf("%lu journal checks as expected\n", checks);
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+ * Decision-to-wire latency of the light output under bursts of traffic.
+ *
+ * The controller gets bursts of sensor bytes back to back at 9600 baud:
+ * cars arrive in both directions, and as long as a light is green the cars
+ * queued behind it enter one per byte, up to as many as fit on the bridge
+ * in the crossing time, so that most bytes received make a light decision.
+ * The USART transmitter is played at --baud: once a byte is written to
+ * UDR0, UDRE0 is clear for the time of one byte, then the data register
+ * empty interrupt is raised if it is enabled. For every light state sent
+ * the time from the decision to UDR0 is taken (COM_TRANSMIT), and it is
+ * checked that the states go out in the order they were decided. The most
+ * states the queue held at once (LightLatency.high_water) is printed; a
+ * state that finds the queue full fails the controller's assertion.
+ *
+ * Messages take no time on the host, so this is the wait behind the
+ * transmitter and behind other light states; on the target the run time
+ * of the deciding message comes on top. Fails if the 99th percentile is
+ * above --bound ms, or if a state was out of order.
+ *
+ *   latency [--bursts n] [--burst n] [--period s] [--baud n] [--bound ms] [--seed n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+
+#include "tinytimber_host.h"
+#include "common.h"
+#include "objects/communicator.h"
+#include "objects/traffichandler.h"
+
+// Start, 8 data bits and stop, rounded up to whole ticks.
+#define BYTE_TICKS(baud) (Time)((10L * TICKS_PER_SEC + (baud) - 1) / (baud))
+#define RX_TICKS BYTE_TICKS(9600)
+
+// At most one car a second enters from one side, so no more than this can
+// be on the bridge.
+#define MAX_ON_BRIDGE (TIME_CROSS_BRIDGE / DELAY_CROSSING + 1)
+
+struct options {
+	int bursts;
+	int burst;           // sensor bytes per burst
+	double period;       // seconds from one burst to the next
+	int baud;            // of the transmitter
+	double bound;        // ms
+	uint64_t seed;
+};
+
+static struct options opt = { 2000, 20, 3, 9600, 2, 1 };
+
+struct run {
+	struct Communicator com;
+	uint64_t rng;
+	int16_t queue[2];    // cars waiting, as the controller was told
+	Time entered[MAX_ON_BRIDGE];   // the last entries, a ring
+	int next_entry;
+	uint8_t lights;      // last light state on the wire
+	Time byte_ticks;     // of the transmitter
+	int left;            // bytes left in the current burst
+	Time* latency;       // one per light state sent
+	size_t n, cap;
+	Time last_decided;
+	unsigned long out_of_order;
+};
+
+static struct run run;
+
+static uint64_t next_u64(uint64_t* s) {
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ULL;
+}
+
+static void on_failure(void* ctx, const char* what, const char* file, int line) {
+	(void)ctx;
+	printf("controller failed at %.3f s: %s (%s:%d)\n",
+	       (double)tt_host_now() / TICKS_PER_SEC, what, file, line);
+	exit(1);
+}
+
+// The byte in the transmitter is out: the data register is free again.
+static void sent(void* ctx, int arg) {
+	(void)ctx;
+	(void)arg;
+	UCSR0A |= 1 << UDRE0;
+	if (UCSR0B & (1 << UDRIE0)) {
+		tt_host_irq(IRQ_USART0_UDRE);
+	}
+}
+
+static void transmit(void* ctx, Time now, uint8_t data, Time latency) {
+	struct run* r = ctx;
+	if (r->n == r->cap) {
+		r->cap = r->cap ? 2 * r->cap : 4096;
+		r->latency = realloc(r->latency, r->cap * sizeof(*r->latency));
+		if (!r->latency) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	r->latency[r->n++] = latency;
+	if (now - latency < r->last_decided) {
+		r->out_of_order++;
+	}
+	r->last_decided = now - latency;
+	r->lights = data;
+
+	UCSR0A &= ~(1 << UDRE0);
+	if (tt_host_inject(now + r->byte_ticks, sent, NULL, 0) < 0) {
+		fprintf(stderr, "too many injected events\n");
+		exit(2);
+	}
+}
+
+static int green(struct run* r, int dir) {
+	return (r->lights >> (dir == NORTHBOUND ? NB_GREEN : SB_GREEN)) & 1;
+}
+
+// The next sensor byte of a burst, made up from the lights as they are on
+// the wire now, and the one after it one byte time later.
+static void receive(void* ctx, int arg) {
+	struct run* r = ctx;
+	uint64_t x = next_u64(&r->rng);
+	uint8_t sensors = 0;
+	int dir;
+	(void)arg;
+
+	for (dir = 0; dir < 2; dir++) {
+		if (green(r, dir) && r->queue[dir] > 0 &&
+		    tt_host_now() - r->entered[r->next_entry] >= MSEC(TIME_CROSS_BRIDGE)) {
+			sensors |= 1 << (dir == NORTHBOUND ? NB_BRIDGE_ENTRY : SB_BRIDGE_ENTRY);
+			r->queue[dir]--;
+			r->entered[r->next_entry] = tt_host_now();
+			r->next_entry = (r->next_entry + 1) % MAX_ON_BRIDGE;
+		} else if ((x >> dir) & 1) {
+			sensors |= 1 << (dir == NORTHBOUND ? NB_CAR_ARRIVAL : SB_CAR_ARRIVAL);
+			r->queue[dir]++;
+		}
+	}
+	if (sensors) {
+		UDR0 = sensors;
+		tt_host_irq(IRQ_USART0_RX);
+	}
+	if (--r->left > 0) {
+		tt_host_inject(tt_host_now() + RX_TICKS, receive, r, 0);
+	}
+}
+
+static int compare_time(const void* a, const void* b) {
+	Time x = *(const Time*)a, y = *(const Time*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double ms(Time t) {
+	return (double)t * 1000 / TICKS_PER_SEC;
+}
+
+int main(int argc, char** argv) {
+	struct Traffichandler ctrl;
+	struct Communicator c = initCommunicator(&ctrl);
+	struct Traffichandler t = initTraffichandler(&run.com);
+	struct LightLatency stats;
+	Time period, p50, p99, bound;
+	unsigned long in_hist = 0;
+	int i, failed = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--bursts")) opt.bursts = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--burst")) opt.burst = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--period")) opt.period = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--baud")) opt.baud = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--bound")) opt.bound = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--seed")) opt.seed = strtoull(argv[++i], NULL, 0);
+		else {
+			fprintf(stderr, "usage: %s [--bursts n] [--burst n] [--period s] [--baud n] [--bound ms] [--seed n]\n",
+			        argv[0]);
+			return 2;
+		}
+	}
+	period = (Time)(opt.period * TICKS_PER_SEC);
+	if (opt.bursts <= 0 || opt.burst <= 0 || opt.baud <= 0 || (Time)opt.burst * RX_TICKS >= period) {
+		fprintf(stderr, "--bursts, --burst and --baud must be positive, and a burst shorter than --period\n");
+		return 2;
+	}
+	bound = (Time)(opt.bound * TICKS_PER_SEC / 1000);
+
+	run.com = c;
+	ctrl = t;
+	run.byte_ticks = BYTE_TICKS(opt.baud);
+	for (i = 0; i < MAX_ON_BRIDGE; i++) {
+		run.entered[i] = -MSEC(TIME_CROSS_BRIDGE);
+	}
+	run.rng = opt.seed * 0x9e3779b97f4a7c15ULL + 0x2545f4914f6cdd1dULL;
+	tt_host_reset();
+	tt_host_on_transmit(transmit, &run);
+	tt_host_on_failure(on_failure, NULL);
+	UCSR0A = 1 << UDRE0;
+	INSTALL(&run.com, com_receive_ready, IRQ_USART0_RX);
+	INSTALL_FAST(&run.com, com_data_register_ready, IRQ_USART0_UDRE);
+	TINYTIMBER(&ctrl, traffichandler_init, 0);
+
+	for (i = 0; i < opt.bursts; i++) {
+		run.left = opt.burst;
+		tt_host_inject((i + 1) * period, receive, &run, 0);
+		while (tt_host_batch((i + 2) * period - 1)) {
+		}
+	}
+
+	qsort(run.latency, run.n, sizeof(*run.latency), compare_time);
+	p50 = run.n ? run.latency[run.n / 2] : 0;
+	p99 = run.n ? run.latency[(run.n * 99) / 100] : 0;
+	com_latency(&run.com, &stats);
+	for (i = 0; i < COM_LATENCY_BUCKETS; i++) {
+		in_hist += stats.hist[i];
+	}
+
+	printf("%d bursts of %d sensor bytes, %zu light states sent\n", opt.bursts, opt.burst, run.n);
+	printf("decision to wire: p50 %.2f ms, p99 %.2f ms, max %.2f ms (one byte %.2f ms)\n",
+	       ms(p50), ms(p99), run.n ? ms(run.latency[run.n - 1]) : 0.0, ms(run.byte_ticks));
+	printf("on the controller: max %.2f ms, histogram", ms(stats.max));
+	for (i = 0; i < COM_LATENCY_BUCKETS; i++) {
+		printf(" %u", stats.hist[i]);
+	}
+	printf("\n%lu out of order, at most %u of %d states in the queue\n", run.out_of_order, stats.high_water,
+	       COM_LIGHTS);
+
+	if (p99 > bound) {
+		printf("FAIL: p99 above the bound of %.2f ms\n", opt.bound);
+		failed = 1;
+	}
+	if (run.out_of_order) {
+		printf("FAIL: light states out of order\n");
+		failed = 1;
+	}
+	if (run.n && (stats.max != run.latency[run.n - 1] || (run.n < UINT16_MAX && in_hist != run.n))) {
+		printf("FAIL: the controller's statistics disagree with the measurement\n");
+		failed = 1;
+	}
+	free(run.latency);
+	return failed;
+}
@@ -0,0 +1,315 @@
+/*
+ * Check of the statistics display against the host LCD registers.
+ *
+ * display_frame and display_button are installed on IRQ_LCD and IRQ_PCINT1
+ * as main() does, and the LCD interrupt is raised once per frame. A press
+ * of the joystick takes PB4 low and raises IRQ_PCINT1, and so does the
+ * release. What the LCD registers (host_lcd_regs) show is decoded back into
+ * characters with the segment codes of lcd.c, and compared with the page
+ * that should be showing after its last pass:
+ *
+ *   pages     figures handed to display_note directly, so that every page
+ *             (queues, tp, wa, sw, po) is checked with values at the limits
+ *             of the four BCD digits: 0, 9, 9999, 10000 and 65535 and up,
+ *             which show as 9999; also the colons and the light carets.
+ *             The queues must stay up until the joystick is pressed, every
+ *             press must turn one page on, a second press within
+ *             DISPLAY_BOUNCE_TIME none, and the queues must come back
+ *             after the last page.
+ *   bridge    the bridge simulation for --seconds with the frames at 16 Hz
+ *             alongside, and a press every other DISPLAY_PAGE_TIME: the last
+ *             pass of every page whose figures did not change while it was
+ *             drawn must show them, and "tp" must show the cars that entered
+ *             in the last whole window of DISPLAY_RATE_TIME, per hour.
+ *
+ * Fails on the first page that does not match.
+ *
+ *   lcdcheck [--seconds s] [--seed n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+
+#include "bridge.h"
+#include "lcd.h"
+#include "objects/display.h"
+
+#define RATE_FRAMES (DISPLAY_RATE_TIME * DISPLAY_FRAME_RATE)
+
+// The characters the display draws.
+static const char glyphs[] = "0123456789tpwaso";
+#define N_GLYPHS (int)(sizeof(glyphs) - 1)
+
+struct options {
+	double seconds;
+	uint64_t seed;
+};
+
+static struct options opt = { 600, 1 };
+
+static uint16_t segments[N_GLYPHS];
+static struct Display fresh;
+static unsigned long pages_checked;
+
+// The four nibbles of character `pos` on the LCD, without the bits of the
+// first one that are special characters.
+static uint16_t segments_at(int pos) {
+	uint16_t s = 0;
+	int i;
+
+	for (i = 3; i >= 0; i--) {
+		uint8_t r = host_lcd_regs[pos / 2 + 5 * i];
+		uint8_t nibble = pos % 2 ? r >> 4 : r & 0xf;
+		if (i == 0) {
+			nibble &= ~(SPECIAL_MASK >> (pos % 2 ? 4 : 0)) & 0xf;
+		}
+		s = (s << 4) | nibble;
+	}
+	return s;
+}
+
+static void load_glyphs(void) {
+	int i, j;
+
+	for (i = 0; i < N_GLYPHS; i++) {
+		memset((void*)host_lcd_regs, 0, sizeof(host_lcd_regs));
+		writeChar(glyphs[i], 0);
+		segments[i] = segments_at(0);
+		for (j = 0; j < i; j++) {
+			if (segments[j] == segments[i]) {
+				printf("'%c' and '%c' look the same on the LCD\n", glyphs[j], glyphs[i]);
+				exit(1);
+			}
+		}
+	}
+	memset((void*)host_lcd_regs, 0, sizeof(host_lcd_regs));
+}
+
+// What the LCD shows, '?' for anything that is not a glyph.
+static void decode(char out[DISPLAY_CHARS + 1]) {
+	int pos, i;
+
+	for (pos = 0; pos < DISPLAY_CHARS; pos++) {
+		uint16_t s = segments_at(pos);
+		out[pos] = '?';
+		for (i = 0; i < N_GLYPHS; i++) {
+			if (segments[i] == s) {
+				out[pos] = glyphs[i];
+			}
+		}
+	}
+	out[DISPLAY_CHARS] = '\0';
+}
+
+static unsigned field(int32_t v) {
+	return v < 0 ? 0 : v < 9999 ? v : 9999;
+}
+
+// The page `page` as it should show `v`, with `rate` cars per hour.
+static void expect(char out[DISPLAY_CHARS + 1], int page, const struct DisplayValues* v, unsigned rate) {
+	switch (page) {
+	case PAGE_QUEUES:
+		snprintf(out, DISPLAY_CHARS + 1, "%02u%02u%02u", field(v->in_queue[NORTHBOUND]) % 100,
+		         field(v->on_bridge) % 100, field(v->in_queue[SOUTHBOUND]) % 100);
+		break;
+	case PAGE_THROUGHPUT:
+		snprintf(out, DISPLAY_CHARS + 1, "tp%04u", field(rate));
+		break;
+	case PAGE_MAX_WAIT:
+		snprintf(out, DISPLAY_CHARS + 1, "wa%04u", field(v->max_wait));
+		break;
+	case PAGE_SWITCHES:
+		snprintf(out, DISPLAY_CHARS + 1, "sw%04u", v->switches < 9999 ? (unsigned)v->switches : 9999);
+		break;
+#ifdef TT_STATS
+	case PAGE_POOL:
+		snprintf(out, DISPLAY_CHARS + 1, "po%04u", field(MSG_HIGH_WATER()));
+		break;
+#endif
+	}
+}
+
+// The LCD against page `page` of `v`, colons and carets included.
+static void check_page(const char* what, int page, const struct DisplayValues* v, unsigned rate) {
+	char want[DISPLAY_CHARS + 1], got[DISPLAY_CHARS + 1];
+	int colons = host_lcd_regs[8] & 0x1;
+	uint8_t nb = host_lcd_regs[0] & SPECIAL_MASK, sb = host_lcd_regs[1] & SPECIAL_MASK;
+
+	expect(want, page, v, rate);
+	decode(got);
+	if (strcmp(want, got) != 0) {
+		printf("%s, page %d: shows \"%s\", expected \"%s\"\n", what, page, got, want);
+		exit(1);
+	}
+	if (colons != (page == PAGE_QUEUES)) {
+		printf("%s, page %d: colons %s\n", what, page, colons ? "on" : "off");
+		exit(1);
+	}
+	if (nb != (v->light[NORTHBOUND] == GREEN ? 1 << 2 : 1 << 1) ||
+	    sb != (v->light[SOUTHBOUND] == GREEN ? 1 << 1 : 1 << 6)) {
+		printf("%s, page %d: carets 0x%02x 0x%02x for lights %d %d\n", what, page, nb, sb,
+		       v->light[NORTHBOUND], v->light[SOUTHBOUND]);
+		exit(1);
+	}
+	pages_checked++;
+}
+
+// The display as it starts, on a blank LCD.
+static void restart(void) {
+	display = fresh;
+	memset((void*)host_lcd_regs, 0, sizeof(host_lcd_regs));
+	tt_host_reset();
+	INSTALL_FAST(&display, display_frame, IRQ_LCD);
+	INSTALL_FAST(&display, display_button, IRQ_PCINT1);
+}
+
+// The joystick centre is pressed and let go.
+static void press(void) {
+	PINB = PINB & ~(1 << PB4);
+	tt_host_irq(IRQ_PCINT1);
+	PINB = PINB | (1 << PB4);
+	tt_host_irq(IRQ_PCINT1);
+}
+
+struct page_case {
+	const char* what;
+	struct DisplayValues v;
+};
+
+static const struct page_case cases[] = {
+	{ "zeros",       { { 0, 0 }, 0, { RED, RED }, 0, 0, 0 } },
+	{ "one digit",   { { 9, 1 }, 9, { GREEN, RED }, 9, 9, 9 } },
+	{ "two digits",  { { 12, 99 }, 7, { RED, GREEN }, 100, 10, 99 } },
+	{ "negative",    { { -1, -32768 }, 0, { GREEN, GREEN }, 0, 1000, 1000 } },
+	{ "9999",        { { 100, 9999 }, 99, { RED, RED }, 9999, 9999, 9999 } },
+	{ "10000",       { { 10000, 10000 }, 100, { RED, RED }, 10000, 10000, 10000 } },
+	{ "65535 and up", { { 32767, 32767 }, 65535, { RED, RED }, 4294967295u, 65535, 4294967295u } },
+};
+#define N_CASES (int)(sizeof(cases) / sizeof(cases[0]))
+
+// The last pass of a page is drawn: the next frame turns to the next page.
+static int page_done(void) {
+	return display.pos == 0 && display.page_frames == 0;
+}
+
+// Frames up to the last pass of the page showing, which must be `page`.
+static void run_page(const char* what, int page) {
+	do {
+		tt_host_irq(IRQ_LCD);
+	} while (!page_done());
+	if (display.page != page) {
+		printf("%s: page %d shows, expected page %d\n", what, display.page, page);
+		exit(1);
+	}
+}
+
+// Every page of every case, each checked after its last pass. The first
+// figures noted start the throughput window, so "tp" shows 0.
+static void check_pages(void) {
+	int c, page, pass;
+
+	for (c = 0; c < N_CASES; c++) {
+		restart();
+		display_note(&cases[c].v);
+		// Longer than all pages would take if they turned by themselves.
+		for (pass = 0; pass < N_PAGES * DISPLAY_PAGE_TIME * DISPLAY_FRAME_RATE / DISPLAY_CHARS; pass++) {
+			run_page(cases[c].what, PAGE_QUEUES);
+		}
+		check_page(cases[c].what, PAGE_QUEUES, &cases[c].v, 0);
+		for (page = PAGE_QUEUES + 1; page < N_PAGES; page++) {
+			press();
+			run_page(cases[c].what, page);
+			check_page(cases[c].what, page, &cases[c].v, 0);
+		}
+		// Back to the queues once the last page is up.
+		run_page(cases[c].what, PAGE_QUEUES);
+		check_page(cases[c].what, PAGE_QUEUES, &cases[c].v, 0);
+	}
+
+	// A bounce is not a second press.
+	restart();
+	display_note(&cases[0].v);
+	press();
+	press();
+	run_page("bounce", PAGE_QUEUES + 1);
+}
+
+static unsigned long served(const struct Bridge* b) {
+	return b->entries[NORTHBOUND] + b->entries[SOUTHBOUND];
+}
+
+// The bridge simulation with the frames interleaved. Frame n comes at
+// n / DISPLAY_FRAME_RATE s, after everything due by then.
+static void check_bridge(void) {
+	static struct Bridge b;
+	struct BridgeConfig cfg;
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	struct DisplayValues drawn;
+	unsigned long frames = (unsigned long)(opt.seconds * DISPLAY_FRAME_RATE), n;
+	unsigned long window_start = 0, window_cars = 0;
+	unsigned rate = 0, drawn_rate = 0;
+	unsigned long tp_checked = 0;
+
+	display = fresh;
+	memset((void*)host_lcd_regs, 0, sizeof(host_lcd_regs));
+	bridge_default_config(&cfg);
+	cfg.wait_bound = 0;
+	bridge_init(&b, &cfg, opt.seed, &com, &ctrl);
+	INSTALL_FAST(&display, display_frame, IRQ_LCD);
+	INSTALL_FAST(&display, display_button, IRQ_PCINT1);
+
+	for (n = 1; n <= frames; n++) {
+		bridge_run(&b, (Time)n * TICKS_PER_SEC / DISPLAY_FRAME_RATE);
+		if (n % (2 * DISPLAY_PAGE_TIME * DISPLAY_FRAME_RATE) == 0) {
+			press();
+		}
+		if (n % RATE_FRAMES == 0) {
+			window_cars = served(&b) - window_start;
+			window_start = served(&b);
+			rate = window_cars * (3600 / DISPLAY_RATE_TIME);
+		}
+		// A pass starts in this frame.
+		if (display.pos == 0) {
+			memcpy(&drawn, &display.values, sizeof(drawn));
+			drawn_rate = rate;
+		}
+		tt_host_irq(IRQ_LCD);
+		if (page_done() && rate == drawn_rate && !memcmp(&drawn, &display.values, sizeof(drawn))) {
+			check_page("bridge", display.page, &drawn, rate);
+			tp_checked += display.page == PAGE_THROUGHPUT;
+		}
+	}
+	if (tp_checked == 0) {
+		printf("bridge: \"tp\" never checked\n");
+		exit(1);
+	}
+	printf("bridge: %lu cars in %.0f s, the last whole window %lu cars, \"tp\" shows %u cars/h\n",
+	       served(&b), opt.seconds, window_cars, field(rate));
+}
+
+int main(int argc, char** argv) {
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--seconds")) opt.seconds = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--seed")) opt.seed = strtoull(argv[++i], NULL, 0);
+		else {
+			fprintf(stderr, "usage: %s [--seconds s] [--seed n]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (opt.seconds < 2 * DISPLAY_RATE_TIME) {
+		fprintf(stderr, "--seconds must take in two windows of %d s\n", DISPLAY_RATE_TIME);
+		return 2;
+	}
+
+	fresh = display;
+	load_glyphs();
+	check_pages();
+	check_bridge();
+	printf("%lu pages as expected\n", pages_checked);
+	return 0;
+}
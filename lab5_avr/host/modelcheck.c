@@ -0,0 +1,704 @@
+/*
+ * Exhaustive model checker for the traffic controller.
+ *
+ * Explores every reachable state of the real Traffichandler/Communicator
+ * objects, run on the host kernel, against a nondeterministic bridge with
+ * bounded queues. A state is a snapshot taken at the start of a time
+ * quantum and holds:
+ *   - the controller: lane[].in_queue, lane[].light, on_bridge,
+ *     passed_before_change, light_update_pending, poll_pending,
+ *     last_green_direction and clear_at relative to now (the
+ *     Communicator never has light states waiting, as the host
+ *     transmitter is always ready),
+ *   - the kernel: every pending message with its time relative to now,
+ *   - the bridge: lights as last written, queue lengths, cars on the
+ *     bridge and how long the heads of the queues have been waiting.
+ * At each quantum boundary the environment may add a car to either queue,
+ * and a car at the head of a queue with green may enter the bridge (it
+ * must do so within --reaction quanta). Messages due exactly at the
+ * boundary are run both before and after the sensor byte. The quantum is
+ * a whole number of idle polls, so the pending message times only take a
+ * few distinct values and the state space is finite. passed_before_change
+ * is only ever compared against MAX_CARS_BEFORE_LIGHT_SWITCH, so it is
+ * saturated there.
+ *
+ * The search is a level-synchronous breadth-first search over all cores.
+ * Visited states are kept as 64-bit fingerprints in a lock-free open
+ * addressing table (hash compaction: a fingerprint collision can hide a
+ * state, with probability about states^2 / 2^65). For traces only the
+ * parent and the action of each state are kept; a counterexample is
+ * printed by replaying its actions from the initial state, and being
+ * breadth-first it is a shortest one. Checked properties:
+ *   - safety: a car enters with the other direction on the bridge,
+ *   - starvation: a car waits at the head of its queue beyond a bound,
+ *   - progress: cars are queued, nobody has green and nothing is pending,
+ *   - failed ASSERTs and kernel errors.
+ *
+ *   modelcheck [--threads n] [--queue n] [--wait-bound s] [--reaction n]
+ *              [--slots-log2 n] [--max-depth n]
+ */
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+#include <avr/io.h>
+
+#include "tinytimber_host.h"
+#include "common.h"
+#include "objects/communicator.h"
+#include "objects/traffichandler.h"
+#include "objects/storage.h"
+
+#define QUANTUM     (50 * TICKS_IDLE_POLL)  // about 0.5 s
+#define CROSS_Q     10                      // quanta on the bridge
+#define GAP_Q       2                       // quanta between cars from one side
+#define MAX_MSGS    16
+#define MAX_CARS    8
+
+// Environment actions, one bit each.
+#define A_ARRIVE(dir) (1 << (dir))
+#define A_ENTER(dir)  (4 << (dir))
+#define A_KERNEL_FIRST 16
+#define N_ACTIONS 32
+
+struct mc_msg {
+	uint8_t obj;
+	uint8_t meth;
+	int16_t arg;
+	int32_t offset;
+	int32_t deadline;  // 0 for TIME_INFINITY
+};
+
+// Packed state. Built from a zeroed struct so it can be hashed and
+// compared as bytes.
+struct state {
+	int32_t clear_in;          // clear_at - now, at least -PARAM_SWITCH_WINDOW
+	int16_t in_queue[2];
+	uint16_t on_bridge;
+	uint8_t light[2];
+	uint8_t passed;
+	uint8_t pending;
+	uint8_t poll_pending;
+	uint8_t last_green;
+
+	uint8_t lights;
+	uint8_t queue[2];
+	uint8_t head_wait[2];      // quanta the head has waited
+	uint8_t since_entry[2];    // quanta since the last entry, up to GAP_Q
+	uint8_t eligible_wait[2];  // quanta the head has been allowed to enter
+	uint8_t ncars;
+	uint8_t car_dir[MAX_CARS];
+	uint8_t car_left[MAX_CARS]; // quanta until the car is off the bridge
+
+	uint8_t nmsgs;
+	struct mc_msg msgs[MAX_MSGS];
+};
+
+struct options {
+	int threads;
+	int queue;
+	double wait_bound;
+	int reaction;
+	int slots_log2;
+	int max_depth;
+};
+
+static struct options opt = { 0, 3, 30, 1, 24, 0 };
+static int wait_bound_q;
+
+// Methods that may be found in the queues, by index.
+static const Method methods[] = {
+	(Method)traffichandler_sensors,
+	(Method)traffichandler_queue,
+	(Method)traffichandler_bridge,
+	(Method)traffichandler_leave_bridge,
+	(Method)traffichandler_check_lights,
+	(Method)traffichandler_set_light,
+	(Method)traffichandler_switch_light,
+	(Method)traffichandler_set_red_light,
+	(Method)traffichandler_print,
+	(Method)traffichandler_init,
+	(Method)com_write_data,
+	(Method)com_receive_ready,
+	(Method)com_data_register_ready,
+};
+#define N_METHODS (int)(sizeof(methods) / sizeof(methods[0]))
+
+/* per-thread simulation */
+
+struct sim {
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	struct state s;            // environment part is live during a step
+	const char* failure;
+	char what[160];
+	jmp_buf abort;
+	int verbose;
+	Time elapsed;              // time since the initial state, for traces
+};
+
+static void transmit(void* ctx, Time now, uint8_t data, Time latency) {
+	struct sim* sim = ctx;
+	(void)latency;
+	sim->s.lights = data;
+	if (sim->verbose) {
+		printf("  %9.3f s  controller writes lights %x\n",
+		       (double)(sim->elapsed + now) / TICKS_PER_SEC, data);
+	}
+}
+
+static void on_failure(void* ctx, const char* what, const char* file, int line) {
+	struct sim* sim = ctx;
+	snprintf(sim->what, sizeof(sim->what), "%s (%s:%d)", what, file, line);
+	sim->failure = sim->what;
+	longjmp(sim->abort, 1);
+}
+
+static int method_index(Method m) {
+	int i;
+	for (i = 0; i < N_METHODS; i++) {
+		if (methods[i] == m) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Snapshot the controller and the kernel into sim->s. Returns 0 if the
+// state does not fit the packed representation.
+static int pack(struct sim* sim) {
+	struct TTPending p[MAX_MSGS];
+	struct state* s = &sim->s;
+	int i, n = tt_host_save(p, MAX_MSGS);
+
+	if (n < 0 || sim->com.light_count != 0) {
+		return 0;
+	}
+	s->in_queue[NORTHBOUND] = sim->ctrl.lane[NORTHBOUND].in_queue;
+	s->in_queue[SOUTHBOUND] = sim->ctrl.lane[SOUTHBOUND].in_queue;
+	s->on_bridge = sim->ctrl.on_bridge;
+	s->light[NORTHBOUND] = sim->ctrl.lane[NORTHBOUND].light;
+	s->light[SOUTHBOUND] = sim->ctrl.lane[SOUTHBOUND].light;
+	s->passed = sim->ctrl.passed_before_change < PARAM_MAX_CARS ?
+	            sim->ctrl.passed_before_change : PARAM_MAX_CARS;
+	s->pending = sim->ctrl.light_update_pending;
+	s->poll_pending = sim->ctrl.poll_pending;
+	s->last_green = sim->ctrl.last_green_direction;
+	// Only looked at up to the switch window after it, so any time further
+	// back is as good as that.
+	s->clear_in = sim->ctrl.clear_at - tt_host_now() > -PARAM_SWITCH_WINDOW ?
+	              sim->ctrl.clear_at - tt_host_now() : -PARAM_SWITCH_WINDOW;
+
+	memset(s->msgs, 0, sizeof(s->msgs));
+	s->nmsgs = 0;
+	for (i = 0; i < n; i++) {
+		struct mc_msg* msg = &s->msgs[s->nmsgs];
+		int m = method_index(p[i].method);
+		// The journal timer has no say in the decisions, and would only
+		// multiply the states by its offset.
+		if (p[i].to == &storage.super) {
+			continue;
+		}
+		if (m < 0 || p[i].size != 0) {
+			return 0;
+		}
+		msg->obj = p[i].to == &sim->com.super;
+		msg->meth = m;
+		msg->arg = p[i].arg;
+		msg->offset = p[i].offset;
+		msg->deadline = p[i].deadline == TIME_INFINITY ? 0 : p[i].deadline;
+		s->nmsgs++;
+	}
+	return 1;
+}
+
+// Load `s` into the thread's objects and kernel.
+static void unpack(struct sim* sim, const struct state* s) {
+	struct TTPending p[MAX_MSGS];
+	int i;
+
+	sim->s = *s;
+	sim->ctrl.lane[NORTHBOUND].in_queue = s->in_queue[NORTHBOUND];
+	sim->ctrl.lane[SOUTHBOUND].in_queue = s->in_queue[SOUTHBOUND];
+	sim->ctrl.on_bridge = s->on_bridge;
+	sim->ctrl.lane[NORTHBOUND].light = s->light[NORTHBOUND];
+	sim->ctrl.lane[SOUTHBOUND].light = s->light[SOUTHBOUND];
+	sim->ctrl.passed_before_change = s->passed;
+	sim->ctrl.light_update_pending = s->pending;
+	sim->ctrl.poll_pending = s->poll_pending;
+	sim->ctrl.last_green_direction = s->last_green;
+	sim->ctrl.clear_at = s->clear_in;
+
+	for (i = 0; i < s->nmsgs; i++) {
+		p[i].to = s->msgs[i].obj ? &sim->com.super : &sim->ctrl.super;
+		p[i].method = methods[s->msgs[i].meth];
+		p[i].arg = s->msgs[i].arg;
+		p[i].offset = s->msgs[i].offset;
+		p[i].deadline = s->msgs[i].deadline ? s->msgs[i].deadline : TIME_INFINITY;
+		p[i].size = 0;
+	}
+	// Every quantum starts at time 0, the state only holds relative times.
+	tt_host_load(p, s->nmsgs, 0);
+}
+
+static void sim_init(struct sim* sim) {
+	struct Communicator c = initCommunicator(&sim->ctrl);
+	struct Traffichandler t = initTraffichandler(&sim->com);
+
+	sim->com = c;
+	sim->ctrl = t;
+	memset(&sim->s, 0, sizeof(sim->s));
+	sim->s.since_entry[NORTHBOUND] = GAP_Q;
+	sim->s.since_entry[SOUTHBOUND] = GAP_Q;
+	sim->failure = NULL;
+	sim->elapsed = 0;
+
+	tt_host_reset();
+	tt_host_on_transmit(transmit, sim);
+	tt_host_on_failure(on_failure, sim);
+	UCSR0A = 1 << UDRE0;
+	INSTALL(&sim->com, com_receive_ready, IRQ_USART0_RX);
+	INSTALL_FAST(&sim->com, com_data_register_ready, IRQ_USART0_UDRE);
+	TINYTIMBER(&sim->ctrl, traffichandler_init, 0);
+	tt_host_run_until(QUANTUM - 1);
+	tt_host_advance(QUANTUM);
+	sim->elapsed = QUANTUM;
+	pack(sim);
+}
+
+static int green_for(const struct state* s, int dir) {
+	return (s->lights >> (dir == NORTHBOUND ? NB_GREEN : SB_GREEN)) & 1;
+}
+
+static int eligible(const struct state* s, int dir) {
+	return s->queue[dir] > 0 && green_for(s, dir) && s->since_entry[dir] >= GAP_Q;
+}
+
+static void run_due(void) {
+	while (tt_host_next() <= tt_host_now()) {
+		tt_host_step();
+	}
+}
+
+// Apply `action` to the state loaded in `sim` and run the kernel to the
+// start of the next quantum. Returns 0 if the action is not possible,
+// 1 if it was applied, and sets sim->failure on a violation.
+static int step(struct sim* sim, int action) {
+	struct state* s = &sim->s;
+	uint8_t sensors = 0;
+	int dir, i, can[2];
+
+	if (setjmp(sim->abort)) {
+		return 1;
+	}
+
+	// Cars whose crossing time is up have left.
+	for (i = 0; i < s->ncars; ) {
+		if (--s->car_left[i] == 0) {
+			s->ncars--;
+			s->car_dir[i] = s->car_dir[s->ncars];
+			s->car_left[i] = s->car_left[s->ncars];
+			s->car_dir[s->ncars] = 0;
+			s->car_left[s->ncars] = 0;
+		} else {
+			i++;
+		}
+	}
+
+	if (action & A_KERNEL_FIRST) {
+		if (tt_host_next() > tt_host_now()) {
+			return 0;   // nothing due: same as the other order
+		}
+		run_due();
+	}
+
+	for (dir = 0; dir < 2; dir++) {
+		can[dir] = eligible(s, dir);
+		if ((action & A_ENTER(dir)) && !can[dir]) {
+			return 0;
+		}
+		if (can[dir] && !(action & A_ENTER(dir)) && s->eligible_wait[dir] >= opt.reaction) {
+			return 0;   // the driver has to go now
+		}
+		if ((action & A_ARRIVE(dir)) && s->queue[dir] >= opt.queue) {
+			return 0;
+		}
+	}
+
+	for (dir = 0; dir < 2; dir++) {
+		if (action & A_ENTER(dir)) {
+			for (i = 0; i < s->ncars; i++) {
+				if (s->car_dir[i] != dir) {
+					sim->failure = "opposite directions on the bridge";
+				}
+			}
+			if (s->ncars >= MAX_CARS) {
+				sim->failure = "too many cars on the bridge for the model";
+				return 1;
+			}
+			s->car_dir[s->ncars] = dir;
+			s->car_left[s->ncars] = CROSS_Q;
+			s->ncars++;
+			s->queue[dir]--;
+			s->head_wait[dir] = 0;
+			s->since_entry[dir] = 0;
+			s->eligible_wait[dir] = 0;
+			sensors |= 1 << (dir == NORTHBOUND ? NB_BRIDGE_ENTRY : SB_BRIDGE_ENTRY);
+		} else if (can[dir]) {
+			s->eligible_wait[dir]++;
+		}
+		if (action & A_ARRIVE(dir)) {
+			if (s->queue[dir] == 0) {
+				s->head_wait[dir] = 0;
+			}
+			s->queue[dir]++;
+			sensors |= 1 << (dir == NORTHBOUND ? NB_CAR_ARRIVAL : SB_CAR_ARRIVAL);
+		}
+	}
+	if (sim->verbose && sensors) {
+		printf("  %9.3f s  sensors %x%s\n", (double)(sim->elapsed + tt_host_now()) / TICKS_PER_SEC, sensors,
+		       action & A_KERNEL_FIRST ? " (after the messages due now)" : "");
+	}
+	if (sensors) {
+		UDR0 = sensors;
+		tt_host_irq(IRQ_USART0_RX);
+	}
+	if (sim->failure) {
+		return 1;
+	}
+
+	tt_host_run_until(QUANTUM - 1);
+	tt_host_advance(QUANTUM);
+
+	for (dir = 0; dir < 2; dir++) {
+		if (s->since_entry[dir] < GAP_Q) {
+			s->since_entry[dir]++;
+		}
+		if (s->queue[dir] > 0 && ++s->head_wait[dir] > wait_bound_q) {
+			sim->failure = "queue waited beyond the bound";
+		}
+		if (!eligible(s, dir)) {
+			s->eligible_wait[dir] = 0;
+		}
+	}
+	if (!sim->failure && tt_host_next() == TIME_INFINITY && (s->queue[NORTHBOUND] || s->queue[SOUTHBOUND]) &&
+	    !(s->queue[NORTHBOUND] && green_for(s, NORTHBOUND)) && !(s->queue[SOUTHBOUND] && green_for(s, SOUTHBOUND))) {
+		sim->failure = "no progress: cars queued, no green and nothing pending";
+	}
+	if (!sim->failure && !pack(sim)) {
+		sim->failure = "state does not fit the model (too many or unknown messages)";
+	}
+	return 1;
+}
+
+/* visited set */
+
+static _Atomic uint64_t* visited;
+static uint64_t visited_mask;
+static atomic_ulong visited_count;
+
+static uint64_t fingerprint(const struct state* s) {
+	const unsigned char* p = (const unsigned char*)s;
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	size_t i;
+	for (i = 0; i < sizeof(*s); i++) {
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 29;
+	return h ? h : 1;
+}
+
+// Returns 1 if `h` was not in the set yet, 0 if it was, -1 if it is full.
+static int visit(uint64_t h) {
+	uint64_t i = h & visited_mask, n;
+	for (n = 0; n <= visited_mask; n++, i = (i + 1) & visited_mask) {
+		uint64_t seen = atomic_load_explicit(&visited[i], memory_order_relaxed);
+		if (seen == h) {
+			return 0;
+		}
+		if (seen == 0) {
+			if (atomic_compare_exchange_strong(&visited[i], &seen, h)) {
+				atomic_fetch_add_explicit(&visited_count, 1, memory_order_relaxed);
+				return 1;
+			}
+			if (seen == h) {
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
+
+/* breadth-first search */
+
+struct node {
+	struct state s;
+	uint32_t id;
+};
+
+struct buffer {
+	struct node* nodes;
+	uint32_t* parent;
+	uint8_t* action;
+	size_t n, cap;
+};
+
+struct worker {
+	pthread_t thread;
+	struct sim sim;
+	struct buffer next;
+};
+
+static struct node* frontier;
+static size_t frontier_n;
+static atomic_size_t frontier_pos;
+static atomic_int stop;
+static pthread_mutex_t result_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char* violation;
+static uint32_t violation_parent;
+static uint8_t violation_action;
+static int table_full;
+
+// Parent and action of every state, by id. State 0 is the initial state.
+static uint32_t* parents;
+static uint8_t* actions;
+static size_t n_states, cap_states;
+
+static void push(struct buffer* b, const struct state* s, uint32_t parent, uint8_t action) {
+	if (b->n == b->cap) {
+		b->cap = b->cap ? 2 * b->cap : 1024;
+		b->nodes = realloc(b->nodes, b->cap * sizeof(*b->nodes));
+		b->parent = realloc(b->parent, b->cap * sizeof(*b->parent));
+		b->action = realloc(b->action, b->cap * sizeof(*b->action));
+		if (!b->nodes || !b->parent || !b->action) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	b->nodes[b->n].s = *s;
+	b->parent[b->n] = parent;
+	b->action[b->n] = action;
+	b->n++;
+}
+
+static void found(const char* what, uint32_t parent, int action) {
+	pthread_mutex_lock(&result_lock);
+	if (!violation) {
+		violation = what;
+		violation_parent = parent;
+		violation_action = action;
+	}
+	pthread_mutex_unlock(&result_lock);
+	atomic_store(&stop, 1);
+}
+
+static void* expand(void* arg) {
+	struct worker* w = arg;
+	size_t i, chunk = 64;
+
+	while (!atomic_load(&stop) && (i = atomic_fetch_add(&frontier_pos, chunk)) < frontier_n) {
+		size_t end = i + chunk < frontier_n ? i + chunk : frontier_n;
+		for (; i < end && !atomic_load(&stop); i++) {
+			int a;
+			for (a = 0; a < N_ACTIONS; a++) {
+				int r;
+				unpack(&w->sim, &frontier[i].s);
+				w->sim.failure = NULL;
+				if (!step(&w->sim, a)) {
+					continue;
+				}
+				if (w->sim.failure) {
+					found(w->sim.failure, frontier[i].id, a);
+					break;
+				}
+				r = visit(fingerprint(&w->sim.s));
+				if (r < 0) {
+					table_full = 1;
+					atomic_store(&stop, 1);
+					break;
+				}
+				if (r) {
+					push(&w->next, &w->sim.s, frontier[i].id, a);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+static void* start_worker(void* arg) {
+	struct worker* w = arg;
+	// Every thread has its own kernel, set up like the initial state.
+	sim_init(&w->sim);
+	return expand(arg);
+}
+
+static void print_state(const struct state* s) {
+	printf("    controller: queue N=%d S=%d bridge=%u passed=%u%s%s lights N=%s S=%s last green %s, %d pending\n",
+	       s->in_queue[NORTHBOUND], s->in_queue[SOUTHBOUND], s->on_bridge, s->passed,
+	       s->pending ? " update-pending" : "", s->poll_pending ? " poll-pending" : "",
+	       s->light[NORTHBOUND] ? "green" : "red", s->light[SOUTHBOUND] ? "green" : "red",
+	       s->last_green == NORTHBOUND ? "N" : "S", s->nmsgs);
+	printf("    bridge:     queue N=%d S=%d cars=%d lights=%x head wait N=%.1f s S=%.1f s\n",
+	       s->queue[NORTHBOUND], s->queue[SOUTHBOUND], s->ncars, s->lights,
+	       s->head_wait[NORTHBOUND] * (double)QUANTUM / TICKS_PER_SEC,
+	       s->head_wait[SOUTHBOUND] * (double)QUANTUM / TICKS_PER_SEC);
+}
+
+// Replay the path to the violation from the initial state, printing it.
+static void print_trace(void) {
+	size_t len = 0, i;
+	uint32_t id;
+	uint8_t* path;
+	struct sim* sim = malloc(sizeof(*sim));
+
+	for (id = violation_parent; id != 0; id = parents[id]) {
+		len++;
+	}
+	path = malloc(len + 1);
+	path[len] = violation_action;
+	for (i = len, id = violation_parent; id != 0; id = parents[id]) {
+		path[--i] = actions[id];
+	}
+
+	printf("counterexample, %zu quanta of %.3f s:\n", len + 1, (double)QUANTUM / TICKS_PER_SEC);
+	sim_init(sim);
+	sim->verbose = 1;
+	print_state(&sim->s);
+	for (i = 0; i <= len; i++) {
+		struct state s = sim->s;
+		unpack(sim, &s);
+		step(sim, path[i]);
+		if (sim->failure) {
+			printf("  %9.3f s  %s\n", (double)(sim->elapsed + tt_host_now()) / TICKS_PER_SEC, sim->failure);
+			break;
+		}
+		sim->elapsed += QUANTUM;
+		print_state(&sim->s);
+	}
+	free(path);
+	free(sim);
+}
+
+int main(int argc, char** argv) {
+	struct timespec t0, t1;
+	struct worker* workers;
+	struct sim* init;
+	int i, depth = 0;
+	double secs;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--threads")) opt.threads = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--queue")) opt.queue = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--wait-bound")) opt.wait_bound = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--reaction")) opt.reaction = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--slots-log2")) opt.slots_log2 = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--max-depth")) opt.max_depth = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--threads n] [--queue n] [--wait-bound s] [--reaction n] "
+			        "[--slots-log2 n] [--max-depth n]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (opt.threads <= 0) {
+		opt.threads = get_nprocs();
+	}
+	wait_bound_q = (int)(opt.wait_bound * TICKS_PER_SEC / QUANTUM);
+	if (wait_bound_q > 250) {
+		wait_bound_q = 250;
+	}
+
+	visited_mask = (1ULL << opt.slots_log2) - 1;
+	visited = calloc(visited_mask + 1, sizeof(*visited));
+	workers = calloc(opt.threads, sizeof(*workers));
+	init = malloc(sizeof(*init));
+	if (!visited || !workers || !init) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	sim_init(init);
+	visit(fingerprint(&init->s));
+	frontier = malloc(sizeof(*frontier));
+	frontier[0].s = init->s;
+	frontier[0].id = 0;
+	frontier_n = 1;
+	cap_states = 1024;
+	parents = malloc(cap_states * sizeof(*parents));
+	actions = malloc(cap_states * sizeof(*actions));
+	parents[0] = 0;
+	actions[0] = 0;
+	n_states = 1;
+
+	while (frontier_n && !atomic_load(&stop) && (!opt.max_depth || depth < opt.max_depth)) {
+		size_t next_n = 0, j;
+		atomic_store(&frontier_pos, 0);
+		for (i = 0; i < opt.threads; i++) {
+			workers[i].next.n = 0;
+			pthread_create(&workers[i].thread, NULL, start_worker, &workers[i]);
+		}
+		for (i = 0; i < opt.threads; i++) {
+			pthread_join(workers[i].thread, NULL);
+			next_n += workers[i].next.n;
+		}
+
+		// Number the new states and make them the next frontier.
+		free(frontier);
+		frontier = malloc((next_n ? next_n : 1) * sizeof(*frontier));
+		while (n_states + next_n > cap_states) {
+			cap_states *= 2;
+			parents = realloc(parents, cap_states * sizeof(*parents));
+			actions = realloc(actions, cap_states * sizeof(*actions));
+		}
+		if (!frontier || !parents || !actions || n_states + next_n > UINT32_MAX) {
+			fprintf(stderr, "out of memory\n");
+			return 2;
+		}
+		frontier_n = 0;
+		for (i = 0; i < opt.threads; i++) {
+			struct buffer* b = &workers[i].next;
+			for (j = 0; j < b->n; j++) {
+				frontier[frontier_n].s = b->nodes[j].s;
+				frontier[frontier_n].id = n_states;
+				parents[n_states] = b->parent[j];
+				actions[n_states] = b->action[j];
+				frontier_n++;
+				n_states++;
+			}
+		}
+		depth++;
+		if (depth % 10 == 0) {
+			fprintf(stderr, "depth %d: %zu states, %zu in the frontier\n", depth, n_states, frontier_n);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	printf("queue bound %d, wait bound %.1f s, reaction %d quanta\n",
+	       opt.queue, opt.wait_bound, opt.reaction);
+	printf("%zu states, depth %d, %d threads, %.2f s (%.0f states/s)\n",
+	       n_states, depth, opt.threads, secs, n_states / secs);
+	if (violation) {
+		printf("VIOLATION: %s\n", violation);
+		print_trace();
+		return 1;
+	}
+	if (table_full) {
+		printf("visited set full, raise --slots-log2\n");
+		return 2;
+	}
+	if (frontier_n) {
+		printf("stopped at depth %d with %zu states left unexplored\n", depth, frontier_n);
+		return 0;
+	}
+	printf("state space exhausted, no violation\n");
+	return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ * Profile reports from a log of the AVR's serial output, with the methods
+ * named from the symbols of the firmware ELF.
+ *
+ * The log holds the raw bytes the AVR sent on USART0, as saved by the
+ * simulator or a terminal program, from a firmware built with TT_PROFILE.
+ * Light states are skipped. The bytes with REPORT_FRAME set carry three
+ * bits each of the reports of objects/profiler.h, and of the crash report
+ * that initiation.c sends first after a crash. Reports whose check byte
+ * does not match are passed over one byte at a time, so a log may start
+ * in the middle of one.
+ *
+ * Method pointers are word addresses on the AVR: they are doubled and
+ * looked up among the function symbols of the ELF. Without --elf the
+ * addresses are printed. The samples of all reports are added up; with
+ * --each every report is printed as well.
+ *
+ *   profile [--elf firmware.elf] [--each] log
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "objects/profiler.h"
+
+// Crash report of initiation.c: reason, count, line, object and method.
+#define CRASH_REPORT_SIZE 8
+
+struct symbol {
+	uint32_t addr, size;
+	const char* name;
+};
+
+struct method {
+	uint16_t word;       // as sent, a word address
+	unsigned long samples;
+};
+
+struct options {
+	const char* elf;
+	int each;
+	const char* log;
+};
+
+static struct options opt = { NULL, 0, NULL };
+
+static struct symbol* symbols;
+static size_t n_symbols;
+static char* elf_image;
+
+static struct method* methods;
+static size_t n_methods, cap_methods;
+static unsigned long samples, idle, other, reports;
+
+static char* read_file(const char* path, size_t* size) {
+	FILE* f = fopen(path, "rb");
+	char* buf;
+	long n;
+
+	if (!f || fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		perror(path);
+		exit(2);
+	}
+	buf = malloc(n ? n : 1);
+	if (!buf || fread(buf, 1, n, f) != (size_t)n) {
+		fprintf(stderr, "%s: cannot read\n", path);
+		exit(2);
+	}
+	fclose(f);
+	*size = n;
+	return buf;
+}
+
+static int compare_symbol(const void* a, const void* b) {
+	const struct symbol* x = a;
+	const struct symbol* y = b;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// The function symbols of a 32-bit little-endian ELF, as avr-gcc writes.
+static void load_symbols(const char* path) {
+	size_t size, i, j;
+	const Elf32_Ehdr* eh;
+	const Elf32_Shdr* sh;
+
+	elf_image = read_file(path, &size);
+	eh = (const Elf32_Ehdr*)elf_image;
+	if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+	    eh->e_shentsize != sizeof(Elf32_Shdr) || eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf32_Shdr) > size) {
+		fprintf(stderr, "%s: not a 32-bit little-endian ELF\n", path);
+		exit(2);
+	}
+	sh = (const Elf32_Shdr*)(elf_image + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		const Elf32_Sym* sym;
+		const Elf32_Shdr* strtab;
+		size_t n;
+
+		if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) {
+			continue;
+		}
+		strtab = &sh[sh[i].sh_link];
+		if (sh[i].sh_offset + (size_t)sh[i].sh_size > size || strtab->sh_offset + (size_t)strtab->sh_size > size) {
+			fprintf(stderr, "%s: symbol table out of the file\n", path);
+			exit(2);
+		}
+		sym = (const Elf32_Sym*)(elf_image + sh[i].sh_offset);
+		n = sh[i].sh_size / sizeof(Elf32_Sym);
+		symbols = realloc(symbols, (n_symbols + n) * sizeof(*symbols));
+		if (!symbols) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+		for (j = 0; j < n; j++) {
+			if (ELF32_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_name >= strtab->sh_size) {
+				continue;
+			}
+			symbols[n_symbols].addr = sym[j].st_value;
+			symbols[n_symbols].size = sym[j].st_size;
+			symbols[n_symbols].name = elf_image + strtab->sh_offset + sym[j].st_name;
+			n_symbols++;
+		}
+	}
+	if (n_symbols == 0) {
+		fprintf(stderr, "%s: no function symbols (stripped?)\n", path);
+		exit(2);
+	}
+	qsort(symbols, n_symbols, sizeof(*symbols), compare_symbol);
+}
+
+// Name of the method at word address `word`, in a static buffer.
+static const char* symbolize(uint16_t word) {
+	static char buf[160];
+	uint32_t addr = (uint32_t)word * 2;
+	size_t lo = 0, hi = n_symbols;
+
+	if (n_symbols == 0) {
+		snprintf(buf, sizeof(buf), "0x%04x", addr);
+		return buf;
+	}
+	// The last symbol at or below addr.
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (symbols[mid].addr <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0 || (symbols[lo - 1].size && addr >= symbols[lo - 1].addr + symbols[lo - 1].size)) {
+		snprintf(buf, sizeof(buf), "? (0x%04x)", addr);
+	} else if (addr == symbols[lo - 1].addr) {
+		snprintf(buf, sizeof(buf), "%s (0x%04x)", symbols[lo - 1].name, addr);
+	} else {
+		snprintf(buf, sizeof(buf), "%s+0x%x (0x%04x)", symbols[lo - 1].name, addr - symbols[lo - 1].addr, addr);
+	}
+	return buf;
+}
+
+static void add_samples(uint16_t word, unsigned long n) {
+	size_t i;
+	for (i = 0; i < n_methods; i++) {
+		if (methods[i].word == word) {
+			methods[i].samples += n;
+			return;
+		}
+	}
+	if (n_methods == cap_methods) {
+		cap_methods = cap_methods ? 2 * cap_methods : 64;
+		methods = realloc(methods, cap_methods * sizeof(*methods));
+		if (!methods) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	methods[n_methods].word = word;
+	methods[n_methods].samples = n;
+	n_methods++;
+}
+
+// Byte `i` of the report that starts at triplet `k`.
+static uint8_t report_byte(const uint8_t* bits, size_t k, size_t i) {
+	uint8_t b = 0;
+	int j;
+	for (j = 0; j < 8; j++) {
+		size_t bit = i * 8 + j;
+		b |= ((bits[k + bit / 3] >> (bit % 3)) & 1) << j;
+	}
+	return b;
+}
+
+static uint16_t report_word(const uint8_t* bits, size_t k, size_t i) {
+	return report_byte(bits, k, i) | report_byte(bits, k, i + 1) << 8;
+}
+
+// Triplets taken by a report of `n` bytes.
+static size_t triplets(size_t n) {
+	return (n * 8 + 2) / 3;
+}
+
+// Length of a good profile report at triplet `k`, 0 if there is none.
+static size_t profile_at(const uint8_t* bits, size_t n_bits, size_t k) {
+	size_t n, i;
+	uint8_t sum = 0;
+
+	if (n_bits - k < triplets(PROFILE_HEADER + 1) || report_byte(bits, k, 0) != PROFILE_REPORT) {
+		return 0;
+	}
+	n = report_byte(bits, k, 1);
+	if (n > PROFILE_SLOTS) {
+		return 0;
+	}
+	n = PROFILE_HEADER + 4 * n + 1;
+	if (n_bits - k < triplets(n)) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		sum += report_byte(bits, k, i);
+	}
+	return sum == 0 ? n : 0;
+}
+
+static void print_crash(const uint8_t* bits) {
+	static const char* reasons[] = { "none", "panic", "assertion", "watchdog" };
+	static const char* files[] = {
+		[FILE_KERNEL] = "TinyTimber.c",
+		[FILE_TRAFFICHANDLER] = "traffichandler.c",
+		[FILE_COMMUNICATOR] = "communicator.c",
+	};
+	uint8_t reason = report_byte(bits, 0, 0);
+	uint16_t at = report_word(bits, 0, 2);
+	const char* file = CRASH_FILE(at) < sizeof(files) / sizeof(files[0]) ? files[CRASH_FILE(at)] : NULL;
+
+	printf("crash report: %s, crash %u since power-on, %s line %u\n", reasons[reason], report_byte(bits, 0, 1),
+	       file ? file : "unknown file", CRASH_LINE(at));
+	printf("  object 0x%04x, method %s\n", report_word(bits, 0, 4), symbolize(report_word(bits, 0, 6)));
+}
+
+static void take_profile(const uint8_t* bits, size_t k) {
+	uint8_t n = report_byte(bits, k, 1);
+	uint16_t total = report_word(bits, k, 2);
+	uint16_t report_idle = report_word(bits, k, 4);
+	uint16_t report_other = report_word(bits, k, 6);
+	size_t i;
+
+	reports++;
+	samples += total;
+	idle += report_idle;
+	other += report_other;
+	if (opt.each) {
+		printf("report %lu: %u samples, %u idle, %u in methods left out\n", reports, total, report_idle,
+		       report_other);
+	}
+	for (i = 0; i < n; i++) {
+		uint16_t word = report_word(bits, k, PROFILE_HEADER + 4 * i);
+		uint16_t count = report_word(bits, k, PROFILE_HEADER + 4 * i + 2);
+		add_samples(word, count);
+		if (opt.each) {
+			printf("  %6u  %s\n", count, symbolize(word));
+		}
+	}
+}
+
+static int compare_samples(const void* a, const void* b) {
+	const struct method* x = a;
+	const struct method* y = b;
+	return x->samples > y->samples ? -1 : x->samples < y->samples;
+}
+
+static double percent(unsigned long n) {
+	return samples ? 100.0 * n / samples : 0.0;
+}
+
+int main(int argc, char** argv) {
+	uint8_t* log;
+	uint8_t* bits;
+	size_t size, n_bits = 0, k = 0, n, skipped = 0, i;
+
+	for (i = 1; i < (size_t)argc; i++) {
+		if (i + 1 < (size_t)argc && !strcmp(argv[i], "--elf")) opt.elf = argv[++i];
+		else if (!strcmp(argv[i], "--each")) opt.each = 1;
+		else if (!opt.log && argv[i][0] != '-') opt.log = argv[i];
+		else {
+			fprintf(stderr, "usage: %s [--elf firmware.elf] [--each] log\n", argv[0]);
+			return 2;
+		}
+	}
+	if (!opt.log) {
+		fprintf(stderr, "usage: %s [--elf firmware.elf] [--each] log\n", argv[0]);
+		return 2;
+	}
+	if (opt.elf) {
+		load_symbols(opt.elf);
+	}
+
+	log = (uint8_t*)read_file(opt.log, &size);
+	bits = malloc(size ? size : 1);
+	if (!bits) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	for (i = 0; i < size; i++) {
+		if (log[i] & (1 << REPORT_FRAME)) {
+			bits[n_bits++] = (log[i] >> 4) & 0x7;
+		}
+	}
+
+	// A crash report can only be told apart by where it is: first.
+	if (n_bits >= triplets(CRASH_REPORT_SIZE) && !profile_at(bits, n_bits, 0) &&
+	    report_byte(bits, 0, 0) >= CRASH_PANIC && report_byte(bits, 0, 0) <= CRASH_WATCHDOG) {
+		print_crash(bits);
+		k = triplets(CRASH_REPORT_SIZE);
+	}
+	while (k < n_bits) {
+		if ((n = profile_at(bits, n_bits, k)) != 0) {
+			take_profile(bits, k);
+			k += triplets(n);
+		} else {
+			k++;
+			skipped++;
+		}
+	}
+
+	printf("%lu reports, %lu samples, %.1f%% idle, %.1f%% in methods left out of a report",
+	       reports, samples, percent(idle), percent(other));
+	if (skipped) {
+		printf(", %zu report bytes not understood", skipped);
+	}
+	printf("\n");
+	qsort(methods, n_methods, sizeof(*methods), compare_samples);
+	for (i = 0; i < n_methods; i++) {
+		printf("%8lu %5.1f%%  %s\n", methods[i].samples, percent(methods[i].samples), symbolize(methods[i].word));
+	}
+	free(methods);
+	free(symbols);
+	free(elf_image);
+	free(bits);
+	free(log);
+	return reports == 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Replay a serial capture against the host build of the controller.
+ *
+ * Reads a capture (objects/capture.h; from a COM_CAPTURE build, or from
+ * explore --capture), feeds the recorded sensor bytes to the controller at
+ * their recorded times as receive interrupts, and compares the light bytes
+ * it writes with the recorded ones:
+ *   - decisions: the n-th light byte written differs, or there are more
+ *     or fewer of them,
+ *   - timing: the n-th light byte is written more than --tolerance ms
+ *     away from the recorded time.
+ * Time is virtual, so by default the replay runs as fast as it can;
+ * --speed 1 paces it in real time and --speed 10 ten times faster, e.g. to
+ * watch it on the display of a connected simulator.
+ *
+ *   replay [--speed x] [--tolerance ms] [--max-diffs n] capture.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+
+#include "tinytimber_host.h"
+#include "capture_file.h"
+#include "common.h"
+#include "objects/communicator.h"
+#include "objects/traffichandler.h"
+
+struct options {
+	double speed;
+	double tolerance;
+	int max_diffs;
+	const char* file;
+};
+
+struct list {
+	struct CaptureRecord* r;
+	size_t n, cap;
+};
+
+static struct options opt = { 0, 1, 10, NULL };
+static struct list replayed;
+
+static void append(struct list* l, const struct CaptureRecord* r) {
+	if (l->n == l->cap) {
+		l->cap = l->cap ? 2 * l->cap : 256;
+		l->r = realloc(l->r, l->cap * sizeof(*l->r));
+		if (!l->r) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	l->r[l->n++] = *r;
+}
+
+static void transmit(void* ctx, Time now, uint8_t data, Time latency) {
+	// Recorded with the time of the decision, as by a COM_CAPTURE build.
+	struct CaptureRecord r = { now - latency, CAPTURE_TX, data };
+	(void)ctx;
+	append(&replayed, &r);
+}
+
+static void on_failure(void* ctx, const char* what, const char* file, int line) {
+	(void)ctx;
+	printf("controller failed at %.3f s: %s (%s:%d)\n",
+	       (double)tt_host_now() / TICKS_PER_SEC, what, file, line);
+	exit(1);
+}
+
+// A recorded sensor byte, at its time.
+static void receive(void* ctx, int data) {
+	(void)ctx;
+	UDR0 = data;
+	tt_host_irq(IRQ_USART0_RX);
+}
+
+// Sleep until `t` of virtual time has passed at the requested speed.
+static void pace(const struct timespec* start, Time t) {
+	struct timespec now, wait;
+	double target, elapsed;
+	if (opt.speed <= 0) {
+		return;
+	}
+	target = (double)t / TICKS_PER_SEC / opt.speed;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+	if (target > elapsed) {
+		wait.tv_sec = (time_t)(target - elapsed);
+		wait.tv_nsec = (long)((target - elapsed - wait.tv_sec) * 1e9);
+		nanosleep(&wait, NULL);
+	}
+}
+
+int main(int argc, char** argv) {
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	struct Communicator c = initCommunicator(&ctrl);
+	struct Traffichandler t = initTraffichandler(&com);
+	struct list rx = { 0 }, tx = { 0 };
+	struct CaptureRecord r;
+	struct timespec start;
+	Time last = 0, end = 0, tolerance, max_error = 0;
+	double sum_error = 0;
+	unsigned long dropped = 0, decisions = 0, late = 0;
+	size_t i, n;
+	FILE* f;
+	int res, i_arg;
+
+	for (i_arg = 1; i_arg < argc; i_arg++) {
+		if (i_arg + 1 < argc && !strcmp(argv[i_arg], "--speed")) opt.speed = atof(argv[++i_arg]);
+		else if (i_arg + 1 < argc && !strcmp(argv[i_arg], "--tolerance")) opt.tolerance = atof(argv[++i_arg]);
+		else if (i_arg + 1 < argc && !strcmp(argv[i_arg], "--max-diffs")) opt.max_diffs = atoi(argv[++i_arg]);
+		else if (!opt.file && argv[i_arg][0] != '-') opt.file = argv[i_arg];
+		else {
+			opt.file = NULL;
+			break;
+		}
+	}
+	if (!opt.file) {
+		fprintf(stderr, "usage: %s [--speed x] [--tolerance ms] [--max-diffs n] capture.bin\n", argv[0]);
+		return 2;
+	}
+	tolerance = (Time)(opt.tolerance * TICKS_PER_SEC / 1000);
+
+	if (!(f = fopen(opt.file, "rb"))) {
+		perror(opt.file);
+		return 2;
+	}
+	while ((res = capture_read(f, &last, &r)) > 0) {
+		if (r.kind == CAPTURE_RX) {
+			append(&rx, &r);
+		} else if (r.kind == CAPTURE_TX) {
+			append(&tx, &r);
+		} else if (r.kind == CAPTURE_DROPPED) {
+			dropped += r.data;
+		}
+		if (r.time > end) {
+			end = r.time;
+		}
+	}
+	fclose(f);
+	if (res < 0) {
+		printf("warning: capture ends in a truncated record\n");
+	}
+	if (dropped) {
+		printf("warning: %lu records were dropped on the target, expect differences\n", dropped);
+	}
+
+	com = c;
+	ctrl = t;
+	tt_host_reset();
+	tt_host_on_transmit(transmit, NULL);
+	tt_host_on_failure(on_failure, NULL);
+	UCSR0A = 1 << UDRE0;
+	INSTALL(&com, com_receive_ready, IRQ_USART0_RX);
+	INSTALL_FAST(&com, com_data_register_ready, IRQ_USART0_UDRE);
+	TINYTIMBER(&ctrl, traffichandler_init, 0);
+
+	// The sensor bytes are injected a few ahead of the clock, which jumps
+	// from one batch to the next. A byte interrupts at its timestamp:
+	// whatever was due before it has run, whatever is due at the same tick
+	// runs after it. The run stops at the end of the capture, later
+	// decisions were not recorded.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	i = 0;
+	do {
+		while (i < rx.n && tt_host_inject(rx.r[i].time, receive, NULL, rx.r[i].data) == 0) {
+			i++;
+		}
+		if (tt_host_next_batch() <= end) {
+			pace(&start, tt_host_next_batch());
+		}
+	} while (tt_host_batch(end));
+
+	n = tx.n < replayed.n ? tx.n : replayed.n;
+	for (i = 0; i < n; i++) {
+		Time error = replayed.r[i].time - tx.r[i].time;
+		if (error < 0) {
+			error = -error;
+		}
+		sum_error += error;
+		if (error > max_error) {
+			max_error = error;
+		}
+		if (replayed.r[i].data != tx.r[i].data || error > tolerance) {
+			if (replayed.r[i].data != tx.r[i].data) {
+				decisions++;
+			} else {
+				late++;
+			}
+			if (decisions + late <= (unsigned long)opt.max_diffs) {
+				printf("  light byte %zu: recorded %x at %.3f s, replayed %x at %.3f s\n", i,
+				       tx.r[i].data, (double)tx.r[i].time / TICKS_PER_SEC,
+				       replayed.r[i].data, (double)replayed.r[i].time / TICKS_PER_SEC);
+			}
+		}
+	}
+
+	printf("%zu sensor bytes over %.1f s, %zu light bytes recorded, %zu replayed\n",
+	       rx.n, (double)end / TICKS_PER_SEC, tx.n, replayed.n);
+	printf("%lu different decisions, %lu beyond %.1f ms; timing error mean %.3f ms, max %.3f ms\n",
+	       decisions, late, opt.tolerance, n ? sum_error / n * 1000 / TICKS_PER_SEC : 0.0,
+	       (double)max_error * 1000 / TICKS_PER_SEC);
+	if (decisions || late || tx.n != replayed.n) {
+		printf("MISMATCH\n");
+		return 1;
+	}
+	printf("replay matches the capture\n");
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Check of the all-red hold after a reset.
+ *
+ * Runs the controller against the bridge model with random traffic, as
+ * explore does, and resets it now and then at a random instant
+ * (bridge_restart): the cars on the bridge and in the queues carry on, the
+ * controller starts afresh. Every other reset is a power-on, which knows
+ * nothing of the cars; the others take over the controller's state at the
+ * instant of the reset, as after a crash with a fresh journal. Fails if
+ *   - a light turns green less than the switch window after a reset,
+ *   - a car enters with the other direction on the bridge,
+ *   - an ASSERT of the controller fails.
+ * Queues are not checked for starvation: after a power-on the controller
+ * does not know of the cars that were waiting.
+ *
+ *   restart [--episodes n] [--minutes m] [--first seed]
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bridge.h"
+#include "objects/storage.h"
+
+struct options {
+	unsigned long episodes;
+	double minutes;
+	unsigned long first;
+};
+
+static struct options opt = { 500, 10, 1 };
+
+struct episode {
+	struct Bridge bridge;
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	Time hold_until;       // no green before this, after the last reset
+	const char* failure;   // NULL while the episode is fine
+	Time failed_at;
+	char what[160];
+	jmp_buf abort;
+};
+
+static unsigned long resets, restored;
+
+static void check(void* ctx, const struct BridgeEvent* e) {
+	struct episode* ep = ctx;
+	if (ep->failure) {
+		return;
+	}
+	if (e->kind == BRIDGE_UNSAFE) {
+		ep->failure = "opposite directions on the bridge";
+	} else if (e->kind == BRIDGE_LIGHTS && (e->lights & ((1 << NB_GREEN) | (1 << SB_GREEN))) &&
+	           e->time < ep->hold_until) {
+		snprintf(ep->what, sizeof(ep->what), "green %.3f s before the end of the all-red hold",
+		         (double)(ep->hold_until - e->time) / TICKS_PER_SEC);
+		ep->failure = ep->what;
+	}
+	if (ep->failure) {
+		ep->failed_at = e->time;
+	}
+}
+
+static void on_failure(void* ctx, const char* what, const char* file, int line) {
+	struct episode* ep = ctx;
+	snprintf(ep->what, sizeof(ep->what), "%s (%s:%d)", what, file, line);
+	ep->failure = ep->what;
+	ep->failed_at = tt_host_now();
+	longjmp(ep->abort, 1);
+}
+
+// The state the journal would hold if it had been written just now.
+static void snapshot(const struct Traffichandler* t, struct JournalState* s) {
+	s->in_queue[NORTHBOUND] = t->lane[NORTHBOUND].in_queue;
+	s->in_queue[SOUTHBOUND] = t->lane[SOUTHBOUND].in_queue;
+	s->on_bridge = t->on_bridge;
+	s->last_green_direction = t->last_green_direction;
+	s->passed_before_change = t->passed_before_change;
+	s->stats = t->stats;
+}
+
+// Traffic and timing of one episode, drawn like explore draws them.
+static void random_config(struct Bridge* b, struct BridgeConfig* cfg) {
+	int dir;
+	bridge_default_config(cfg);
+	for (dir = 0; dir < 2; dir++) {
+		cfg->mean_arrival[dir] = bridge_random(b, MSEC(300), SEC(30));
+	}
+	cfg->entry_min = bridge_random(b, 0, MSEC(500));
+	cfg->entry_max = cfg->entry_min + bridge_random(b, 0, SEC(2));
+	cfg->cross_max = MSEC(TIME_CROSS_BRIDGE);
+	cfg->cross_min = cfg->cross_max - bridge_random(b, 0, MSEC(500));
+	cfg->wait_bound = 0;
+}
+
+static void run_episode(struct episode* ep, unsigned long seed) {
+	struct BridgeConfig cfg;
+	struct JournalState s;
+	Time end = (Time)(opt.minutes * 60 * TICKS_PER_SEC), t;
+	int n = 0;
+
+	ep->bridge.rng = seed * 0xd1b54a32d192ed03ULL + 1;
+	random_config(&ep->bridge, &cfg);
+	ep->failure = NULL;
+	bridge_init(&ep->bridge, &cfg, seed, &ep->com, &ep->ctrl);
+	ep->bridge.trace = check;
+	ep->bridge.trace_ctx = ep;
+	ep->hold_until = PARAM_SWITCH_WINDOW;   // the first start is a reset too
+	tt_host_on_failure(on_failure, ep);
+
+	if (setjmp(ep->abort) == 0) {
+		for (t = 0; !ep->failure; n++) {
+			t += bridge_random(&ep->bridge, SEC(1), SEC(60));
+			if (t >= end) {
+				bridge_run(&ep->bridge, end);
+				break;
+			}
+			bridge_run(&ep->bridge, t);
+			snapshot(&ep->ctrl, &s);
+			bridge_restart(&ep->bridge, n % 2 ? &s : NULL);
+			ep->hold_until = t + PARAM_SWITCH_WINDOW;
+			resets++;
+			restored += n % 2;
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	static struct episode ep;
+	unsigned long e, failed = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--episodes")) opt.episodes = strtoul(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "--minutes")) opt.minutes = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--first")) opt.first = strtoul(argv[++i], NULL, 0);
+		else {
+			fprintf(stderr, "usage: %s [--episodes n] [--minutes m] [--first seed]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for (e = 0; e < opt.episodes; e++) {
+		run_episode(&ep, opt.first + e);
+		if (ep.failure && failed++ < 5) {
+			printf("episode %lu: %s at %.3f s\n", opt.first + e, ep.failure,
+			       (double)ep.failed_at / TICKS_PER_SEC);
+		}
+	}
+	printf("%lu episodes of %.1f simulated minutes, %lu resets (%lu with the state restored)\n",
+	       opt.episodes, opt.minutes, resets, restored);
+	printf("%lu episodes failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Structure-of-arrays controller state, see soa.h.
+ *
+ * Written with the GCC vector extensions, which compile to SSE2 on x86-64
+ * and NEON on ARM. A comparison gives a mask of all ones or all zeros per
+ * lane, and select() takes the lanes of `a` where the mask is set.
+ */
+
+#include "soa.h"
+#include <string.h>
+
+#define LANES 8
+
+typedef int16_t vec __attribute__((vector_size(2 * LANES)));
+typedef uint16_t uvec __attribute__((vector_size(2 * LANES)));
+
+static vec load(const int16_t* p) {
+	vec v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uvec load_u(const uint16_t* p) {
+	uvec v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void store(int16_t* p, vec v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+static void store_u(uint16_t* p, uvec v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+static vec splat(int16_t x) {
+	return (vec){ 0 } + x;
+}
+
+static vec select(vec mask, vec a, vec b) {
+	return (a & mask) | (b & ~mask);
+}
+
+void soa_load(struct SoaBlock* b, int i, const struct Traffichandler* t) {
+	int dir;
+	for (dir = 0; dir < 2; dir++) {
+		b->in_queue[dir][i] = t->lane[dir].in_queue;
+		b->light[dir][i] = t->lane[dir].light;
+	}
+	b->on_bridge[i] = t->on_bridge;
+	b->passed_before_change[i] = t->passed_before_change;
+	b->last_green_direction[i] = t->last_green_direction;
+	b->light_update_pending[i] = t->light_update_pending;
+	b->poll_pending[i] = t->poll_pending;
+	b->decision[i] = DECIDE_NONE;
+}
+
+void soa_store(const struct SoaBlock* b, int i, struct Traffichandler* t) {
+	int dir;
+	for (dir = 0; dir < 2; dir++) {
+		t->lane[dir].in_queue = b->in_queue[dir][i];
+		t->lane[dir].light = b->light[dir][i];
+	}
+	t->on_bridge = b->on_bridge[i];
+	t->passed_before_change = b->passed_before_change[i];
+	t->last_green_direction = b->last_green_direction[i];
+	t->light_update_pending = b->light_update_pending[i];
+	t->poll_pending = b->poll_pending[i];
+}
+
+void soa_check(struct SoaBlock* b, uint16_t max_cars, int arg) {
+	const vec keep_poll = splat(arg != CHECK_POLL);
+	const vec keep_pending = splat(arg != CHECK_RESET);
+	int i;
+
+	for (i = 0; i < SOA_WIDTH; i += LANES) {
+		vec north = load(&b->in_queue[NORTHBOUND][i]);
+		vec south = load(&b->in_queue[SOUTHBOUND][i]);
+		uvec on_bridge = load_u(&b->on_bridge[i]);
+		uvec passed = load_u(&b->passed_before_change[i]);
+		vec last = load(&b->last_green_direction[i]);
+		vec pending = load(&b->light_update_pending[i]) & keep_pending;
+		vec poll = load(&b->poll_pending[i]) & keep_poll;
+		vec north_green = last == NORTHBOUND;
+		vec active = select(north_green, north, south);
+		vec other = select(north_green, south, north);
+		vec idle, busy, decide, to_other;
+
+		// Nothing on the bridge: green for whoever waits, north first.
+		idle = select(north > 0, splat(DECIDE_GREEN_NORTH),
+		              select(south > 0, splat(DECIDE_GREEN_SOUTH), splat(DECIDE_NONE)));
+
+		// Cars on the bridge: switch if enough have passed or nobody is left
+		// on the green side, otherwise let the next one through or poll.
+		to_other = (other > 0) & ((passed >= max_cars) | (active <= 0));
+		busy = select(active > 0, DECIDE_GREEN_NORTH + ((last != NORTHBOUND) & 1),
+		              select(poll != 0, splat(DECIDE_NONE), splat(DECIDE_POLL)));
+		busy = select(to_other, DECIDE_SWITCH_NORTH + (north_green & 1), busy);
+
+		decide = select(on_bridge == 0, idle, busy);
+		decide = select(pending != 0, splat(DECIDE_NONE), decide);
+
+		store(&b->decision[i], decide);
+		store(&b->light_update_pending[i],
+		      pending | ((decide == DECIDE_SWITCH_NORTH) & 1) | ((decide == DECIDE_SWITCH_SOUTH) & 1));
+		store(&b->poll_pending[i], poll | ((decide == DECIDE_POLL) & 1));
+	}
+}
+
+void soa_apply(struct SoaBlock* b) {
+	int i;
+
+	for (i = 0; i < SOA_WIDTH; i += LANES) {
+		vec decide = load(&b->decision[i]);
+		vec last = load(&b->last_green_direction[i]);
+		vec north = load(&b->light[NORTHBOUND][i]);
+		vec south = load(&b->light[SOUTHBOUND][i]);
+		uvec passed = load_u(&b->passed_before_change[i]);
+		vec pending = load(&b->light_update_pending[i]);
+		vec green = (decide == DECIDE_GREEN_NORTH) | (decide == DECIDE_GREEN_SOUTH);
+		vec red = (decide == DECIDE_SWITCH_NORTH) | (decide == DECIDE_SWITCH_SOUTH);
+		vec dir = (decide == DECIDE_GREEN_SOUTH) & 1;   // new green direction
+
+		// traffichandler_set_light: a new green direction starts counting again.
+		store_u(&b->passed_before_change[i], passed & (uvec)~(green & (dir != last)));
+		store(&b->light_update_pending[i], pending & ~green);
+
+		// traffichandler_set_red_light remembers which side had green.
+		last = select(red, (north != GREEN) & 1, last);
+		store(&b->last_green_direction[i], select(green, dir, last));
+		store(&b->light[NORTHBOUND][i], select(green, (dir == NORTHBOUND) & 1, select(red, splat(RED), north)));
+		store(&b->light[SOUTHBOUND][i], select(green, (dir == SOUTHBOUND) & 1, select(red, splat(RED), south)));
+	}
+}
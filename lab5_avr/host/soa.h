@@ -0,0 +1,57 @@
+#ifndef SOA_H_
+#define SOA_H_
+
+/* Structure-of-arrays controller state
+The light decision of the controller (traffichandler_check_lights) for many
+scenarios at once, for evaluating a policy change over thousands of traffic
+situations. The decision state of SOA_WIDTH scenarios is kept field by field
+in one block, and soa_check makes the decision for all of them in lockstep,
+eight scenarios per 16-byte SIMD operation, with every branch of the scalar
+code computed and the results selected by mask. All fields are 16 bits wide,
+so that the same eight scenarios of every field fit one register. soa_apply
+then carries out the decisions that take effect at once, as the
+traffichandler_set_light and traffichandler_set_red_light messages that
+traffichandler_check_lights posts without a delay would.
+
+Decisions and the state afterwards are exactly those of the scalar code;
+soabench checks this against the controller run by the host kernel.
+*/
+
+#include <stdint.h>
+#include "objects/traffichandler.h"
+
+#define SOA_WIDTH 64   // scenarios per block
+
+// What traffichandler_check_lights decided.
+enum SoaDecision {
+	DECIDE_NONE,
+	DECIDE_GREEN_NORTH,    // set_light now
+	DECIDE_GREEN_SOUTH,
+	DECIDE_SWITCH_NORTH,   // set_red_light now, switch_light once the bridge is clear
+	DECIDE_SWITCH_SOUTH,
+	DECIDE_POLL,           // check_lights again after TICKS_IDLE_POLL
+};
+
+struct SoaBlock {
+	int16_t in_queue[2][SOA_WIDTH];
+	uint16_t on_bridge[SOA_WIDTH];
+	uint16_t passed_before_change[SOA_WIDTH];
+	int16_t light[2][SOA_WIDTH];
+	int16_t last_green_direction[SOA_WIDTH];
+	int16_t light_update_pending[SOA_WIDTH];
+	int16_t poll_pending[SOA_WIDTH];
+	int16_t decision[SOA_WIDTH];   // enum SoaDecision, from soa_check
+};
+
+// Copy the decision state of a controller into scenario `i` of `b`, and back.
+void soa_load(struct SoaBlock* b, int i, const struct Traffichandler* t);
+void soa_store(const struct SoaBlock* b, int i, struct Traffichandler* t);
+
+// traffichandler_check_lights(self, arg) for every scenario of `b`, with
+// PARAM_MAX_CARS = `max_cars`.
+void soa_check(struct SoaBlock* b, uint16_t max_cars, int arg);
+
+// Carry out the decisions of the last soa_check that take effect at once.
+void soa_apply(struct SoaBlock* b);
+
+#endif /* SOA_H_ */
@@ -0,0 +1,281 @@
+/*
+ * Check and benchmark the structure-of-arrays light decision (soa.h).
+ *
+ * First every combination of a grid of controller states, both kinds of
+ * check and a few MAX_CARS settings is decided by soa_check and soa_apply
+ * and by traffichandler_check_lights itself, run by the host kernel
+ * together with the set_light and set_red_light messages it posts for the
+ * same instant. The decision and the state afterwards must be the same.
+ * Then random states are advanced in lockstep, one soa_check and soa_apply
+ * per step, and the rate is compared with running the controller.
+ *
+ *   soabench [--scenarios n] [--steps n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+
+#include "tinytimber_host.h"
+#include "soa.h"
+#include "objects/communicator.h"
+
+struct options {
+	int scenarios;
+	int steps;
+};
+
+static struct options opt = { 100000, 100 };
+static int shown;   // differences printed so far
+
+// What the controller did, from the observer.
+struct observed {
+	int set_light;       // argument of set_light run now, -1 if none
+	int set_red_light;   // set_red_light ran now
+};
+
+static void observe(void* ctx, Time now, Object* to, Method meth, int arg) {
+	struct observed* o = ctx;
+	(void)now;
+	(void)to;
+	if (meth == (Method)traffichandler_set_light) {
+		o->set_light = arg;
+	} else if (meth == (Method)traffichandler_set_red_light) {
+		o->set_red_light = 1;
+	}
+}
+
+static void on_failure(void* ctx, const char* what, const char* file, int line) {
+	(void)ctx;
+	printf("controller failed: %s (%s:%d)\n", what, file, line);
+	exit(1);
+}
+
+static int green_decision(int lights) {
+	return (lights >> NB_GREEN) & 1 ? DECIDE_GREEN_NORTH : DECIDE_GREEN_SOUTH;
+}
+
+// Run traffichandler_check_lights(ctrl, arg) and whatever it posts for the
+// same instant, and return the decision it made, or -1 if it did something
+// that is not one of the decisions.
+static int reference(struct Traffichandler* ctrl, int arg) {
+	struct TTPending pending[TT_HOST_NMSGS];
+	struct observed o = { -1, 0 };
+	int decision = DECIDE_NONE, i, n;
+
+	tt_host_reset();
+	tt_host_observe(observe, &o);
+	tt_host_on_failure(on_failure, NULL);
+	ASYNC(ctrl, traffichandler_check_lights, arg);
+	tt_host_run_until(tt_host_now());
+
+	if (o.set_light >= 0) {
+		decision = green_decision(o.set_light);
+	}
+	n = tt_host_save(pending, TT_HOST_NMSGS);
+	for (i = 0; i < n; i++) {
+		if (pending[i].to != &ctrl->super) {
+			continue;
+		}
+		if (pending[i].method == (Method)traffichandler_switch_light && o.set_red_light && decision == DECIDE_NONE) {
+			decision = green_decision(pending[i].arg) + (DECIDE_SWITCH_NORTH - DECIDE_GREEN_NORTH);
+		} else if (pending[i].method == (Method)traffichandler_check_lights && pending[i].arg == CHECK_POLL &&
+		           decision == DECIDE_NONE) {
+			decision = DECIDE_POLL;
+		} else {
+			return -1;
+		}
+	}
+	if (o.set_red_light && decision != DECIDE_SWITCH_NORTH && decision != DECIDE_SWITCH_SOUTH) {
+		return -1;
+	}
+	return decision;
+}
+
+static int same_state(const struct Traffichandler* a, const struct Traffichandler* b) {
+	return a->lane[NORTHBOUND].in_queue == b->lane[NORTHBOUND].in_queue &&
+	       a->lane[SOUTHBOUND].in_queue == b->lane[SOUTHBOUND].in_queue &&
+	       a->lane[NORTHBOUND].light == b->lane[NORTHBOUND].light &&
+	       a->lane[SOUTHBOUND].light == b->lane[SOUTHBOUND].light &&
+	       a->on_bridge == b->on_bridge && a->passed_before_change == b->passed_before_change &&
+	       a->last_green_direction == b->last_green_direction &&
+	       a->light_update_pending == b->light_update_pending && a->poll_pending == b->poll_pending;
+}
+
+// Decide block `b`, filled up to `n`, both ways. Returns how many differ.
+static int compare_block(struct SoaBlock* b, int n, uint16_t max_cars, int arg,
+                         struct Communicator* com, struct Traffichandler* ctrl) {
+	struct Traffichandler fresh = initTraffichandler(com);
+	struct Traffichandler before[SOA_WIDTH], after;
+	int i, decision, differ = 0;
+
+	for (i = 0; i < n; i++) {
+		before[i] = fresh;
+		soa_store(b, i, &before[i]);
+	}
+	soa_check(b, max_cars, arg);
+	soa_apply(b);
+	traffic_params.max_cars_before_light_switch = max_cars;
+	for (i = 0; i < n; i++) {
+		*ctrl = before[i];
+		decision = reference(ctrl, arg);
+		after = fresh;
+		soa_store(b, i, &after);
+		if (decision != b->decision[i] || !same_state(ctrl, &after)) {
+			differ++;
+			if (shown++ < 10) {
+				printf("  queues %d/%d, bridge %u, passed %u, last %u, lights %u/%u, pending %d, poll %d, "
+				       "max cars %u, %s: controller %d, soa %d%s\n",
+				       before[i].lane[NORTHBOUND].in_queue, before[i].lane[SOUTHBOUND].in_queue,
+				       before[i].on_bridge, before[i].passed_before_change, before[i].last_green_direction,
+				       before[i].lane[NORTHBOUND].light, before[i].lane[SOUTHBOUND].light,
+				       before[i].light_update_pending, before[i].poll_pending, max_cars,
+				       arg == CHECK_POLL ? "poll" : arg == CHECK_RESET ? "reset" : "event", decision, b->decision[i],
+				       decision == b->decision[i] ? ", state differs" : "");
+			}
+		}
+	}
+	return differ;
+}
+
+// Every state of a small grid. Returns the number of differences.
+static int check_grid(unsigned long* checked, struct Communicator* com, struct Traffichandler* ctrl) {
+	static const uint16_t max_cars[] = { 1, 3, MAX_CARS_BEFORE_LIGHT_SWITCH };
+	struct SoaBlock b;
+	int m, arg, n = 0, differ = 0;
+	int north, south, bridge, passed, last, lights, pending, poll;
+
+	for (m = 0; m < (int)(sizeof(max_cars) / sizeof(max_cars[0])); m++) {
+		for (arg = CHECK_EVENT; arg <= CHECK_RESET; arg++) {
+			for (north = -1; north <= 3; north++)
+			for (south = -1; south <= 3; south++)
+			for (bridge = 0; bridge <= 2; bridge++)
+			for (passed = 0; passed <= 6; passed++)
+			for (last = 0; last <= 1; last++)
+			for (lights = 0; lights <= 3; lights++)
+			for (pending = 0; pending <= 1; pending++)
+			// A poll only runs while it is the one scheduled.
+			for (poll = arg == CHECK_POLL; poll <= 1; poll++) {
+				b.in_queue[NORTHBOUND][n] = north;
+				b.in_queue[SOUTHBOUND][n] = south;
+				b.on_bridge[n] = bridge;
+				b.passed_before_change[n] = passed;
+				b.last_green_direction[n] = last;
+				b.light[NORTHBOUND][n] = lights & 1;
+				b.light[SOUTHBOUND][n] = lights >> 1;
+				b.light_update_pending[n] = pending;
+				b.poll_pending[n] = poll;
+				if (++n == SOA_WIDTH) {
+					differ += compare_block(&b, n, max_cars[m], arg, com, ctrl);
+					*checked += n;
+					n = 0;
+				}
+			}
+			if (n > 0) {
+				differ += compare_block(&b, n, max_cars[m], arg, com, ctrl);
+				*checked += n;
+				n = 0;
+			}
+		}
+	}
+	return differ;
+}
+
+static uint64_t next_u64(uint64_t* s) {
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 2685821657736338717ULL;
+}
+
+static void random_state(struct Traffichandler* t, uint64_t* rng) {
+	uint64_t r = next_u64(rng);
+	t->lane[NORTHBOUND].in_queue = r % 6;
+	t->lane[SOUTHBOUND].in_queue = (r >> 8) % 6;
+	t->on_bridge = (r >> 16) % 6;
+	t->passed_before_change = (r >> 24) % 8;
+	t->last_green_direction = (r >> 32) & 1;
+	t->lane[NORTHBOUND].light = (r >> 33) & 1;
+	t->lane[SOUTHBOUND].light = !t->lane[NORTHBOUND].light && ((r >> 34) & 1);
+	t->light_update_pending = ((r >> 35) & 3) == 0;
+	t->poll_pending = (r >> 37) & 1;
+}
+
+static double since(const struct timespec* t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv) {
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	struct Communicator c = initCommunicator(&ctrl);
+	struct Traffichandler t = initTraffichandler(&com);
+	struct SoaBlock* blocks;
+	struct timespec t0;
+	unsigned long checked = 0;
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	double soa_secs, ref_secs, soa_rate, ref_rate;
+	int differ, n_blocks, i, step;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--scenarios")) opt.scenarios = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--steps")) opt.steps = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--scenarios n] [--steps n]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (opt.scenarios <= 0 || opt.steps <= 0) {
+		fprintf(stderr, "--scenarios and --steps must be positive\n");
+		return 2;
+	}
+	com = c;
+	ctrl = t;
+	UCSR0A = 1 << UDRE0;
+
+	differ = check_grid(&checked, &com, &ctrl);
+	printf("%lu states decided by soa_check and by the controller, %d differ\n", checked, differ);
+
+	n_blocks = (opt.scenarios + SOA_WIDTH - 1) / SOA_WIDTH;
+	blocks = malloc(n_blocks * sizeof(*blocks));
+	if (!blocks) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	for (i = 0; i < n_blocks * SOA_WIDTH; i++) {
+		struct Traffichandler s = t;
+		random_state(&s, &rng);
+		soa_load(&blocks[i / SOA_WIDTH], i % SOA_WIDTH, &s);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (step = 0; step < opt.steps; step++) {
+		for (i = 0; i < n_blocks; i++) {
+			soa_check(&blocks[i], MAX_CARS_BEFORE_LIGHT_SWITCH, CHECK_EVENT);
+			soa_apply(&blocks[i]);
+		}
+	}
+	soa_secs = since(&t0);
+	soa_rate = (double)n_blocks * SOA_WIDTH * opt.steps / soa_secs;
+
+	// The controller is far slower, one step of every scenario is enough.
+	traffic_params.max_cars_before_light_switch = MAX_CARS_BEFORE_LIGHT_SWITCH;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n_blocks * SOA_WIDTH; i++) {
+		ctrl = t;
+		soa_store(&blocks[i / SOA_WIDTH], i % SOA_WIDTH, &ctrl);
+		reference(&ctrl, CHECK_EVENT);
+	}
+	ref_secs = since(&t0);
+	ref_rate = (double)n_blocks * SOA_WIDTH / ref_secs;
+
+	printf("soa_check + soa_apply: %d scenarios x %d steps in %.2f s, %.3g scenarios/s\n",
+	       n_blocks * SOA_WIDTH, opt.steps, soa_secs, soa_rate);
+	printf("controller on the host kernel: %.3g scenarios/s (soa %.0fx faster)\n", ref_rate, soa_rate / ref_rate);
+	free(blocks);
+	return differ != 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * Parameter sweep for the controller constants.
+ *
+ * Evaluates every combination of MAX_CARS_BEFORE_LIGHT_SWITCH,
+ * DELAY_LIGHT_SWITCH and DELAY_FIRST_CHECK from a grid (set through
+ * traffic_params, see traffichandler.h) against a set of arrival-rate
+ * scenarios, on all cores. Every combination sees the same traffic (same
+ * seeds), so differences come from the settings and not from the noise.
+ * For each combination:
+ *   throughput  mean of the cars per hour through the bridge over the
+ *               scenarios, so saturated scenarios decide the ranking,
+ *   max wait    the longest time any car waited from arrival to entry,
+ *   unsafe      entries with the other direction on the bridge; such
+ *               settings are never on the front.
+ * The Pareto front of throughput against max wait is printed, and all
+ * results can be written as CSV.
+ *
+ *   sweep [--threads n] [--hours h] [--seeds n] [--csv file]
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+
+#include "bridge.h"
+
+struct scenario {
+	const char* name;
+	double mean_arrival[2];    // seconds
+};
+
+static const struct scenario scenarios[] = {
+	{ "saturated",  { 2, 2 } },
+	{ "heavy",      { 4, 4 } },
+	{ "rush north", { 3, 12 } },
+	{ "rush south", { 15, 3 } },
+	{ "moderate",   { 8, 8 } },
+	{ "light",      { 30, 45 } },
+};
+#define N_SCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+static const int grid_max_cars[] = { 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 15, 20 };
+static const int grid_light_switch[] = { 0, 100, 250, 500, 750, 1000, 1500, 2000, 3000 };   // ms
+static const int grid_first_check[] = { 0, 50, 100, 250, 500, 750, 1000, 1500, 2000 };      // ms
+#define N_OF(a) (int)(sizeof(a) / sizeof(a[0]))
+
+struct result {
+	int max_cars, light_switch, first_check;
+	double throughput;         // cars per hour
+	double max_wait;           // seconds
+	unsigned long unsafe;
+	int on_front;
+};
+
+struct options {
+	int threads;
+	double hours;
+	int seeds;
+	const char* csv;
+};
+
+static struct options opt = { 0, 2, 3, NULL };
+static struct result* results;
+static int n_results;
+static atomic_int next_result;
+
+static void evaluate(struct result* r, struct Bridge* b) {
+	struct BridgeConfig cfg;
+	struct Communicator com;
+	struct Traffichandler ctrl;
+	Time end = (Time)(opt.hours * 3600 * TICKS_PER_SEC), t, max_wait = 0;
+	double cars_per_hour = 0;
+	int sc, seed, dir;
+
+	traffic_params.max_cars_before_light_switch = r->max_cars;
+	traffic_params.switch_window = TICKS_CROSS_BRIDGE + MSEC(r->light_switch);
+	traffic_params.first_check = MSEC(r->first_check);
+	r->unsafe = 0;
+
+	for (sc = 0; sc < N_SCENARIOS; sc++) {
+		for (seed = 1; seed <= opt.seeds; seed++) {
+			bridge_default_config(&cfg);
+			cfg.mean_arrival[NORTHBOUND] = (Time)(scenarios[sc].mean_arrival[NORTHBOUND] * TICKS_PER_SEC);
+			cfg.mean_arrival[SOUTHBOUND] = (Time)(scenarios[sc].mean_arrival[SOUTHBOUND] * TICKS_PER_SEC);
+			cfg.entry_max = MSEC(500);
+			cfg.wait_bound = 0;
+			bridge_init(b, &cfg, sc * 1000 + seed, &com, &ctrl);
+			for (t = 0; t < end; t += SEC(600)) {
+				bridge_run(b, t + SEC(600) < end ? t + SEC(600) : end);
+			}
+			for (dir = 0; dir < 2; dir++) {
+				cars_per_hour += b->entries[dir] / opt.hours;
+				if (b->max_wait[dir] > max_wait) {
+					max_wait = b->max_wait[dir];
+				}
+			}
+			r->unsafe += b->unsafe;
+		}
+	}
+	r->throughput = cars_per_hour / (N_SCENARIOS * opt.seeds);
+	r->max_wait = (double)max_wait / TICKS_PER_SEC;
+}
+
+static void* worker(void* arg) {
+	struct Bridge* b = malloc(sizeof(*b));
+	int i;
+	(void)arg;
+	while ((i = atomic_fetch_add(&next_result, 1)) < n_results) {
+		evaluate(&results[i], b);
+	}
+	free(b);
+	return NULL;
+}
+
+// Safe results that no other safe result beats on both throughput and
+// max wait.
+static void mark_front(void) {
+	int i, j;
+	for (i = 0; i < n_results; i++) {
+		results[i].on_front = results[i].unsafe == 0;
+		for (j = 0; j < n_results && results[i].on_front; j++) {
+			if (j != i && results[j].unsafe == 0 &&
+			    results[j].throughput >= results[i].throughput && results[j].max_wait <= results[i].max_wait &&
+			    (results[j].throughput > results[i].throughput || results[j].max_wait < results[i].max_wait)) {
+				results[i].on_front = 0;
+			}
+		}
+	}
+}
+
+static int by_throughput(const void* a, const void* b) {
+	const struct result* x = a;
+	const struct result* y = b;
+	return (x->throughput < y->throughput) - (x->throughput > y->throughput);
+}
+
+int main(int argc, char** argv) {
+	struct timespec t0, t1;
+	pthread_t* threads;
+	unsigned long unsafe = 0;
+	double secs;
+	int i, a, b, c;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && !strcmp(argv[i], "--threads")) opt.threads = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--hours")) opt.hours = atof(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--seeds")) opt.seeds = atoi(argv[++i]);
+		else if (i + 1 < argc && !strcmp(argv[i], "--csv")) opt.csv = argv[++i];
+		else {
+			fprintf(stderr, "usage: %s [--threads n] [--hours h] [--seeds n] [--csv file]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (opt.threads <= 0) {
+		opt.threads = get_nprocs();
+	}
+
+	n_results = N_OF(grid_max_cars) * N_OF(grid_light_switch) * N_OF(grid_first_check);
+	results = calloc(n_results, sizeof(*results));
+	threads = calloc(opt.threads, sizeof(*threads));
+	if (!results || !threads) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	i = 0;
+	for (a = 0; a < N_OF(grid_max_cars); a++) {
+		for (b = 0; b < N_OF(grid_light_switch); b++) {
+			for (c = 0; c < N_OF(grid_first_check); c++, i++) {
+				results[i].max_cars = grid_max_cars[a];
+				results[i].light_switch = grid_light_switch[b];
+				results[i].first_check = grid_first_check[c];
+			}
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < opt.threads; i++) {
+		pthread_create(&threads[i], NULL, worker, NULL);
+	}
+	for (i = 0; i < opt.threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	mark_front();
+	qsort(results, n_results, sizeof(*results), by_throughput);
+
+	if (opt.csv) {
+		FILE* f = fopen(opt.csv, "w");
+		if (!f) {
+			perror(opt.csv);
+			return 2;
+		}
+		fprintf(f, "max_cars,light_switch_ms,first_check_ms,throughput_per_hour,max_wait_s,unsafe,pareto\n");
+		for (i = 0; i < n_results; i++) {
+			fprintf(f, "%d,%d,%d,%.2f,%.2f,%lu,%d\n", results[i].max_cars, results[i].light_switch,
+			        results[i].first_check, results[i].throughput, results[i].max_wait,
+			        results[i].unsafe, results[i].on_front);
+		}
+		fclose(f);
+	}
+
+	for (i = 0; i < n_results; i++) {
+		unsafe += results[i].unsafe > 0;
+	}
+	printf("%d combinations x %d scenarios x %d seeds of %g h on %d threads in %.1f s (%.0f simulated h/s)\n",
+	       n_results, N_SCENARIOS, opt.seeds, opt.hours, opt.threads, secs,
+	       n_results * N_SCENARIOS * opt.seeds * opt.hours / secs);
+	printf("scenarios (mean seconds between cars N/S):");
+	for (i = 0; i < N_SCENARIOS; i++) {
+		printf(" %s %g/%g%s", scenarios[i].name, scenarios[i].mean_arrival[NORTHBOUND],
+		       scenarios[i].mean_arrival[SOUTHBOUND], i + 1 < N_SCENARIOS ? "," : "\n");
+	}
+	printf("%lu combinations let opposite directions onto the bridge\n", unsafe);
+	printf("Pareto front, throughput against max wait:\n");
+	printf("  %8s %15s %15s %12s %12s\n", "max cars", "light switch", "first check", "cars/h", "max wait");
+	for (i = 0; i < n_results; i++) {
+		if (results[i].on_front) {
+			printf("  %8d %12d ms %12d ms %12.1f %10.1f s%s\n", results[i].max_cars, results[i].light_switch,
+			       results[i].first_check, results[i].throughput, results[i].max_wait,
+			       results[i].max_cars == MAX_CARS_BEFORE_LIGHT_SWITCH && results[i].light_switch == DELAY_LIGHT_SWITCH &&
+			       results[i].first_check == DELAY_FIRST_CHECK ? "  (current)" : "");
+		}
+	}
+	for (i = 0; i < n_results; i++) {
+		if (results[i].max_cars == MAX_CARS_BEFORE_LIGHT_SWITCH && results[i].light_switch == DELAY_LIGHT_SWITCH &&
+		    results[i].first_check == DELAY_FIRST_CHECK) {
+			printf("current settings: %.1f cars/h, max wait %.1f s%s\n", results[i].throughput,
+			       results[i].max_wait, results[i].on_front ? ", on the front" : "");
+		}
+	}
+	return 0;
+}
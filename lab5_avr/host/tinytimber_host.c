@@ -0,0 +1,503 @@
+/*
+ * TinyTimber.c for the host, see tinytimber_host.h.
+ *
+ * Same queue discipline as the AVR kernel: messages whose baseline has
+ * passed are run in deadline order, the others wait in a timer queue
+ * sorted by baseline. There is no preemption; a message runs to
+ * completion before the next one starts.
+ */
+
+#include "tinytimber_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct msg_block {
+	Msg next;                // for use in linked lists
+	Time baseline;           // event time reference point
+	Time deadline;           // absolute deadline (=priority)
+	Object* to;              // receiving object
+	Method method;           // code to run
+	int arg;                 // argument to the above
+	unsigned char size;      // bytes used in payload, 0 for an int message
+	unsigned char payload[MSG_PAYLOAD];
+};
+
+struct event {
+	Time time;
+	unsigned long seq;       // injection order, among events of the same time
+	TTEvent fn;
+	void* ctx;
+	int arg;
+};
+
+struct kernel {
+	struct msg_block messages[TT_HOST_NMSGS];
+	Msg msgPool;
+	Msg msgQ;
+	Msg timerQ;
+	Msg current;             // message under execution, NULL in interrupts
+	Time now;
+	int msgsInUse;
+	int msgsHighWater;
+
+	Method mtable[N_VECTORS];
+	Object* otable[N_VECTORS];
+
+	struct event events[TT_HOST_NEVENTS];   // binary heap by (time, seq)
+	int nevents;
+	unsigned long eventSeq;
+
+	TTObserver observer;
+	void* observerCtx;
+	TTTransmit transmit;
+	void* transmitCtx;
+	TTFailure failure;
+	void* failureCtx;
+
+	int initialized;
+};
+
+static _Thread_local struct kernel own;
+static _Thread_local struct kernel* active;   // set by tt_host_use, NULL for own
+
+// The kernel the calling thread works on.
+#define k (active ? active : &own)
+
+// Tag for objects locked by the simulation running in this kernel.
+#define OWNED ((struct thread_block*)k)
+
+static void fail(const char* what, const char* file, int line) {
+	if (k->failure) {
+		k->failure(k->failureCtx, what, file, line);
+	}
+	fprintf(stderr, "%s:%d: %s\n", file, line, what);
+	abort();
+}
+
+void tt_host_assert(const char* expr, const char* file, int line) {
+	fail(expr, file, line);
+}
+
+void tt_host_transmit(uint8_t data, int32_t latency) {
+	if (k->transmit) {
+		k->transmit(k->transmitCtx, k->now, data, latency);
+	}
+}
+
+/* queue manager */
+static void enqueueByDeadline(Msg p, Msg* queue) {
+	Msg prev = NULL, q = *queue;
+	while (q && (q->deadline <= p->deadline)) {
+		prev = q;
+		q = q->next;
+	}
+	p->next = q;
+	if (prev == NULL)
+		*queue = p;
+	else
+		prev->next = p;
+}
+
+static void enqueueByBaseline(Msg p, Msg* queue) {
+	Msg prev = NULL, q = *queue;
+	while (q && (q->baseline <= p->baseline)) {
+		prev = q;
+		q = q->next;
+	}
+	p->next = q;
+	if (prev == NULL)
+		*queue = p;
+	else
+		prev->next = p;
+}
+
+static int removeMsg(Msg m, Msg* queue) {
+	Msg prev = NULL, q = *queue;
+	while (q && (q != m)) {
+		prev = q;
+		q = q->next;
+	}
+	if (q) {
+		if (prev)
+			prev->next = q->next;
+		else
+			*queue = q->next;
+		return 1;
+	}
+	return 0;
+}
+
+static Msg allocMsg(void) {
+	Msg m = k->msgPool;
+	if (!m) {
+		fail("message pool exhausted", __FILE__, __LINE__);
+	}
+	k->msgPool = m->next;
+	if (++k->msgsInUse > k->msgsHighWater)
+		k->msgsHighWater = k->msgsInUse;
+	return m;
+}
+
+static void freeMsg(Msg m) {
+	m->next = k->msgPool;
+	k->msgPool = m;
+	k->msgsInUse--;
+}
+
+void tt_host_reset(void) {
+	int i;
+	memset(k, 0, sizeof(*k));
+	for (i = 0; i < TT_HOST_NMSGS - 1; i++)
+		k->messages[i].next = &k->messages[i + 1];
+	k->msgPool = k->messages;
+	k->initialized = 1;
+}
+
+TTKernel* tt_host_new(void) {
+	struct kernel* ctx = malloc(sizeof(*ctx));
+	struct kernel* prev;
+	if (!ctx) {
+		fail("out of memory for a kernel", __FILE__, __LINE__);
+	}
+	prev = tt_host_use(ctx);
+	tt_host_reset();
+	tt_host_use(prev);
+	return ctx;
+}
+
+void tt_host_delete(TTKernel* ctx) {
+	if (ctx == active) {
+		active = NULL;
+	}
+	free(ctx);
+}
+
+TTKernel* tt_host_use(TTKernel* ctx) {
+	struct kernel* prev = active;
+	active = ctx;
+	return prev;
+}
+
+static void retargetQueue(Msg q, Object* from, Object* to) {
+	for (; q; q = q->next) {
+		if (q->to == from)
+			q->to = to;
+	}
+}
+
+void tt_host_retarget(Object* from, Object* to) {
+	int i;
+	retargetQueue(k->msgQ, from, to);
+	retargetQueue(k->timerQ, from, to);
+	for (i = 0; i < N_VECTORS; i++) {
+		if (k->otable[i] == from)
+			k->otable[i] = to;
+	}
+}
+
+void tt_host_observe(TTObserver observer, void* ctx) {
+	k->observer = observer;
+	k->observerCtx = ctx;
+}
+
+void tt_host_on_transmit(TTTransmit transmit, void* ctx) {
+	k->transmit = transmit;
+	k->transmitCtx = ctx;
+}
+
+void tt_host_on_failure(TTFailure failure, void* ctx) {
+	k->failure = failure;
+	k->failureCtx = ctx;
+}
+
+Time tt_host_now(void) {
+	return k->now;
+}
+
+Time tt_host_next(void) {
+	if (k->msgQ)
+		return k->now;
+	if (k->timerQ)
+		return k->timerQ->baseline;
+	return TIME_INFINITY;
+}
+
+int tt_host_step(void) {
+	Msg m;
+	if (!k->msgQ) {
+		if (!k->timerQ)
+			return 0;
+		if (k->timerQ->baseline > k->now)
+			k->now = k->timerQ->baseline;
+		while (k->timerQ && k->timerQ->baseline <= k->now) {
+			m = k->timerQ;
+			k->timerQ = m->next;
+			enqueueByDeadline(m, &k->msgQ);
+		}
+	}
+	m = k->msgQ;
+	k->msgQ = m->next;
+	k->current = m;
+	if (k->observer)
+		k->observer(k->observerCtx, k->now, m->to, m->method, m->arg);
+	m->to->ownedBy = OWNED;
+	if (m->size)
+		((BlockMethod)m->method)(m->to, m->payload);
+	else
+		m->method(m->to, m->arg);
+	m->to->ownedBy = NULL;
+	k->current = NULL;
+	freeMsg(m);
+	return 1;
+}
+
+/* injected events */
+static int eventBefore(const struct event* a, const struct event* b) {
+	return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+int tt_host_inject(Time t, TTEvent fn, void* ctx, int arg) {
+	struct event e;
+	int i = k->nevents;
+	if (i == TT_HOST_NEVENTS)
+		return -1;
+	e.time = t;
+	e.seq = k->eventSeq++;
+	e.fn = fn;
+	e.ctx = ctx;
+	e.arg = arg;
+	for (; i > 0 && eventBefore(&e, &k->events[(i - 1) / 2]); i = (i - 1) / 2)
+		k->events[i] = k->events[(i - 1) / 2];
+	k->events[i] = e;
+	k->nevents++;
+	return 0;
+}
+
+static struct event popEvent(void) {
+	struct event top = k->events[0];
+	struct event last = k->events[--k->nevents];
+	int i = 0, c;
+	while ((c = 2 * i + 1) < k->nevents) {
+		if (c + 1 < k->nevents && eventBefore(&k->events[c + 1], &k->events[c]))
+			c++;
+		if (!eventBefore(&k->events[c], &last))
+			break;
+		k->events[i] = k->events[c];
+		i = c;
+	}
+	k->events[i] = last;
+	return top;
+}
+
+Time tt_host_next_batch(void) {
+	Time t = tt_host_next();
+	if (k->nevents && k->events[0].time < t)
+		t = k->events[0].time;
+	return t;
+}
+
+int tt_host_batch(Time until) {
+	Time t = tt_host_next_batch();
+	int n = 0;
+	if (t > until) {
+		tt_host_advance(until);
+		return 0;
+	}
+	if (t > k->now)
+		k->now = t;
+	while (k->nevents && k->events[0].time <= k->now) {
+		struct event e = popEvent();
+		e.fn(e.ctx, e.arg);
+		n++;
+	}
+	while (tt_host_next() <= k->now) {
+		tt_host_step();
+		n++;
+	}
+	return n;
+}
+
+void tt_host_run_until(Time t) {
+	while (tt_host_next() <= t)
+		tt_host_step();
+	if (t > k->now)
+		k->now = t;
+}
+
+void tt_host_advance(Time t) {
+	if (t > k->now)
+		k->now = t;
+}
+
+void tt_host_irq(enum Vector i) {
+	Msg saved = k->current;
+	k->current = NULL;
+	if (k->mtable[i])
+		k->mtable[i](k->otable[i], i);
+	k->current = saved;
+}
+
+static int saveQueue(Msg q, struct TTPending* out, int n, int max) {
+	for (; q; q = q->next, n++) {
+		if (n >= max)
+			return -1;
+		out[n].to = q->to;
+		out[n].method = q->method;
+		out[n].arg = q->arg;
+		out[n].offset = q->baseline - k->now;
+		out[n].deadline = q->deadline - q->baseline;
+		out[n].size = q->size;
+		memcpy(out[n].payload, q->payload, q->size);
+	}
+	return n;
+}
+
+int tt_host_save(struct TTPending* out, int max) {
+	int n = saveQueue(k->msgQ, out, 0, max);
+	return n < 0 ? n : saveQueue(k->timerQ, out, n, max);
+}
+
+void tt_host_load(const struct TTPending* in, int n, Time now) {
+	int i;
+	k->now = now;
+	k->current = NULL;
+	k->nevents = 0;
+	while (k->msgQ) {
+		Msg m = k->msgQ;
+		k->msgQ = m->next;
+		freeMsg(m);
+	}
+	while (k->timerQ) {
+		Msg m = k->timerQ;
+		k->timerQ = m->next;
+		freeMsg(m);
+	}
+	// Equal keys are queued behind each other, so the saved order is kept.
+	for (i = 0; i < n; i++) {
+		Msg m = allocMsg();
+		m->to = in[i].to;
+		m->method = in[i].method;
+		m->arg = in[i].arg;
+		m->baseline = k->now + in[i].offset;
+		m->deadline = m->baseline + in[i].deadline;
+		m->size = in[i].size;
+		memcpy(m->payload, in[i].payload, in[i].size);
+		if (in[i].offset > 0)
+			enqueueByBaseline(m, &k->timerQ);
+		else
+			enqueueByDeadline(m, &k->msgQ);
+	}
+}
+
+/* communication primitives */
+static void post(Msg m, Time bl, Time dl) {
+	m->baseline = (k->current ? k->current->baseline : k->now) + bl;
+	m->deadline = m->baseline + (dl > 0 ? dl : TIME_INFINITY);
+	if (m->baseline > k->now)
+		enqueueByBaseline(m, &k->timerQ);
+	else
+		enqueueByDeadline(m, &k->msgQ);
+}
+
+Msg async(Time bl, Time dl, Object* to, Method meth, int arg) {
+	Msg m = allocMsg();
+	m->to = to;
+	m->method = meth;
+	m->arg = arg;
+	m->size = 0;
+	post(m, bl, dl);
+	return m;
+}
+
+Msg async_block(Time bl, Time dl, Object* to, BlockMethod meth, const void* blk, unsigned char size) {
+	Msg m = allocMsg();
+	m->to = to;
+	m->method = (Method)meth;
+	m->arg = 0;
+	m->size = size;
+	memcpy(m->payload, blk, size);
+	post(m, bl, dl);
+	return m;
+}
+
+int sync(Object* to, Method meth, int arg) {
+	int result;
+	if (to->ownedBy) {                   // only ever locked further up our own stack
+#ifdef TT_CONTENTION_STATS
+		to->deadlocks++;
+#endif
+		return -1;
+	}
+	to->ownedBy = OWNED;
+	result = meth(to, arg);
+	to->ownedBy = NULL;
+	return result;
+}
+
+#ifdef TT_CONTENTION_STATS
+void contention(Object* obj, Contention* c, int reset) {
+	c->contended = obj->contended;
+	c->deadlocks = obj->deadlocks;
+	c->blocked = obj->blocked;
+	if (reset) {
+		obj->contended = 0;
+		obj->deadlocks = 0;
+		obj->blocked = 0;
+	}
+}
+#endif
+
+void ABORT(Msg m) {
+	if (removeMsg(m, &k->timerQ) || removeMsg(m, &k->msgQ))
+		freeMsg(m);
+}
+
+void T_RESET(Timer* t) {
+	t->accum = CURRENT_BASELINE();
+}
+
+Time T_SAMPLE(Timer* t) {
+	return CURRENT_BASELINE() - t->accum;
+}
+
+Time CURRENT_OFFSET(void) {
+	return k->now - CURRENT_BASELINE();
+}
+
+Time CURRENT_BASELINE(void) {
+	return k->current ? k->current->baseline : k->now;
+}
+
+// The virtual time goes on over tt_host_load, as over a crash reset, and
+// starts from 0 with tt_host_reset, as after a power-on.
+unsigned int UPTIME(void) {
+	return (unsigned int)(k->now >> 16);
+}
+
+int MSG_HIGH_WATER(void) {
+	return k->msgsHighWater;
+}
+
+/* initialization */
+void install(Object* obj, Method m, enum Vector i) {
+	if (i >= 0 && i < N_VECTORS) {
+		k->otable[i] = obj;
+		k->mtable[i] = m;
+	}
+}
+
+void install_fast(Object* obj, Method m, enum Vector i) {
+	install(obj, m, i);
+}
+
+// Unlike on the target this returns at once: the startup message is
+// posted and the harness drives the simulation from there.
+int tinytimber(Object* obj, Method m, int arg) {
+	if (!k->initialized)
+		tt_host_reset();
+	if (m != NULL)
+		ASYNC(obj, m, arg);
+	return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef TINYTIMBER_HOST_H_
+#define TINYTIMBER_HOST_H_
+
+/* TinyTimber on the host
+Implements the TinyTimber.h API on a PC so that the unmodified application
+objects can be run in simulation. Time is virtual: it only moves when the
+harness asks for the next event, and every message runs to completion at
+the instant of its baseline. Interrupts are simulated by calling the
+installed handler between two messages (tt_host_irq).
+
+All kernel state is kept in a kernel context. Each thread has one of its
+own, so each thread can run its own independent simulation, and a harness
+that runs many simulations can give each of them a context with
+tt_host_new and switch between them with tt_host_use (see fleet.c).
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+
+// Number of message blocks available on the host.
+#ifndef TT_HOST_NMSGS
+#define TT_HOST_NMSGS 64
+#endif
+
+// Number of injected events that can wait at once (see tt_host_inject).
+#ifndef TT_HOST_NEVENTS
+#define TT_HOST_NEVENTS 64
+#endif
+
+// Called before every message is executed, with the virtual time.
+typedef void (*TTObserver)(void* ctx, Time now, Object* to, Method meth, int arg);
+
+// Called for every byte the application writes to UDR0, with the virtual
+// time and how long ago the light state was decided. The host has no
+// transmitter: UDRE0 stays as the harness leaves it.
+typedef void (*TTTransmit)(void* ctx, Time now, uint8_t data, Time latency);
+
+// An injected event, e.g. a sensor byte that sets UDR0 and calls tt_host_irq.
+typedef void (*TTEvent)(void* ctx, int arg);
+
+// Called on a failed ASSERT or a kernel error (e.g. message pool exhausted).
+// If it returns, the process is aborted.
+typedef void (*TTFailure)(void* ctx, const char* what, const char* file, int line);
+
+// A kernel context: message pool, queues, time, installed handlers, observer,
+// transmit and failure handlers.
+typedef struct kernel TTKernel;
+
+// A new context, as after tt_host_reset.
+TTKernel* tt_host_new(void);
+void tt_host_delete(TTKernel* ctx);
+
+// Make the calling thread work on `ctx`, or on its own context if NULL, and
+// return the context it worked on before. A context may be used by any
+// thread, but only by one at a time and only between messages.
+TTKernel* tt_host_use(TTKernel* ctx);
+
+// Redirect pending messages and installed handlers from `from` to `to`, for
+// an object that has moved. Needed when a simulation goes on in another
+// thread, since the thread-local application objects (storage, display) are
+// at a different address there.
+void tt_host_retarget(Object* from, Object* to);
+
+// Empty all queues, forget installed handlers and set the time to 0.
+void tt_host_reset(void);
+
+// Install the observer, the transmit and the failure handler of the current
+// context.
+void tt_host_observe(TTObserver observer, void* ctx);
+void tt_host_on_transmit(TTTransmit transmit, void* ctx);
+void tt_host_on_failure(TTFailure failure, void* ctx);
+
+// Current virtual time.
+Time tt_host_now(void);
+
+// Baseline of the next message to run, TIME_INFINITY when there is none.
+Time tt_host_next(void);
+
+// Run the next message, advancing the time to its baseline if needed.
+// Returns 0 if there was nothing to run.
+int tt_host_step(void);
+
+// Run every message with a baseline up to `t`, then set the time to `t`.
+void tt_host_run_until(Time t);
+
+// Set the time to `t` without running anything. Nothing may be due before `t`.
+void tt_host_advance(Time t);
+
+// Batched virtual time
+// Instead of stepping message by message, a harness can inject its
+// environment events (sensor bytes) ahead of time and let the clock jump
+// from one event time to the next: the cost of a run is then proportional
+// to the number of events, however long the quiet stretches between them.
+
+// Run `fn(ctx, arg)` when the clock reaches `t`. Returns -1 if
+// TT_HOST_NEVENTS events are already waiting; inject a few ahead of the
+// clock and top them up between batches.
+int tt_host_inject(Time t, TTEvent fn, void* ctx, int arg);
+
+// Time of the next batch: the earlier of tt_host_next() and the first
+// injected event.
+Time tt_host_next_batch(void);
+
+// Jump to the time of the next batch and run it, if it is due by `until`:
+// first the events injected for that time, in the order they were
+// injected, then every message that is due, including those posted for the
+// same time while the batch runs. The events thus come in like interrupts
+// after everything due before their time. Returns the number of events and
+// messages run, or 0, with the time set to `until`, if nothing is due by
+// then.
+int tt_host_batch(Time until);
+
+// Simulate interrupt `i` at the current time: the installed handler runs
+// with the current time as its baseline.
+void tt_host_irq(enum Vector i);
+
+// A message waiting in one of the queues, with its times relative to now.
+struct TTPending {
+	Object* to;
+	Method method;
+	int arg;
+	Time offset;             // baseline - now, <= 0 once it is due
+	Time deadline;           // deadline - baseline
+	unsigned char size;      // payload bytes, 0 for an int message
+	unsigned char payload[MSG_PAYLOAD];
+};
+
+// Copy the pending messages into `out` in the order they would be run,
+// ready messages first. Returns how many there are, or -1 if more than
+// `max`. Must be called between messages.
+int tt_host_save(struct TTPending* out, int max);
+
+// Set the time to `now`, drop all pending messages and injected events and
+// post `in[0..n)` relative to it, as saved by tt_host_save. Installed
+// handlers, the observer and the failure handler are kept.
+void tt_host_load(const struct TTPending* in, int n, Time now);
+
+#endif /* TINYTIMBER_HOST_H_ */
@@ -40,27 +40,37 @@
 #include "TinyTimber.h"
 
 #include <setjmp.h>
+#include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/wdt.h>
 
 #define STACKSIZE       96
-#define NMSGS           15
-#define NTHREADS        4
+#define NMSGS           15      // MSG_BLOCKS of them with room for an argument block
+// Without deadlines a message only preempts one with a later baseline, which
+// hardly ever happens, so one thread runs the messages and the second is
+// for that. 126 bytes of RAM each.
+#define NTHREADS        2       // with TT_SINGLE_STACK, most messages nested on the stack
+
+#if defined(TT_SINGLE_STACK) && defined(TT_STAGED_POST)
+#error "TT_SINGLE_STACK and TT_STAGED_POST cannot be combined"
+#endif
 
 #define STATUS()        (SREG & 0x80)
 #define DISABLE(s)      { s = STATUS(); cli(); }
 #define ENABLE(s)       if (s) sei();
 #define SLEEP()         { SMCR = 0x01; __asm__ __volatile__ ("sleep" ::); }
-#define PANIC()         { LCDDR0 = 0xFF; LCDDR1 = 0xFF; LCDDR2 = 0xFF; while (1) SLEEP(); }
-                        // Light up the display...
+#define PANIC()         crash(CRASH_PANIC, __LINE__)
+                        // Reset through the watchdog, see CRASH
 #define SETSTACK(buf,a) { *((unsigned int *)(buf)+8) = (unsigned int)(a) + STACKSIZE - 4; \
                           *((unsigned int *)(buf)+9) = (unsigned int)(a) + STACKSIZE - 4; }
 #define SETPC(buf, a)   *((unsigned int *)((unsigned char *)(buf) + 21)) = (unsigned int)(a)
 
 #define TIMER_INIT()    { CLKPR = 0x80; CLKPR = 0x00; \
-                          TCNT1 = 0x0000; TCCR1B = 0x04; TIMSK1 = 0x01; }
+                          TCNT1 = 0x0000; TCCR1B = 0x04; OCR1B = 0x8000; TIMSK1 = 0x01 | (1 << OCIE1B); }
                         // No system clock prescaling
                         // Normal mode, clk/256 prescaling, enable timer overflow interrupts
+                        // and compare B halfway between them (watchdog heartbeat)
 #define TIMER_OCLR()    // No timer overflow interrupt clear necessary
 #define TIMER_CCLR()    // No timer compare interrupt clear necessary
 #define TIMERGET(x)     (x) = ((Time)overflows << 16) | (unsigned int)TCNT1; \
@@ -71,12 +81,20 @@
                           } else \
                              TIMSK1 &= ~0x02; \
                         }
+#ifdef TT_TIME24
+#define HIGH16(x)       (signed char)((x) >> 16)
+#else
 #define HIGH16(x)       (int)((x) >> 16)
+#endif
 #define LOW16(x)        (unsigned int)((x) & 0xffff)
 #define MAX(a,b)        ( (a)-(b) <= 0 ? (b) : (a) )
-#define INFINITY        0x7fffffffL
+#define INFINITY        TIME_INFINITY
 #define INF(a)          ( (a)==0 ? INFINITY : (a) )
 
+#define WATCHDOG        WDTO_2S
+#define CRASH_MAGIC     0xC4A5
+#define IDLE()          (current == &thread0)
+
 typedef struct thread_block *Thread;
 
 #define INSTALLED_TAG (Thread)1
@@ -90,66 +108,161 @@ struct msg_block {
     int arg;                 // argument to the above
 };
 
+// A message that carries an argument block (async_block). msg comes
+// first, so that a pointer to one is also a Msg.
+struct block_msg {
+    struct msg_block msg;
+    unsigned char payload[MSG_PAYLOAD];
+};
+
 struct thread_block {
     Thread next;             // for use in linked lists
     Msg msg;                 // message under execution
     Object *waitsFor;        // deadlock detection link
+#ifdef TT_STAGED_POST
+    Msg merging;             // message being moved out of staged, NULL if aborted
+#endif
+#ifndef TT_SINGLE_STACK
     jmp_buf context;         // machine state
+#endif
 };
 
+struct msg_block    messages[NMSGS - MSG_BLOCKS];
+struct block_msg    blockMessages[MSG_BLOCKS];
+
+#define IS_BLOCK(m)     ((uintptr_t)(m) - (uintptr_t)blockMessages < sizeof(blockMessages))
+#define PAYLOAD(m)      (IS_BLOCK(m) ? ((struct block_msg *)(m))->payload : NULL)
+
+#ifdef TT_SINGLE_STACK
+// Messages run to completion on the one stack. A message that preempts
+// another runs nested inside the interrupt handler or the method that
+// posted it, and its thread_block is a local variable of that nesting
+// level; activeStack links the levels, innermost first.
+unsigned char nesting = 0;
+#else
 struct stack {
     unsigned char stack[STACKSIZE];
 };
 
-struct msg_block    messages[NMSGS];
 struct thread_block threads[NTHREADS];
 struct stack        stacks[NTHREADS];
+#endif
 
 struct thread_block thread0;
 
 Msg msgPool         = messages;
+Msg blockPool       = &blockMessages[0].msg;
 Msg msgQ            = NULL;
 Msg timerQ          = NULL;
 Time timestamp      = 0;
+#ifdef TT_TIME24
+signed char overflows = 0;   // only the byte that fits above TCNT1 in a 24-bit Time
+#else
 int overflows       = 0;
+#endif
 
+#ifndef TT_SINGLE_STACK
 Thread threadPool   = threads;
+#endif
 Thread activeStack  = &thread0;
 Thread current      = &thread0;
 
+#ifdef TT_STAGED_POST
+Msg staged          = NULL;     // posted but not yet in msgQ or timerQ, newest first
+Time stagedDeadline;            // earliest deadline in staged, at most
+unsigned char queueEpoch = 0;   // changed whenever msgQ or timerQ changes
+#endif
+
+#ifndef TT_STATIC_IRQ
 Method  mtable[N_VECTORS];
 Object *otable[N_VECTORS];
+unsigned long fastVectors = 0;  // bit n set: vector n installed with INSTALL_FAST
+#endif
+
+// Not cleared at startup, so that it tells what happened before a reset.
+struct crash_block {
+    unsigned int magic;      // CRASH_MAGIC if the record is from an earlier run
+    CrashRecord rec;
+    unsigned int uptime;     // timer overflows since power-on, see UPTIME
+};
+struct crash_block crashBlock __attribute__((section(".noinit")));
+unsigned char resetCause __attribute__((section(".noinit")));   // MCUSR at startup
+
+// Runs before the C runtime sets up RAM. A watchdog reset leaves the
+// watchdog running with its shortest timeout, so it must be stopped here.
+void saveResetCause(void) __attribute__((naked, used, section(".init3")));
+void saveResetCause(void) {
+    resetCause = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+}
 
 static void schedule(void);
+#ifdef TT_STAGED_POST
+static void stage(Msg m);
+#endif
 
 #define TIMER_COMPARE_INTERRUPT  ISR(TIMER1_COMPA_vect)
 #define TIMER_OVERFLOW_INTERRUPT ISR(TIMER1_OVF_vect)
 
-#define IRQ(n,v) ISR(v) { TIMERGET(timestamp); if (mtable[n]) mtable[n](otable[n],n); schedule(); }
-
-IRQ(IRQ_INT0,            INT0_vect);
-IRQ(IRQ_PCINT0,          PCINT0_vect);
-IRQ(IRQ_PCINT1,          PCINT1_vect);
-IRQ(IRQ_TIMER2_COMP,     TIMER2_COMP_vect);
-IRQ(IRQ_TIMER2_OVF,      TIMER2_OVF_vect);
-IRQ(IRQ_TIMER0_COMP,     TIMER0_COMP_vect);
-IRQ(IRQ_TIMER0_OVF,      TIMER0_OVF_vect);
-IRQ(IRQ_SPI_STC,         SPI_STC_vect);
-IRQ(IRQ_USART0_RX,       USART0_RX_vect);
-IRQ(IRQ_USART0_UDRE,     USART0_UDRE_vect);
-IRQ(IRQ_USART0_TX,       USART0_TX_vect);
-IRQ(IRQ_USI_START,       USI_START_vect);
-IRQ(IRQ_USI_OVERFLOW,    USI_OVERFLOW_vect);
-IRQ(IRQ_ANALOG_COMP,     ANALOG_COMP_vect);
-IRQ(IRQ_ADC,             ADC_vect);
-IRQ(IRQ_EE_READY,        EE_READY_vect);
-IRQ(IRQ_SPM_READY,       SPM_READY_vect);
-IRQ(IRQ_LCD,             LCD_vect);
+#define VECTOR_IRQ_INT0            INT0_vect
+#define VECTOR_IRQ_PCINT0          PCINT0_vect
+#define VECTOR_IRQ_PCINT1          PCINT1_vect
+#define VECTOR_IRQ_TIMER2_COMP     TIMER2_COMP_vect
+#define VECTOR_IRQ_TIMER2_OVF      TIMER2_OVF_vect
+#define VECTOR_IRQ_TIMER0_COMP     TIMER0_COMP_vect
+#define VECTOR_IRQ_TIMER0_OVF      TIMER0_OVF_vect
+#define VECTOR_IRQ_SPI_STC         SPI_STC_vect
+#define VECTOR_IRQ_USART0_RX       USART0_RX_vect
+#define VECTOR_IRQ_USART0_UDRE     USART0_UDRE_vect
+#define VECTOR_IRQ_USART0_TX       USART0_TX_vect
+#define VECTOR_IRQ_USI_START       USI_START_vect
+#define VECTOR_IRQ_USI_OVERFLOW    USI_OVERFLOW_vect
+#define VECTOR_IRQ_ANALOG_COMP     ANALOG_COMP_vect
+#define VECTOR_IRQ_ADC             ADC_vect
+#define VECTOR_IRQ_EE_READY        EE_READY_vect
+#define VECTOR_IRQ_SPM_READY       SPM_READY_vect
+#define VECTOR_IRQ_LCD             LCD_vect
+
+#ifdef TT_STATIC_IRQ
+// Handlers are called directly from their vectors, see TT_IRQ_BINDINGS.
+#include "irq_bindings.h"
+
+#define STATIC_IRQ(n,obj,meth)      ISR(VECTOR_##n) { TIMERGET(timestamp); meth(obj,n); schedule(); }
+#define STATIC_IRQ_FAST(n,obj,meth) ISR(VECTOR_##n) { meth(obj,n); }
+
+TT_IRQ_BINDINGS(STATIC_IRQ, STATIC_IRQ_FAST)
+
+// An interrupt was enabled without a binding.
+ISR(BADISR_vect) { PANIC(); }
+#else
+#define IRQ(n) ISR(VECTOR_##n) { if (fastVectors & (1UL << (n))) { mtable[n](otable[n],n); return; } \
+                       TIMERGET(timestamp); if (mtable[n]) mtable[n](otable[n],n); schedule(); }
+
+IRQ(IRQ_INT0);
+IRQ(IRQ_PCINT0);
+IRQ(IRQ_PCINT1);
+IRQ(IRQ_TIMER2_COMP);
+IRQ(IRQ_TIMER2_OVF);
+IRQ(IRQ_TIMER0_COMP);
+IRQ(IRQ_TIMER0_OVF);
+IRQ(IRQ_SPI_STC);
+IRQ(IRQ_USART0_RX);
+IRQ(IRQ_USART0_UDRE);
+IRQ(IRQ_USART0_TX);
+IRQ(IRQ_USI_START);
+IRQ(IRQ_USI_OVERFLOW);
+IRQ(IRQ_ANALOG_COMP);
+IRQ(IRQ_ADC);
+IRQ(IRQ_EE_READY);
+IRQ(IRQ_SPM_READY);
+IRQ(IRQ_LCD);
+#endif
 
 /* queue manager */
 void enqueueByDeadline(Msg p, Msg *queue) {
     Msg prev = NULL, q = *queue;
-    while (q && (q->deadline <= p->deadline)) {
+    while (q && (q->deadline - p->deadline <= 0)) {
         prev = q;
         q = q->next;
     }
@@ -162,7 +275,7 @@ void enqueueByDeadline(Msg p, Msg *queue) {
 
 void enqueueByBaseline(Msg p, Msg *queue) {
     Msg prev = NULL, q = *queue;
-    while (q && (q->baseline <= p->baseline )) {
+    while (q && (q->baseline - p->baseline <= 0)) {
         prev = q;
         q = q->next;
     }
@@ -187,6 +300,27 @@ void insert(Msg m, Msg *queue) {
     *queue = m;
 }
 
+#ifdef TT_STATS
+unsigned char msgsInUse     = 0;
+unsigned char msgsHighWater = 0;   // most messages ever allocated at once
+#endif
+
+static Msg allocMsg(Msg *pool) {
+    Msg m = dequeue(pool);
+#ifdef TT_STATS
+    if (++msgsInUse > msgsHighWater)
+        msgsHighWater = msgsInUse;
+#endif
+    return m;
+}
+
+static void freeMsg(Msg m) {
+    insert(m, IS_BLOCK(m) ? &blockPool : &msgPool);
+#ifdef TT_STATS
+    msgsInUse--;
+#endif
+}
+
 void push(Thread t, Thread *stack) {
     t->next = *stack;
     *stack = t;
@@ -217,20 +351,66 @@ static int remove(Msg m, Msg *queue) {
 TIMER_OVERFLOW_INTERRUPT {
     TIMER_OCLR();
     overflows++;
+    crashBlock.uptime++;
     TIMERSET(timerQ);
+    if (IDLE())
+        wdt_reset();
+}
+
+ISR(TIMER1_COMPB_vect) {        // heartbeat, so an idle system feeds the watchdog every second
+    if (IDLE())
+        wdt_reset();
 }
 
 TIMER_COMPARE_INTERRUPT {
     Time now;
     TIMER_CCLR();
     TIMERGET(now);
-    while (timerQ && (timerQ->baseline - now <= 0))
+    while (timerQ && (timerQ->baseline - now <= 0)) {
+#ifdef TT_STAGED_POST
+        stage( dequeue(&timerQ) );
+        queueEpoch++;
+#else
         enqueueByDeadline( dequeue(&timerQ), &msgQ );
+#endif
+    }
     TIMERSET(timerQ);
     schedule();
 }
 
 /* context switching */
+static int call(Object *to, Method meth, int arg, const unsigned char *blk);
+#ifdef TT_SINGLE_STACK
+// Run messages at a new nesting level for as long as they are more urgent
+// than the one that was preempted, and their receivers are not locked by
+// it or by another preempted message. Called with interrupts disabled.
+static void runNested(void) {
+    struct thread_block level;
+    Msg this, oldMsg = activeStack->msg;
+    char status = 1;
+
+    level.msg = NULL;
+    level.waitsFor = NULL;
+    push(&level, &activeStack);
+    current = &level;
+    nesting++;
+    while (msgQ && !msgQ->to->ownedBy && (!oldMsg || (msgQ->deadline - oldMsg->deadline <= 0))) {
+        this = level.msg = dequeue(&msgQ);
+        crashBlock.rec.to = this->to;   // left for a watchdog reset to report
+        crashBlock.rec.method = this->method;
+        ENABLE(status);
+        call(this->to, this->method, this->arg, PAYLOAD(this));
+        DISABLE(status);
+        freeMsg(this);
+        wdt_reset();
+    }
+    nesting--;
+    pop(&activeStack);
+    current = activeStack;
+    crashBlock.rec.to = oldMsg ? oldMsg->to : NULL;
+    crashBlock.rec.method = oldMsg ? oldMsg->method : NULL;
+}
+#else
 static void dispatch( Thread next ) {
     if (setjmp( current->context ) == 0) {
         current = next;
@@ -238,28 +418,56 @@ static void dispatch( Thread next ) {
     }
 }
 
+// Give the running thread back to the pool and resume the thread it
+// preempted, or the thread that one is waiting for.
+static void yield(Msg oldMsg) {
+    Thread t;
+    crashBlock.rec.to = oldMsg ? oldMsg->to : NULL;
+    crashBlock.rec.method = oldMsg ? oldMsg->method : NULL;
+    push(pop(&activeStack), &threadPool);
+    t = activeStack;  // can't be NULL, may be &thread0
+    while (t->waitsFor) 
+        t = t->waitsFor->ownedBy;
+    dispatch(t);
+}
+
+#ifdef TT_STAGED_POST
+static void merge(void);
+#endif
+
 static void run(void) {
     while (1) {
-        Msg this = current->msg = dequeue(&msgQ);
-        Msg oldMsg;
+        Msg this, oldMsg;
         char status = 1;
-        
+
+#ifdef TT_STAGED_POST
+        // A thread is also started for staged messages, which may turn out
+        // not to be urgent once they are in the queues.
         ENABLE(status);
-        SYNC(this->to, this->method, this->arg);
-        DISABLE(status);
-        insert(this, &msgPool);
-       
+        merge();
         oldMsg = activeStack->next->msg;
         if (!msgQ || (oldMsg && (msgQ->deadline - oldMsg->deadline > 0))) {
-            Thread t;
-            push(pop(&activeStack), &threadPool);
-            t = activeStack;  // can't be NULL, may be &thread0
-            while (t->waitsFor) 
-	            t = t->waitsFor->ownedBy;
-            dispatch(t);
+            yield(oldMsg);
+            continue;
         }
+        queueEpoch++;
+#endif
+        this = current->msg = dequeue(&msgQ);
+        crashBlock.rec.to = this->to;   // left for a watchdog reset to report
+        crashBlock.rec.method = this->method;
+        ENABLE(status);
+        call(this->to, this->method, this->arg, PAYLOAD(this));
+        DISABLE(status);
+        freeMsg(this);
+        wdt_reset();
+#ifndef TT_STAGED_POST
+        oldMsg = activeStack->next->msg;
+        if (!msgQ || (oldMsg && (msgQ->deadline - oldMsg->deadline > 0)))
+            yield(oldMsg);
+#endif
     }
 }
+#endif
 
 static void idle(void) {
     schedule();
@@ -271,22 +479,106 @@ static void idle(void) {
 
 static void schedule(void) {
     Msg topMsg = activeStack->msg;
+#ifdef TT_STAGED_POST
+    // Staged messages are merged by the thread that is started for them.
+    if (staged && threadPool && ((!topMsg) || (stagedDeadline - topMsg->deadline < 0))) {
+        push(pop(&threadPool), &activeStack);
+        dispatch(activeStack);
+        return;
+    }
+#endif
+#ifdef TT_SINGLE_STACK
+    if (msgQ && nesting < NTHREADS && !msgQ->to->ownedBy &&
+        ((!topMsg) || (msgQ->deadline - topMsg->deadline < 0)))
+        runNested();
+#else
     if (msgQ && threadPool && ((!topMsg) || (msgQ->deadline - topMsg->deadline < 0))) {
         push(pop(&threadPool), &activeStack);
         dispatch(activeStack);
     }
+#endif
 }
 
 /* communication primitives */
-Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
-    Msg m;
-    Time now;
+#ifdef TT_STAGED_POST
+// Posting only pushes the message onto staged, so that interrupt handlers
+// never walk the queues. Threads move staged messages into msgQ and timerQ
+// with interrupts enabled, only turning them off for each step of the
+// walk, and start the walk over if the queues change in between.
+static void stage(Msg m) {
+    if (!staged || m->deadline - stagedDeadline < 0)
+        stagedDeadline = m->deadline;
+    insert(m, &staged);
+}
+
+static void enqueueStaged(Msg m) {
+    Msg *queue, prev, q;
+    unsigned char epoch, byBaseline;
     char status;
+    Time now;
+restart:
     DISABLE(status);
-    m = dequeue(&msgPool);
-    m->to = to; 
-    m->method = meth; 
-    m->arg = arg;
+    if (current->merging != m) {        // aborted in the meantime
+        freeMsg(m);
+        ENABLE(status);
+        return;
+    }
+    TIMERGET(now);
+    byBaseline = m->baseline - now > 0; // baseline has not yet passed
+    queue = byBaseline ? &timerQ : &msgQ;
+    epoch = queueEpoch;
+    prev = NULL;
+    q = *queue;
+    while (q && (byBaseline ? q->baseline - m->baseline <= 0 : q->deadline - m->deadline <= 0)) {
+        prev = q;
+        q = q->next;
+        ENABLE(status);                 // interrupts get in before the cli of DISABLE
+        DISABLE(status);
+        if (queueEpoch != epoch || current->merging != m)
+            goto restart;
+    }
+    m->next = q;
+    if (prev == NULL)
+        *queue = m;
+    else
+        prev->next = m;
+    queueEpoch++;
+    current->merging = NULL;
+    if (byBaseline)
+        TIMERSET(timerQ);
+    ENABLE(status);
+}
+
+// Move all staged messages into the queues. Called with interrupts
+// enabled, returns with them disabled and nothing staged.
+static void merge(void) {
+    char status;
+    Msg m;
+    while (1) {
+        DISABLE(status);
+        if (!staged)
+            return;
+        m = dequeue(&staged);
+        current->merging = m;
+        ENABLE(status);
+        enqueueStaged(m);
+    }
+}
+
+static void post(Msg m, Time bl, Time dl, char status) {
+    m->baseline = (status ? current->msg->baseline : timestamp) + bl;
+    m->deadline = m->baseline + (dl > 0 ? dl : INFINITY);
+
+    stage(m);
+    if (status) {                       // not in an interrupt handler
+        ENABLE(status);
+        merge();
+        schedule();
+    }
+}
+#else
+static void post(Msg m, Time bl, Time dl, char status) {
+    Time now;
     m->baseline = (status ? current->msg->baseline : timestamp) + bl;
     m->deadline = m->baseline + (dl > 0 ? dl : INFINITY);
     
@@ -296,27 +588,76 @@ Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
         TIMERSET(timerQ);
     } else {                            // m is immediately schedulable
         enqueueByDeadline(m, &msgQ);
+#ifdef TT_SINGLE_STACK
+        if (status)
+            schedule();
+#else
         if (status && threadPool && (msgQ->deadline - activeStack->msg->deadline < 0)) {
             push(pop(&threadPool), &activeStack);
             dispatch(activeStack);
         }
+#endif
     }
-    
+}
+#endif
+
+Msg async(Time bl, Time dl, Object *to, Method meth, int arg) {
+    Msg m;
+    char status;
+    DISABLE(status);
+    m = allocMsg(&msgPool);
+    m->to = to; 
+    m->method = meth; 
+    m->arg = arg;
+    post(m, bl, dl, status);
     ENABLE(status);
     return m;
 }
 
-int sync(Object *to, Method meth, int arg) {
+Msg async_block(Time bl, Time dl, Object *to, BlockMethod meth, const void *blk, unsigned char size) {
+    Msg m;
+    unsigned char i;
+    char status;
+    DISABLE(status);
+    m = allocMsg(&blockPool);
+    m->to = to; 
+    m->method = (Method)meth;           // called as a BlockMethod again, see call
+    m->arg = 0;
+    for (i = 0; i < size; i++)          // copy the block into the message itself
+        ((struct block_msg *)m)->payload[i] = ((const unsigned char *)blk)[i];
+    post(m, bl, dl, status);
+    ENABLE(status);
+    return m;
+}
+
+// Lock `to` and run meth on it: with the argument block blk if there is
+// one, meth is then really a BlockMethod, or else with arg.
+static int call(Object *to, Method meth, int arg, const unsigned char *blk) {
     Thread t;
     int result;
     char status, status_ignore;
+#if defined(TT_CONTENTION_STATS) && !defined(TT_SINGLE_STACK)
+    Time start, end;
+#endif
     
     DISABLE(status);
     t = to->ownedBy;
+#ifdef TT_SINGLE_STACK
+    if (t) {                            // locked by a preempted message, which only runs again after us
+#ifdef TT_CONTENTION_STATS
+        to->deadlocks++;
+#endif
+        ENABLE(status);
+        return -1;
+    }
+#else
     if (t) {                            // to is already locked
         while (t->waitsFor) 
             t = t->waitsFor->ownedBy;
         if (t == current || !status) {  // deadlock!
+#ifdef TT_CONTENTION_STATS
+            to->deadlocks++;
+#endif
             ENABLE(status);
             return -1;
         }
@@ -324,38 +665,98 @@ int sync(Object *to, Method meth, int arg) {
             to->wantedBy->waitsFor = NULL;
         to->wantedBy = current;
         current->waitsFor = to;
+#ifdef TT_CONTENTION_STATS
+        TIMERGET(start);
         dispatch(t);
+        TIMERGET(end);
+        to->contended++;
+        to->blocked += end - start;
+#else
+        dispatch(t);
+#endif
         if (current->msg == NULL) {     // message was aborted (when called from run)
             ENABLE(status);
             return 0;
         }
     }
+#endif
     to->ownedBy = current;
     ENABLE(status && (to->wantedBy != INSTALLED_TAG));
-    result = meth(to, arg);
+    result = blk ? ((BlockMethod)meth)(to, blk) : meth(to, arg);
     DISABLE(status_ignore);
     to->ownedBy = NULL; 
+#ifndef TT_SINGLE_STACK
     t = to->wantedBy;
     if (t && (t != INSTALLED_TAG)) {      // we have run on someone's behalf
         to->wantedBy = NULL; 
         t->waitsFor = NULL;
         dispatch(t);
     }
+#endif
     ENABLE(status);
     return result;
 }
 
+int sync(Object *to, Method meth, int arg) {
+    return call(to, meth, arg, NULL);
+}
+
+#ifdef TT_CONTENTION_STATS
+void contention(Object *obj, Contention *c, int reset) {
+    char status;
+    DISABLE(status);
+    c->contended = obj->contended;
+    c->deadlocks = obj->deadlocks;
+    c->blocked = obj->blocked;
+    if (reset) {
+        obj->contended = 0;
+        obj->deadlocks = 0;
+        obj->blocked = 0;
+    }
+    ENABLE(status);
+}
+#endif
+
+#ifdef TT_STAGED_POST
+// Abort m if it has not reached the queues yet. A message that is being
+// merged is freed by the merging thread.
+static int abortStaged(Msg m) {
+    int i;
+    if (remove(m, &staged)) {
+        freeMsg(m);
+        return 1;
+    }
+    if (thread0.merging == m) {
+        thread0.merging = NULL;
+        return 1;
+    }
+    for (i=0; i<NTHREADS; i++)
+        if (threads[i].merging == m) {
+            threads[i].merging = NULL;
+            return 1;
+        }
+    return 0;
+}
+#endif
+
 void ABORT(Msg m) {
     char status;
     DISABLE(status);
+#ifdef TT_STAGED_POST
+    if (abortStaged(m)) {
+        ENABLE(status);
+        return;
+    }
+    queueEpoch++;
+#endif
     if (remove(m, &timerQ) || remove(m, &msgQ))
-        insert(m, &msgPool);
+        freeMsg(m);
     else {
         Thread t = activeStack;
         while (t) {
             if ((t != current) && (t->msg == m) && (t->waitsFor == m->to)) {
 	            t->msg = NULL;
-	            insert(m, &msgPool);
+	            freeMsg(m);
 	            break;
             }
             t = t->next;
@@ -372,6 +773,22 @@ Time T_SAMPLE(Timer *t) {
     return (STATUS() ? current->msg->baseline : timestamp) - t->accum;
 }
 
+#ifdef TT_STATS
+int MSG_HIGH_WATER(void) {
+    return msgsHighWater;
+}
+#endif
+
+#ifdef TT_PROFILE
+Method CURRENT_METHOD(void) {
+    return current->msg ? current->msg->method : NULL;
+}
+#endif
+
+Time CURRENT_BASELINE(void) {
+    return STATUS() ? current->msg->baseline : timestamp;
+}
+
 Time CURRENT_OFFSET(void) {
     char status;
     Time now;
@@ -382,14 +799,73 @@ Time CURRENT_OFFSET(void) {
 }
 
     
+/* crash recovery */
+static char earlierRun(void) {
+    return crashBlock.magic == CRASH_MAGIC && !(resetCause & ((1 << PORF) | (1 << BORF)));
+}
+
+const CrashRecord *LAST_CRASH(void) {
+    if (!earlierRun())
+        return NULL;
+    if (crashBlock.rec.reason == CRASH_NONE && (resetCause & (1 << WDRF))) {
+        crashBlock.rec.reason = CRASH_WATCHDOG;
+        crashBlock.rec.count++;
+        resetCause &= ~(1 << WDRF);
+    }
+    return crashBlock.rec.reason == CRASH_NONE ? NULL : &crashBlock.rec;
+}
+
+unsigned int UPTIME(void) {
+    char status;
+    unsigned int uptime;
+    DISABLE(status);
+    uptime = crashBlock.uptime;
+    ENABLE(status);
+    return uptime;
+}
+
+void crash(unsigned char reason, unsigned int line) {
+    cli();
+    if (current->msg) {
+        crashBlock.rec.to = current->msg->to;
+        crashBlock.rec.method = current->msg->method;
+    }
+    if (crashBlock.magic != CRASH_MAGIC) {  // before the kernel started
+        crashBlock.rec.count = 0;
+        crashBlock.uptime = 0;
+    }
+    crashBlock.magic = CRASH_MAGIC;
+    crashBlock.rec.reason = reason;
+    crashBlock.rec.line = line;
+    crashBlock.rec.count++;
+    wdt_enable(WDTO_15MS);
+    while (1)
+        ;
+}
+
 /* initialization */
 static void initialize(void) {
     int i;
 
-    for (i=0; i<NMSGS-1; i++)
+    LAST_CRASH();               // count a watchdog reset before the record is reused
+    if (!earlierRun()) {
+        crashBlock.rec.count = 0;
+        crashBlock.uptime = 0;
+    }
+    crashBlock.magic = CRASH_MAGIC;
+    crashBlock.rec.reason = CRASH_NONE;
+    crashBlock.rec.line = 0;
+    crashBlock.rec.to = NULL;
+    crashBlock.rec.method = NULL;
+
+    for (i=0; i<NMSGS-MSG_BLOCKS-1; i++)
         messages[i].next = &messages[i+1];
-    messages[NMSGS-1].next = NULL;
+    messages[NMSGS-MSG_BLOCKS-1].next = NULL;
+    for (i=0; i<MSG_BLOCKS-1; i++)
+        blockMessages[i].msg.next = &blockMessages[i+1].msg;
+    blockMessages[MSG_BLOCKS-1].msg.next = NULL;
     
+#ifndef TT_SINGLE_STACK
     for (i=0; i<NTHREADS-1; i++)
         threads[i].next = &threads[i+1];
     threads[NTHREADS-1].next = NULL;
@@ -399,25 +875,59 @@ static void initialize(void) {
         SETSTACK( &threads[i].context, &stacks[i] );
         SETPC( &threads[i].context, run );
         threads[i].waitsFor = NULL;
+#ifdef TT_STAGED_POST
+        threads[i].merging = NULL;
+#endif
     }
+#endif
 
     thread0.next = NULL;
     thread0.waitsFor = NULL;
     thread0.msg = NULL;
+#ifdef TT_STAGED_POST
+    thread0.merging = NULL;
+    staged = NULL;
+#endif
     
     TIMER_INIT();
+    wdt_enable(WATCHDOG);
 }
 
-void install(Object *obj, Method m, enum Vector i) {
+#ifdef TT_STATIC_IRQ
+// The vector is bound at compile time, only the object is marked here.
+static void bind(Object *obj, __attribute__((unused)) Method m, enum Vector i,
+                 __attribute__((unused)) char fast) {
+    if (i >= 0 && i < N_VECTORS) {
+        char status;
+        DISABLE(status);
+        obj->wantedBy = INSTALLED_TAG;  // Mark object as subject to synchronization by interrupt disabling
+        ENABLE(status);
+    }
+}
+#else
+static void bind(Object *obj, Method m, enum Vector i, char fast) {
     if (i >= 0 && i < N_VECTORS) {
         char status;
         DISABLE(status);
         otable[i] = obj;
         mtable[i] = m;
+        if (fast)
+            fastVectors |= 1UL << i;
+        else
+            fastVectors &= ~(1UL << i);
         obj->wantedBy = INSTALLED_TAG;  // Mark object as subject to synchronization by interrupt disabling
         ENABLE(status);
     }
 }
+#endif
+
+void install(Object *obj, Method m, enum Vector i) {
+    bind(obj, m, i, 0);
+}
+
+void install_fast(Object *obj, Method m, enum Vector i) {
+    bind(obj, m, i, 1);
+}
 
 int tinytimber(Object *obj, Method m, int arg) {
     char status;
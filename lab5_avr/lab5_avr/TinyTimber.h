@@ -43,15 +43,48 @@
 //      Abstract type, used in the definition of Object.
 struct thread_block;
 
+//      Type of time values (with platform-dependent resolution).
+//      Defining TT_TIME24 selects a 24-bit representation (avr-gcc __int24),
+//      so that Time arithmetic works on three bytes instead of four. What
+//      that saves in async() has not been measured; bench/run.sh with
+//      BENCH_CFLAGS=-DTT_TIME24 reports it. A 24-bit Time wraps after about
+//      9 minutes, so times are only ever compared by their difference, and
+//      differences must stay below 2^23 ticks (about 268 seconds). TT_TIME64 is for the host simulation, where
+//      runs of several days would overflow 32 bits (about 19 hours); its
+//      infinity leaves room for baseline + TIME_INFINITY.
+#ifdef TT_TIME24
+typedef __int24 Time;
+#define TIME_INFINITY   ((Time)0x7fffff)
+#elif defined(TT_TIME64)
+typedef long long Time;
+#define TIME_INFINITY   ((Time)0x3fffffffffffffffLL)
+#else
+typedef signed long Time;
+#define TIME_INFINITY   ((Time)0x7fffffffL)
+#endif
+
 //      Base class of reactive objects. Every reactive object in a TinyTimber 
 //      system must be of a class that inherits this class.
+//      With TT_CONTENTION_STATS defined, every object also counts how often
+//      a message or SYNC call found it locked by another thread, and how
+//      long those callers were blocked in total (see CONTENTION).
 typedef struct {
     struct thread_block *ownedBy, *wantedBy;
+#ifdef TT_CONTENTION_STATS
+    unsigned int contended;
+    unsigned int deadlocks;
+    Time blocked;
+#endif
 } Object;
 
 //      Initialization macro for class Object. 
+#ifdef TT_CONTENTION_STATS
+#define initObject() \
+        { NULL, NULL, 0, 0, 0 }
+#else
 #define initObject() \
         { NULL, NULL }
+#endif
 
 //  int SYNC( T* obj, int (*meth)(T*, A), A arg );
 //      Synchronously invoke method meth on object obj with argument arg. Type T 
@@ -71,8 +104,14 @@ typedef struct msg_block *Msg;
 //      a first argument that is a reference to a subclass of class Object.
 typedef int (*Method)(Object*, int);
 
+//      Type of methods that take an argument block (see ASYNC_BLOCK). The
+//      block is passed as a pointer, never through an int.
+typedef int (*BlockMethod)(Object*, const void*);
+
 //      Unit pointer value.
+#ifndef NULL
 #define NULL 0
+#endif
 
 //  Msg ASYNC(T *obj, int (*meth)(T*, A), A arg);
 //      Asynchronously invoke method meth on object obj with argument arg. 
@@ -80,9 +119,6 @@ typedef int (*Method)(Object*, int);
 #define ASYNC(obj, meth, arg) \
         async((Time)0, (Time)0, (Object*)obj, (Method)meth, (int)arg)
 
-//      Type of time values (with platform-dependent resolution).
-typedef signed long Time;
-
 //  Msg AFTER(Time bl, T *obj, int (*meth)(T*, A), A arg);
 //      Asynchronously invoke method meth on object obj with argument arg and
 //      baseline offset bl. 
@@ -109,26 +145,74 @@ typedef signed long Time;
 //      where rel = current deadline - current baseline.
 //      During interrupts, current baseline = time of interrupt and current
 //      deadline = infinity.
+//      With TT_STAGED_POST defined, a message is only pushed onto a staging
+//      list when it is sent, and a thread later sorts it into the kernel
+//      queues with interrupts mostly enabled. Interrupt handlers then never
+//      walk the queues, and the longest time interrupts stay off no longer
+//      grows with the number of pending messages. Compare builds with
+//      BENCH_CFLAGS=-DTT_STAGED_POST bench/run.sh (irq_off_max_cycles).
 #define SEND(bl, dl, obj, meth, arg) \
         async(bl, dl, (Object*)obj, (Method)meth, (int)arg)
+//      Number of Time ticks per second (8 MHz system clock, clk/256 prescaling).
+#define TICKS_PER_SEC   31250
+//      Maximum size in bytes of an argument block carried inside a message.
+#ifndef MSG_PAYLOAD
+#define MSG_PAYLOAD     6
+#endif
+//      Number of messages, out of the pool, that can carry an argument
+//      block. Only these have room for MSG_PAYLOAD bytes.
+#ifndef MSG_BLOCKS
+#define MSG_BLOCKS      3
+#endif
+
+//  Msg ASYNC_BLOCK(T *obj, int (*meth)(T*, const B*), const B *blk);
+//      Asynchronously invoke method meth on object obj with a copy of the 
+//      argument block *blk, for payloads that do not fit in an int. Type B
+//      may be any struct of at most MSG_PAYLOAD bytes. The copy is stored
+//      in one of the MSG_BLOCKS block messages (no heap is involved), and
+//      meth receives a pointer to it that stays valid until meth returns.
+#define ASYNC_BLOCK(obj, meth, blk) \
+        SEND_BLOCK((Time)0, (Time)0, obj, meth, blk)
+
+//  Msg AFTER_BLOCK(Time bl, T *obj, int (*meth)(T*, const B*), const B *blk);
+//      As ASYNC_BLOCK, with baseline offset bl.
+#define AFTER_BLOCK(bl, obj, meth, blk) \
+        SEND_BLOCK(bl, (Time)0, obj, meth, blk)
+
+//  Msg SEND_BLOCK(Time bl, Time dl, T *obj, int (*meth)(T*, const B*), const B *blk);
+//      As SEND, with an argument block instead of an int argument. Blocks 
+//      larger than MSG_PAYLOAD are rejected at compile time.
+#define SEND_BLOCK(bl, dl, obj, meth, blk) \
+        async_block(bl, dl, (Object*)obj, (BlockMethod)meth, blk, \
+                    sizeof(char[sizeof(*(blk)) <= MSG_PAYLOAD ? 1 : -1]) * sizeof(*(blk)))
+
 //      Construct a Time value from an argument given in microseconds.
+//      One tick is exactly 32 us, so this is a shift rather than a division.
 #define USEC(x) \
-        ((Time)(((x) * (Time)125) / 4) / (Time)1000)
+        ((Time)(x) >> 5)
 //      Construct a Time value from an argument given in milliseconds.
+//      x * 125 / 4 written as shifts and subtractions, so that non-constant
+//      arguments do not pull in the 32-bit multiply/divide helpers. A function
+//      so that x is evaluated once; negative values are rounded toward zero,
+//      as by the division.
+static inline Time tt_msec(Time x) {
+        Time t = (x << 7) - (x << 1) - x;
+        return (t < 0 ? t + 3 : t) >> 2;
+}
 #define MSEC(x) \
-        ((Time)(((x) * (Time)125) / 4))
+        tt_msec((Time)(x))
 //      Construct a Time value from an argument given in seconds.
 #define SEC(x) \
-        (((x) * (Time)31250)) 
+        (((x) * (Time)TICKS_PER_SEC)) 
 //      Extract the microsecond fraction of a Time value
 #define USEC_OF(t) \
-        (int)(((t) % ((Time)31250)) * 32)
+        (int)(((t) % ((Time)TICKS_PER_SEC)) * 32)
 //      Extract the millisecond fraction of a Time value
 #define MSEC_OF(t) \
-        (int)(((t) % ((Time)31250)) * 4 / 125)
+        (int)(((t) % ((Time)TICKS_PER_SEC)) * 4 / 125)
 //      Extract the while second basis of a Time value
 #define SEC_OF(t) \
-        (int)((t) / ((Time)31250))
+        (int)((t) / ((Time)TICKS_PER_SEC))
 
 enum Vector { 
         IRQ_INT0, 
@@ -165,12 +249,42 @@ void ABORT(Msg m);
 //      invoked on obj with i as its argument.
 #define INSTALL(obj,meth,i) install((Object*)obj, (Method)meth, i)
 
+// void INSTALL_FAST (T* obj, int (*meth)(T*, enum Vector), enum Vector i )
+//      As INSTALL, but meth runs as a bare interrupt handler: the timer is
+//      not sampled before it and the scheduler is not run after it. Only
+//      valid for handlers that post no messages and make no SYNC calls,
+//      e.g. a handler that just moves one byte to or from a data register.
+#define INSTALL_FAST(obj,meth,i) install_fast((Object*)obj, (Method)meth, i)
+
+//      With TT_STATIC_IRQ defined, the handlers are instead bound at compile
+//      time by the application's irq_bindings.h, which defines the macro
+//      TT_IRQ_BINDINGS(BIND, BIND_FAST) as a list of BIND(i, obj, meth)
+//      (as INSTALL) and BIND_FAST(i, obj, meth) (as INSTALL_FAST), one per
+//      vector. Each bound vector then calls its method directly, without
+//      the method and object tables, and vectors that are not bound get no
+//      handler at all; taking one of those is a PANIC. INSTALL must still
+//      be called for every binding, as it marks the object for
+//      synchronization by interrupt disabling, but the method and vector
+//      given to it are ignored; running INSTALL and INSTALL_FAST over
+//      TT_IRQ_BINDINGS keeps both modes on the one list. Compare builds
+//      with BENCH_CFLAGS=-DTT_STATIC_IRQ bench/run.sh.
+
 //  int TINYTIMBER ( T* obj, int (*meth)(T*, A), A arg )
 //      Start up the TinyTimber system by invoking method meth on obj with
 //      argument arg; then handle all subsequent interrupts and timed
 //      events as they occur. Type T must be a struct type that inherits
 //      from Object, while A can be any int-sized type. This function never
 //      returns.
+//      With TT_SINGLE_STACK defined, the kernel has no threads of its own:
+//      every message runs to completion on the one stack, and a message
+//      that preempts another (by an earlier deadline, from an interrupt
+//      handler or a post) runs nested inside it. This saves the thread
+//      stacks and the setjmp/longjmp context switches. A message is only
+//      started while its receiver is not locked by a preempted message,
+//      and a SYNC call to an object that a preempted message holds returns
+//      -1 instead of waiting, so it suits applications whose methods never
+//      block, like this one. Compare builds with
+//      BENCH_CFLAGS=-DTT_SINGLE_STACK bench/run.sh.
 #define TINYTIMBER(obj,meth,arg) tinytimber((Object*)obj, (Method)meth, (int)arg)
 
 
@@ -191,14 +305,92 @@ Time T_SAMPLE(Timer *t);
 //      Return current time measured from current baseline
 Time CURRENT_OFFSET(void);
 
+//      Return the largest number of messages that have been allocated from
+//      the message pool at the same time. Only available with TT_STATS.
+int MSG_HIGH_WATER(void);
+
+//      Return the method of the message being run, or NULL if the system is
+//      idle. From an INSTALL_FAST handler this is the method that was
+//      interrupted (or the one that just finished, while the kernel picks
+//      the next). For a sampling profiler; only available with TT_PROFILE.
+Method CURRENT_METHOD(void);
+
+//      Snapshot of the contention counters of one object.
+typedef struct {
+    unsigned int contended;  // calls that had to wait for another thread
+    unsigned int deadlocks;  // calls that returned -1 instead of waiting
+    Time blocked;            // total time spent waiting, in Time ticks
+} Contention;
+
+//  void CONTENTION(T *obj, Contention *c, int reset);
+//      Copy the contention counters of obj into *c, and clear them if reset
+//      is nonzero. Only available when built with TT_CONTENTION_STATS.
+#define CONTENTION(obj, c, reset) contention((Object*)obj, c, reset)
+
+//      Return the current baseline (the time of the interrupt when called 
+//      from an interrupt handler)
+Time CURRENT_BASELINE(void);
+
+//      Reasons for the last reset, kept in the crash record.
+#define CRASH_NONE      0
+#define CRASH_PANIC     1       // the kernel ran out of message blocks
+#define CRASH_ASSERT    2       // an assertion in the application failed
+#define CRASH_WATCHDOG  3       // no message finished for about two seconds
+
+//      What was running when the system went down. The record lives in RAM
+//      that is not cleared at startup (.noinit), so it survives the reset.
+typedef struct {
+    unsigned char reason;   // CRASH_...
+    unsigned char count;    // crashes since power-on
+    unsigned int line;      // line passed to CRASH, see CRASH_AT
+    Object *to;             // receiver of the message being run, or NULL
+    Method method;          // its method (a word address on the AVR)
+} CrashRecord;
+
+//  void CRASH(unsigned char reason, unsigned int line)
+//      Record reason, line and the message being run, and reset through 
+//      the watchdog within 15 ms. Never returns. The kernel also keeps the
+//      watchdog running while the system is up: it is fed whenever a 
+//      message finishes and while the system is idle, so a method that 
+//      never returns resets with CRASH_WATCHDOG.
+#define CRASH(reason, line) crash(reason, line)
+
+//  unsigned int CRASH_AT(unsigned char file, unsigned int line)
+//      The line argument of CRASH for line `line` of source file `file`, so
+//      that crashes in different files can be told apart. The file number
+//      takes the top four bits; the kernel is file 0, and the application
+//      numbers its own files from 1. CRASH_FILE and CRASH_LINE take the
+//      record's line apart again.
+#define CRASH_AT(file, line)    (((unsigned int)(file) << 12) | (line))
+#define CRASH_FILE(at)          ((at) >> 12)
+#define CRASH_LINE(at)          ((at) & 0xfff)
+
+//      Return the crash record from before the last reset, or NULL if the
+//      system came up normally. Only meaningful before TINYTIMBER is
+//      called, as the kernel reuses the record once it runs.
+const CrashRecord *LAST_CRASH(void);
+
+//      Return the number of timer periods of 65536 ticks (about 2.1 s) 
+//      since power-on. Kept next to the crash record, so it carries on over
+//      watchdog and crash resets: before TINYTIMBER is called after such a
+//      reset it tells when the system went down. Counts from 0 again after
+//      a power-on, and wraps after about 38 hours.
+unsigned int UPTIME(void);
+
 
 // -------------------------------------------------------------------
 // No externally significant information below this line
 // -------------------------------------------------------------------
 
 Msg async(Time bl, Time dl, Object *to, Method m, int arg);   
+Msg async_block(Time bl, Time dl, Object *to, BlockMethod m, const void *blk, unsigned char size);
 int sync(Object *to, Method m, int arg);
+#ifdef TT_CONTENTION_STATS
+void contention(Object *obj, Contention *c, int reset);
+#endif
 void install(Object *obj, Method m, enum Vector index);
+void install_fast(Object *obj, Method m, enum Vector index);
 int tinytimber(Object *obj, Method startup, int arg);
+void crash(unsigned char reason, unsigned int line) __attribute__((noreturn));
 
 #endif
\ No newline at end of file
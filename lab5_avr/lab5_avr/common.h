@@ -17,18 +17,41 @@
 #define DELAY_CROSSING 1000 // Delay for another car to enter bridge in ms.
 #define DELAY_LIGHT_SWITCH 500
 #define DELAY_SWITCH_TO_RED 500
+#define DELAY_FIRST_CHECK 500 // Delay before the first decision when traffic starts in ms.
+#define DELAY_IDLE_POLL 10 // Poll interval while only the bridge is occupied in ms.
+
+// The delays above as TinyTimber ticks (31250 ticks/s, i.e. ms * 125 / 4).
+// Written out as integer constant expressions so they are folded by the
+// compiler and never reach async() as a runtime multiply or divide.
+#define TICKS_CROSS_BRIDGE   ((TIME_CROSS_BRIDGE * 125L) / 4)
+#define TICKS_CROSSING       ((DELAY_CROSSING * 125L) / 4)
+#define TICKS_LIGHT_SWITCH   ((DELAY_LIGHT_SWITCH * 125L) / 4)
+#define TICKS_SWITCH_TO_RED  ((DELAY_SWITCH_TO_RED * 125L) / 4)
+#define TICKS_FIRST_CHECK    ((DELAY_FIRST_CHECK * 125L) / 4)
+#define TICKS_IDLE_POLL      ((DELAY_IDLE_POLL * 125L) / 4)
+// Time from a car entering the bridge until the other side may get green.
+#define TICKS_SWITCH_WINDOW  (TICKS_CROSS_BRIDGE + TICKS_LIGHT_SWITCH)
 
 // Simulator -> AVR
 #define NB_CAR_ARRIVAL  0   // Northbound car arrival sensor bit.
 #define NB_BRIDGE_ENTRY 1   // Northbound bridge entry sensor bit.
 #define SB_CAR_ARRIVAL  2   // Southbound car arrival sensor bit.
 #define SB_BRIDGE_ENTRY 3   // Southbound bridge entry sensor bit.
+#define SENSOR_MASK ((1 << NB_CAR_ARRIVAL) | (1 << NB_BRIDGE_ENTRY) | (1 << SB_CAR_ARRIVAL) | (1 << SB_BRIDGE_ENTRY))
+#define CONFIG_FRAME    7   // Set in every byte of a configuration command (see objects/config.h).
+#define CONFIG_START    6   // Set in the first byte of a configuration command.
 
 // AVR -> Simualtor
 #define NB_GREEN 0  // Northbound green light status bit.
 #define NB_RED 1    // Northbound red light status bit.
 #define SB_GREEN 2  // Southbound green light status bit.
 #define SB_RED 3    // Southbound red light status bit.
+#define REPORT_FRAME 7  // Set in the bytes of a crash or profile report (see initiation.c).
+
+// Source files that can crash, for the crash record (see CRASH_AT in TinyTimber.h).
+#define FILE_KERNEL         0   // TinyTimber.c
+#define FILE_TRAFFICHANDLER 1
+#define FILE_COMMUNICATOR   2
 
 
 
@@ -1,4 +1,17 @@
 #include "initiation.h"
+#include <stdint.h>
+#include <avr/io.h>
+#include "common.h"
+#include "objects/capture.h"
+#include "objects/storage.h"
+#include "objects/display.h"
+#include "objects/calibration.h"
+#include "objects/profiler.h"
+
+// Serial port object.
+struct Communicator com = initCommunicator(&ctrl);
+// Logic handling object for the traffic lights.
+struct Traffichandler ctrl = initTraffichandler(&com);
 
 
 // Setup asynchronous normal mode (U2X = 0)
@@ -33,19 +46,66 @@ void init_usart() {
 	UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
 }
 
+// Blocking write, for use before the kernel runs.
+static void usart_put(uint8_t data) {
+	while (!(UCSR0A & (1 << UDRE0))) {
+	}
+	UDR0 = data;
+}
+
+// Send the record of the crash that caused this restart. The record goes out
+// three bits at a time in bits 4-6 of each byte, least significant first,
+// starting with the reason, then the count, line, object and method (word
+// address), 16-bit values low byte first. Every byte has REPORT_FRAME set
+// and both red light bits, so the simulator keeps the lights red while it
+// reads the report.
+#define REPORT_BYTES 8
+static void report_crash(const CrashRecord* rec) {
+	uint8_t raw[REPORT_BYTES] = {
+		rec->reason, rec->count, rec->line, rec->line >> 8,
+		(uintptr_t)rec->to, (uintptr_t)rec->to >> 8, (uintptr_t)rec->method, (uintptr_t)rec->method >> 8,
+	};
+	uint16_t bits = 0;
+	uint8_t have = 0, i = 0;
+	while (i < REPORT_BYTES || have > 0) {
+		if (have < 3 && i < REPORT_BYTES) {
+			bits |= (uint16_t)raw[i++] << have;
+			have += 8;
+		}
+		usart_put((1 << REPORT_FRAME) | ((bits & 0x7) << 4) | (1 << NB_RED) | (1 << SB_RED));
+		bits >>= 3;
+		have = have > 3 ? have - 3 : 0;
+	}
+}
+
 void initiate() {
-	
+	const CrashRecord* last = LAST_CRASH();
+
 	init_usart();
+	// Lights red straight away, whatever state they were left in by a reset.
+	usart_put((1 << NB_RED) | (1 << SB_RED));
+	if (last) {
+		report_crash(last);
+	}
 	init_lcd();
+	capture_init();
 	clear();
+	display_init();
+	calibration_init();
+	profiler_init(&com);
+
+	// Settings saved by configuration commands, or the defaults.
+	storage_load_config(&ctrl.settings);
+	traffic_params_set(&ctrl.settings);
+
+	// Pick up the queues from before a crash, if they were journaled lately.
+	struct JournalState state;
+	if (storage_load_journal(&state, last)) {
+		traffichandler_restore(&ctrl, &state);
+	}
 	
-	// Serial port object.
-	com = initCommunicator(NULL);
-	// Logic handling object for the traffic lights.
-	ctrl = initTraffichandler(&com);
-	// setting reference and ...
-	com.ctrl = &ctrl;
-	// Why make this call? Can have something to do with the reading. // Check out USART.
-	com_receive_ready(NULL, 0);
+	// Discard whatever byte may be left in the receive buffer. The kernel is
+	// not running yet, so this must not go through com_receive_ready.
+	(void)UDR0;
 }
 
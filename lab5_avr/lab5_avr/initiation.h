@@ -2,13 +2,13 @@
 #define INITIATION_H_
 
 #include "TinyTimber.h"
-#include "objects/Traffichandler.h"
-#include "objects/Communicator.h"
+#include "objects/traffichandler.h"
+#include "objects/communicator.h"
 #include "lcd.h"
 
 // Global objects 
-struct Communicator com;
-struct Traffichandler ctrl;
+extern struct Communicator com;
+extern struct Traffichandler ctrl;
 
 // Objects initiation/creation & Serial COM/USART initiation & lcd initiation.
 void init_usart();
@@ -0,0 +1,42 @@
+#ifndef IRQ_BINDINGS_H_
+#define IRQ_BINDINGS_H_
+
+/* Interrupt handlers
+The one list of them. main.c installs them with INSTALL and INSTALL_FAST,
+and a TT_STATIC_IRQ build binds them to their vectors at compile time (see
+INSTALL in TinyTimber.h).
+
+   IRQ_USART0_RX     sensor bytes and configuration commands
+   IRQ_USART0_UDRE   only moves the buffered byte into UDR0, so it can skip
+                     the scheduler
+   IRQ_EE_READY      saves settings and the journal, one byte per interrupt
+   IRQ_LCD           draws one character of the display per frame
+   IRQ_PCINT1        the joystick, turns the display to its next page
+   IRQ_TIMER2_OVF    measures the system clock against the crystal once a
+                     second
+   IRQ_TIMER0_COMP   TT_PROFILE builds: samples the running method, so it
+                     must not run the scheduler
+*/
+
+#include "initiation.h"
+#include "objects/storage.h"
+#include "objects/display.h"
+#include "objects/calibration.h"
+#include "objects/profiler.h"
+
+#ifdef TT_PROFILE
+#define PROFILER_BINDING(BIND_FAST) BIND_FAST(IRQ_TIMER0_COMP, &profiler, profiler_sample)
+#else
+#define PROFILER_BINDING(BIND_FAST)
+#endif
+
+#define TT_IRQ_BINDINGS(BIND, BIND_FAST) \
+	BIND(IRQ_USART0_RX, &com, com_receive_ready) \
+	BIND_FAST(IRQ_USART0_UDRE, &com, com_data_register_ready) \
+	BIND(IRQ_EE_READY, &storage, storage_ee_ready) \
+	BIND_FAST(IRQ_LCD, &display, display_frame) \
+	BIND_FAST(IRQ_PCINT1, &display, display_button) \
+	BIND(IRQ_TIMER2_OVF, &calibration, calibration_tick) \
+	PROFILER_BINDING(BIND_FAST)
+
+#endif /* IRQ_BINDINGS_H_ */
@@ -1,5 +1,6 @@
 #include "lcd.h"
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 
 #define MAX_CHARS 6
 
@@ -65,11 +66,11 @@ Z:	Segments: A, D, K, P
 9:	Segments: A, B, C, D, F, G, L
 */
 
-#define SCC_NUM(x) (NUMBERS[(x) - '0'])
-#define SCC_CHAR(x) (CHARACTERS[(x) - 'a'])
+#define SCC_NUM(x) pgm_read_word(&NUMBERS[(x) - '0'])
+#define SCC_CHAR(x) pgm_read_word(&CHARACTERS[(x) - 'a'])
 
-// Segment Control Characters: a-z.
-static uint16_t CHARACTERS[] = {
+// Segment Control Characters: a-z. Both tables are kept in flash only.
+static const uint16_t CHARACTERS[] PROGMEM = {
 	0xf51,
 	0x3991,
 	0x1441,
@@ -99,7 +100,7 @@ static uint16_t CHARACTERS[] = {
 };
 
 // Segment Control Characters: 0-9.
-static uint16_t NUMBERS[] = {
+static const uint16_t NUMBERS[] PROGMEM = {
 	0x5559,
 	0x118,
 	0x1e11,
@@ -185,13 +186,13 @@ int writeChar(char ch, int pos) {
 	
 	// Point the first relevant LCD Data Register.
 	// Position 0/1 maps to LCDDR0 (0xEC), 2/3 maps to LCDDR2 (0xED) and 4/5 to LCDDR3 (0xEE).
-	uint8_t* addr = (uint8_t*)(0xEC + pos / 2);
+	volatile uint8_t* addr = &LCDDR0 + pos / 2;
 	for (int i = 0; i < 4; ++i) {
 		uint8_t nibble = scc & 0xf;
 		if (!even_lcd_digit) {
 			nibble <<= 4;
 		}
-		uint8_t* lcddrx = (addr + i * 5);
+		volatile uint8_t* lcddrx = (addr + i * 5);
 		if (i == 0) {
 			// Don't overwrite special bits in LCDDR0/1/2.
 			uint8_t first_mask = decode_mask & ~SPECIAL_MASK;
@@ -205,11 +206,40 @@ int writeChar(char ch, int pos) {
 	return 0;
 }
 
+// The decimal digits of `v`, least significant first, and how many there
+// are (none for 0). The AVR has no divide instruction and a 32-bit % or /
+// is a libgcc call of several hundred cycles, so each digit is counted by
+// subtracting its power of ten instead, at most nine times.
+static int decimal(uint32_t v, char digits[10]) {
+	uint32_t powers[10];
+	uint32_t p = 1;
+	int n = 0;
+
+	while (n < 10 && p <= v) {
+		powers[n++] = p;
+		p = (p << 3) + (p << 1);
+	}
+	for (int j = n - 1; j >= 0; --j) {
+		char digit = 0;
+		while (v >= powers[j]) {
+			v -= powers[j];
+			digit++;
+		}
+		digits[j] = digit;
+	}
+	return n;
+}
+
 int writeLong(long i) {
-	for (int j = 0; j < MAX_CHARS && i != 0; ++j) {
-		char digit = i % 10;
-		i /= 10;
-		if (writeChar(digit + '0', MAX_CHARS - 1 - j) == -1) {
+	char digits[10];
+	int n;
+
+	if (i < 0) {
+		return -1;
+	}
+	n = decimal(i, digits);
+	for (int j = 0; j < MAX_CHARS && j < n; ++j) {
+		if (writeChar(digits[j] + '0', MAX_CHARS - 1 - j) == -1) {
 			return -1;
 		}
 	}
@@ -217,6 +247,13 @@ int writeLong(long i) {
 }
 
 int printAt(long num, int pos) {
-	if (writeChar((num % 100) / 10 + '0', pos) == -1) return -1;
-	return writeChar(num % 10 + '0', pos+1);
+	char digits[10];
+	int n;
+
+	if (num < 0) {
+		return -1;
+	}
+	n = decimal(num, digits);
+	if (writeChar((n > 1 ? digits[1] : 0) + '0', pos) == -1) return -1;
+	return writeChar((n > 0 ? digits[0] : 0) + '0', pos+1);
 }
\ No newline at end of file
@@ -36,8 +36,10 @@ void clear();
 int writeChar(char ch, int pos);
 
 // Writes a long the to the screen, the lowest six digits are shown.
+// Negative numbers are not shown and return -1.
 int writeLong(long i);
 
+// Writes the lowest two digits of a non-negative number at pos and pos+1.
 int printAt(long num, int pos);
 
 #endif
\ No newline at end of file
@@ -1,13 +1,18 @@
 #include <avr/io.h>
-#include "inititation.h"
+#include "initiation.h"
+#include "irq_bindings.h"
+
+#define INSTALL_BINDING(i, obj, meth)      INSTALL(obj, meth, i);
+#define INSTALL_BINDING_FAST(i, obj, meth) INSTALL_FAST(obj, meth, i);
 
 int main() {
 
 	// initiates necessary objects, display & USART serial port.
 	initiate();
 
-	INSTALL(&com, com_receive_ready, IRQ_USART0_RX);
-	INSTALL(&com, com_data_register_ready, IRQ_USART0_UDRE);
+	// The handlers of irq_bindings.h. A TT_STATIC_IRQ build has them bound
+	// already, and INSTALL only marks their objects.
+	TT_IRQ_BINDINGS(INSTALL_BINDING, INSTALL_BINDING_FAST)
 
 	return TINYTIMBER(&ctrl, traffichandler_init, 0);
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "calibration.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// CALIBRATION_NOMINAL = 2^5 * 15625, so error * 2^16 / nominal needs
+// no more than 32 bits for any error that is not dropped.
+#define NOMINAL_ODD   (CALIBRATION_NOMINAL >> 5)
+
+#ifdef __AVR__
+struct Calibration calibration =
+#else
+_Thread_local struct Calibration calibration =
+#endif
+	{ initObject(), 0, 0, 0, 0, 0, 0 };
+
+void calibration_init(void) {
+	// Asynchronous mode from the 32.768 kHz crystal, clk/128: 256 counts a
+	// second, so the 8-bit counter overflows once a second.
+	TIMSK2 = 0;
+	ASSR = 1 << AS2;
+	TCNT2 = 0;
+	TCCR2A = (1 << CS22) | (1 << CS20);
+	// Writes only reach the asynchronous timer a few crystal cycles later.
+	while (ASSR & ((1 << TCN2UB) | (1 << TCR2UB))) {
+	}
+	TIFR2 = 1 << TOV2;
+	TIMSK2 = 1 << TOIE2;
+}
+
+int calibration_tick(struct Calibration* self, __attribute__((unused)) int arg) {
+	Time now = CURRENT_BASELINE();
+	int32_t error;
+
+	if (!self->started) {
+		self->started = 1;
+		self->window_start = now;
+		return 0;
+	}
+	if (++self->seconds < CALIBRATION_WINDOW) {
+		return 0;
+	}
+	self->seconds = 0;
+	error = (int32_t)(now - self->window_start - CALIBRATION_NOMINAL);
+	self->window_start = now;
+	if (error > CALIBRATION_MAX_ERROR || error < -CALIBRATION_MAX_ERROR) {
+		// A lost interrupt or a timer that was stopped.
+		return 0;
+	}
+	if (self->measured) {
+		self->error += (error - self->error) >> 2;
+	} else {
+		self->error = error;
+		self->measured = 1;
+	}
+	self->scale = (self->error << 11) / NOMINAL_ODD;
+	return 0;
+}
+
+int16_t calibration_scale(void) {
+	uint8_t sreg = SREG;
+	int16_t scale;
+	cli();
+	scale = calibration.scale;
+	SREG = sreg;
+	return scale;
+}
+
+Time calibrated(Time t, int16_t scale) {
+	// t >> 6 keeps the product in 32 bits up to t = 2^24, and costs at most
+	// 6 ticks (0.2 ms) of the correction.
+	return t + (Time)(((int32_t)(t >> 6) * scale) >> 10);
+}
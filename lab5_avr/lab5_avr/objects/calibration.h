@@ -0,0 +1,67 @@
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+/* Clock calibration
+TinyTimber counts TIMER1 at clk/256 of the internal RC oscillator, and every
+Time constant assumes exactly TICKS_PER_SEC of those ticks a second. The RC
+oscillator is only trimmed to a few percent and drifts with temperature and
+supply voltage, which stretches or shrinks the 5 s crossing time and the
+switch window by the same fraction. The 32.768 kHz watch crystal of the
+Butterfly keeps much better time.
+
+TIMER2 runs from the crystal in asynchronous mode and overflows once a
+second. Its interrupt notes the TIMER1 time, and every CALIBRATION_WINDOW
+seconds the ticks counted over the window are compared with the nominal
+count. The deviation is averaged over a few windows, so the correction
+follows slow drift but not the jitter of a single measurement, and
+measurements that are off by more than CALIBRATION_MAX_ERROR are dropped.
+
+calibrated() turns a nominal number of ticks (from MSEC, SEC or TICKS_*)
+into the number that lasts as long in crystal time. The controller uses it
+for its delays (traffic_params) and picks up a new correction at the next
+light phase boundary, so DELAY_LIGHT_SWITCH no longer has to cover the
+tolerance of the oscillator. On the host the clock is exact and the
+correction stays 0.
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+
+#define CALIBRATION_WINDOW     16   // s
+#define CALIBRATION_NOMINAL    ((Time)CALIBRATION_WINDOW * TICKS_PER_SEC)
+#define CALIBRATION_MAX_ERROR  (CALIBRATION_NOMINAL / 10)
+
+struct Calibration {
+	Object super;
+
+	uint8_t seconds;        // crystal seconds into the window
+	uint8_t started;        // window_start is set
+	uint8_t measured;       // a window has been measured
+	Time window_start;      // TIMER1 time of the overflow that began it
+	int32_t error;          // ticks per window more than nominal, averaged
+
+	// Correction of calibrated(), in units of 2^-16: error / nominal.
+	int16_t scale;
+};
+
+// One per simulation thread on the host.
+#ifdef __AVR__
+extern struct Calibration calibration;
+#else
+extern _Thread_local struct Calibration calibration;
+#endif
+
+// Start TIMER2 on the crystal. Call before the kernel starts.
+void calibration_init(void);
+
+// IRQ_TIMER2_OVF handler, once a second of crystal time. Uses the baseline
+// of the interrupt, so it must be installed with INSTALL.
+int calibration_tick(struct Calibration* self, int arg);
+
+// The current correction, see `scale`.
+int16_t calibration_scale(void);
+
+// `t` nominal ticks corrected with `scale`. For t up to about 9 minutes.
+Time calibrated(Time t, int16_t scale);
+
+#endif /* CALIBRATION_H_ */
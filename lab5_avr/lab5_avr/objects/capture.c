@@ -0,0 +1,99 @@
+#include "capture.h"
+
+#ifdef COM_CAPTURE
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define RING_MASK (CAPTURE_SIZE - 1)
+
+// Longest record: five varint bytes for 34 bits and the data byte.
+#define MAX_RECORD 6
+
+struct Capture capture = { initObject(), {0}, 0, 0, 0, 0, 0 };
+
+void capture_init(void) {
+	// Three-wire mode, clocked by software strobes of USITC.
+	DDRE = DDRE | (1 << PE5) | (1 << PE4);
+	USICR = (1 << USIWM0);
+}
+
+static uint8_t ring_free(void) {
+	return (uint8_t)(capture.tail - capture.head - 1) & RING_MASK;
+}
+
+static void put(uint8_t b) {
+	capture.ring[capture.head] = b;
+	capture.head = (capture.head + 1) & RING_MASK;
+}
+
+static void put_record(uint8_t kind, uint8_t data, Time t) {
+	int32_t delta = t - capture.last;
+	uint32_t z = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+	// The kind and the low five bits of z make up the first varint byte,
+	// so the 34-bit value never has to be formed.
+	uint8_t b = kind | (((uint8_t)z << 2) & 0x7c);
+
+	capture.last = t;
+	z >>= 5;
+	while (z) {
+		put(b | 0x80);
+		b = z & 0x7f;
+		z >>= 7;
+	}
+	put(b);
+	put(data);
+}
+
+void capture_record(uint8_t kind, uint8_t data, Time t) {
+	uint8_t sreg = SREG;
+	cli();
+	if (capture.dropped && ring_free() >= 2 * MAX_RECORD) {
+		put_record(CAPTURE_DROPPED, capture.dropped, t);
+		capture.dropped = 0;
+	}
+	if (!capture.dropped && ring_free() >= MAX_RECORD) {
+		put_record(kind, data, t);
+	} else if (capture.dropped < 255) {
+		capture.dropped++;
+	}
+	SREG = sreg;
+}
+
+void capture_kick(void) {
+	uint8_t sreg = SREG;
+	uint8_t start;
+	cli();
+	start = !capture.draining;
+	capture.draining = 1;
+	SREG = sreg;
+	if (start) {
+		ASYNC(&capture, capture_drain, 0);
+	}
+}
+
+int capture_drain(struct Capture* self, __attribute__((unused)) int arg) {
+	uint8_t i, b;
+
+	for (;;) {
+		uint8_t sreg = SREG;
+		cli();
+		if (self->tail == self->head) {
+			self->draining = 0;
+			SREG = sreg;
+			return 0;
+		}
+		b = self->ring[self->tail];
+		self->tail = (self->tail + 1) & RING_MASK;
+		SREG = sreg;
+
+		// Eight clock pulses, two strobes each, MSB first.
+		USIDR = b;
+		USISR = (1 << USIOIF);
+		for (i = 0; i < 16; i++) {
+			USICR = (1 << USIWM0) | (1 << USICS1) | (1 << USICLK) | (1 << USITC);
+		}
+	}
+}
+
+#endif
\ No newline at end of file
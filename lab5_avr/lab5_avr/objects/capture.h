@@ -0,0 +1,71 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+/* Serial traffic capture
+Built with COM_CAPTURE, the Communicator logs every sensor byte it receives
+and every light byte it writes, with its time, so an incident can be replayed
+on the host later (host/replay). The records go into a small ring buffer and
+are shifted out over the USI in three-wire mode (DO on PE5, USCK on PE4) by a
+message of their own, so the capture never touches USART0 and the simulator
+link is left alone.
+
+Each record is a LEB128 varint of (zigzag(delta) << 2) | kind followed by the
+data byte, where delta is the time in ticks since the previous record. The
+delta is signed, as a message can run after an interrupt with a later
+timestamp. Sensor and light bytes are a few hundred milliseconds apart, so
+most records are three or four bytes. If the ring fills up, records are
+dropped and counted, and a CAPTURE_DROPPED record with the count (at most
+255) is written once there is room again.
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+
+#define CAPTURE_RX      0   // byte received from the simulator
+#define CAPTURE_TX      1   // byte written to the simulator
+#define CAPTURE_DROPPED 2   // records lost because the ring was full
+
+#ifdef COM_CAPTURE
+
+// Ring buffer size in bytes, a power of two.
+#ifndef CAPTURE_SIZE
+#define CAPTURE_SIZE 64
+#endif
+
+struct Capture {
+	Object super;
+
+	uint8_t ring[CAPTURE_SIZE];
+	uint8_t head;      // next byte to write
+	uint8_t tail;      // next byte to shift out
+	uint8_t dropped;   // records lost since the last CAPTURE_DROPPED
+	uint8_t draining;  // a capture_drain message is pending
+	Time last;         // time of the previous record
+};
+
+extern struct Capture capture;
+
+// Set up the USI and its pins. Call before interrupts are enabled.
+void capture_init(void);
+
+// Append a record with time `t`. Safe in interrupt handlers, including
+// INSTALL_FAST ones, as it posts no messages.
+void capture_record(uint8_t kind, uint8_t data, Time t);
+
+// Make sure the ring is being drained. Must not be called from an
+// INSTALL_FAST handler.
+void capture_kick(void);
+
+// Shift the ring out over the USI.
+int capture_drain(struct Capture* self, int arg);
+
+#define CAPTURE(kind, data) do { capture_record(kind, data, CURRENT_BASELINE()); capture_kick(); } while (0)
+
+#else
+
+#define capture_init()
+#define CAPTURE(kind, data)
+
+#endif
+
+#endif /* CAPTURE_H_ */
\ No newline at end of file
@@ -1,50 +1,204 @@
-#include "Communicator.h"
+#include "communicator.h"
 #include <avr/io.h>
-#include "Traffichandler.h"
+#include <avr/interrupt.h>
+#include "traffichandler.h"
 #include "common.h"
+#include "capture.h"
+
+// The host build defines COM_TRANSMIT to hand every light state that is
+// sent to the harness, which plays the part of the transmitter.
+#ifndef COM_TRANSMIT
+#define COM_TRANSMIT(data, latency)
+#endif
+
+// As in traffichandler.c, unless the host build reports failures itself.
+#ifndef ASSERT
+#define ASSERT(expr) if (!(expr)) CRASH(CRASH_ASSERT, CRASH_AT(FILE_COMMUNICATOR, __LINE__))
+#endif
+
+// Collect a configuration command and pass it on to the controller once
+// all of it is in. A new start byte drops a command that was cut short, and
+// a value that does not fit in 16 bits drops the command as well.
+static void config_byte(struct Communicator* self, uint8_t data) {
+	struct ConfigCommand cmd;
+
+	if (data & (1 << CONFIG_START)) {
+		self->command = data & 0x0f;
+		self->value = 0;
+		self->data_left = self->command < CONFIG_COMMIT ? CONFIG_DATA_BYTES : 0;
+	} else if (self->command != CONFIG_NONE && self->data_left > 0) {
+		if (self->value > (UINT16_MAX >> 6)) {
+			self->command = CONFIG_NONE;
+			return;
+		}
+		self->value = (self->value << 6) | (data & 0x3f);
+		self->data_left--;
+	} else {
+		return;
+	}
+	if (self->data_left == 0) {
+		cmd.command = self->command;
+		cmd.value = self->value;
+		self->command = CONFIG_NONE;
+		ASYNC_BLOCK(self->ctrl, traffichandler_configure, &cmd);
+	}
+}
 
 int com_receive_ready(struct Communicator* self, __attribute__((unused)) int arg) {
-	uint8_t data = UDR0;
+	struct SensorBatch batch;
+	batch.sensors = UDR0;
+	CAPTURE(CAPTURE_RX, batch.sensors);
+
+	if (batch.sensors & (1 << CONFIG_FRAME)) {
+		config_byte(self, batch.sensors);
+		return 0;
+	}
 	
-	// Send off data to Traffic controller.
-	if (data & (1 << NB_CAR_ARRIVAL)) {
-		ASYNC(self->ctrl, traffichandler_queue, NORTHBOUND);
+	// Send off all sensor bits of this byte to the Traffic controller in one message.
+	if (batch.sensors & SENSOR_MASK) {
+		ASYNC_BLOCK(self->ctrl, traffichandler_sensors, &batch);
+	}
+	return 0;
+}
+
+#ifdef COM_LATENCY_STATS
+static void note_latency(struct LightLatency* l, Time latency) {
+	uint8_t i = 0;
+	Time limit = COM_LATENCY_FIRST;
+	while (i < COM_LATENCY_BUCKETS - 1 && latency >= limit) {
+		i++;
+		limit <<= 1;
 	}
-	if (data & (1 << SB_CAR_ARRIVAL)) {
-		ASYNC(self->ctrl, traffichandler_queue, SOUTHBOUND);
+	if (l->hist[i] < UINT16_MAX) {
+		l->hist[i]++;
 	}
-	if (data & (1 << NB_BRIDGE_ENTRY)) {
-		ASYNC(self->ctrl, traffichandler_bridge, NORTHBOUND);
+	if (latency > l->max) {
+		l->max = latency;
 	}
-	if (data & (1 << SB_BRIDGE_ENTRY)) {
-		ASYNC(self->ctrl, traffichandler_bridge, SOUTHBOUND);
+}
+#endif
+
+// Write the oldest waiting state to UDR0. Interrupts must be off.
+static void transmit(struct Communicator* self) {
+	struct LightState* s = &self->light[self->light_head];
+#ifdef COM_LATENCY_STATS
+	// With interrupts off both use the time of the last interrupt, so the
+	// sum is the current time in a message and in a fast handler alike.
+	Time latency = CURRENT_BASELINE() + CURRENT_OFFSET() - s->decided;
+	note_latency(&self->latency, latency);
+#endif
+
+	UDR0 = s->lights;
+	COM_TRANSMIT(s->lights, latency);
+	self->lights_sent = s->lights;
+	self->light_head = (self->light_head + 1) & (COM_LIGHTS - 1);
+	self->light_count--;
+}
+
+static uint8_t report_pending(struct Communicator* self) {
+	return self->report_left > 0 || self->report_have > 0;
+}
+
+// Write the next three bits of the report to UDR0. Interrupts must be off.
+static void transmit_report(struct Communicator* self) {
+	if (self->report_have < 3 && self->report_left > 0) {
+		self->report_bits |= (uint16_t)*self->report++ << self->report_have;
+		self->report_left--;
+		self->report_have += 8;
 	}
-	return 0;
+	UDR0 = (1 << REPORT_FRAME) | ((self->report_bits & 0x7) << 4) | (self->lights_sent & 0x0f);
+	self->report_bits >>= 3;
+	self->report_have = self->report_have > 3 ? self->report_have - 3 : 0;
 }
 
 int com_data_register_ready(struct Communicator* self, __attribute__((unused)) int arg) {
-	if (self->data != 0) {
-		UDR0 = self->data;
-		self->data = 0;
+	if (self->light_count > 0) {
+		transmit(self);
+	} else if (report_pending(self)) {
+		transmit_report(self);
+	}
+	if (self->light_count == 0 && !report_pending(self)) {
+		// Disable data register ready interrupt.
+		UCSR0B = UCSR0B & ~(1 << UDRIE0);
 	}
-	
-	// Disable data register ready interrupt.
-	UCSR0B = UCSR0B & ~(1 << UDRIE0);
 	return 0;
 }
 
-int com_write_data(struct Communicator* self, int data) {
-	// Check if data register is ready to be written to.
+void com_write_lights(struct Communicator* self, uint8_t lights) {
+#ifdef COM_LATENCY_STATS
+	Time decided = CURRENT_BASELINE();
+#endif
+	uint8_t sreg;
+	struct LightState* s;
+
+	// Captured when the decision is made, even if the byte has to wait for
+	// com_data_register_ready, which must not post the drain message.
+	CAPTURE(CAPTURE_TX, lights);
+
+	sreg = SREG;
+	cli();
+	// The queue holds the worst case, see communicator.h.
+	ASSERT(self->light_count < COM_LIGHTS);
+	s = &self->light[(self->light_head + self->light_count) & (COM_LIGHTS - 1)];
+	self->light_count++;
+	s->lights = lights;
+#ifdef COM_LATENCY_STATS
+	if (self->light_count > self->latency.high_water) {
+		self->latency.high_water = self->light_count;
+	}
+	s->decided = decided;
+#endif
+
 	if (UCSR0A & (1 << UDRE0)) {
-		UDR0 = data;
-		self->data = 0;
-		} else {
-		// Otherwise, wait until the data register is empty
-		// and write on that interrupt.
-		
-		// Enable data register ready interrupt.
+		transmit(self);
+	}
+	if (self->light_count > 0) {
+		// Send the rest from the data register empty interrupt.
 		UCSR0B = UCSR0B | (1 << UDRIE0);
-		self->data = data;
 	}
+	SREG = sreg;
+}
+
+int com_write_data(struct Communicator* self, int data) {
+	com_write_lights(self, data);
 	return 0;
+}
+
+#ifdef COM_LATENCY_STATS
+void com_latency(struct Communicator* self, struct LightLatency* out) {
+	uint8_t sreg = SREG;
+	cli();
+	*out = self->latency;
+	SREG = sreg;
+}
+#endif
+
+int com_write_report(struct Communicator* self, const uint8_t* raw, uint8_t n) {
+	uint8_t sreg = SREG;
+	cli();
+	if (report_pending(self)) {
+		SREG = sreg;
+		return -1;
+	}
+	self->report = raw;
+	self->report_left = n;
+	self->report_bits = 0;
+	self->report_have = 0;
+	if (self->light_count == 0 && (UCSR0A & (1 << UDRE0))) {
+		transmit_report(self);
+	}
+	if (report_pending(self)) {
+		UCSR0B = UCSR0B | (1 << UDRIE0);
+	}
+	SREG = sreg;
+	return 0;
+}
+
+uint8_t com_report_busy(struct Communicator* self) {
+	uint8_t sreg = SREG;
+	uint8_t busy;
+	cli();
+	busy = report_pending(self);
+	SREG = sreg;
+	return busy;
 }
\ No newline at end of file
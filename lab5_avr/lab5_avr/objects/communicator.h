@@ -4,34 +4,130 @@
 
 #include <stdint.h>
 #include "TinyTimber.h"
+#include "common.h"
+#include "config.h"
 
 // Forward declare, as the Traffichandler also calls us.
 struct Traffichandler;
 
+/* Light output
+Light states go to the simulator through a channel of their own rather than
+as messages: com_write_lights puts the state in a small queue and writes it
+to UDR0 at once if the transmitter is free, otherwise the data register empty
+interrupt sends it as soon as it is. The simulator thus sees the states in
+the order they were decided, and a light change never waits behind other
+messages (display updates, the journal) for its turn to be sent.
+
+In COM_LATENCY_STATS builds each state is stamped with the baseline of the
+decision, and the time from there to UDR0 is kept as a histogram with
+buckets doubling from 1 ms (about one byte at 9600 baud). The stamps take
+four bytes of RAM per queued state, so they are left out by default.
+
+No state is ever dropped or replaced, since that could take the all-red out
+from between two greens. The queue is sized for the worst case instead, and
+overflowing it is a failed assertion. The controller decides at most two
+states at one instant: red, and green for the other side when the bridge is
+already clear. Any further decision takes a sensor byte or a timer, so at
+9600 baud the transmitter has sent about one state by then. A report byte
+in the way holds the queue up for one more byte. COM_LIGHTS leaves twice
+that much room.
+*/
+
+/* Reports
+Reports, such as the profile of objects/profiler.h, share the line with the
+light states. They are framed as the crash report of initiation.c: three
+bits in bits 4-6 of each byte, least significant first, with REPORT_FRAME
+set. Bits 0-3 of each report byte repeat the last light state sent, so the
+simulator keeps the lights as they are, and a report byte only goes out when
+no light state is waiting, so a light state waits at most one byte for it.
+*/
+
+// Light states that can wait for the transmitter, a power of two.
+#define COM_LIGHTS 8
+
+#define COM_LATENCY_BUCKETS 8
+#define COM_LATENCY_FIRST   32   // ticks, upper end of the first bucket
+
+struct LightState {
+	uint8_t lights;
+#ifdef COM_LATENCY_STATS
+	Time decided;      // baseline of the decision
+#endif
+};
+
+#ifdef COM_LATENCY_STATS
+struct LightLatency {
+	// Bucket i counts latencies below COM_LATENCY_FIRST << i, the last one
+	// all others. Saturate at UINT16_MAX.
+	uint16_t hist[COM_LATENCY_BUCKETS];
+	Time max;
+	uint8_t high_water;   // most states in the queue at once
+};
+#define COM_LATENCY_INIT {{0}, 0, 0},
+#else
+#define COM_LATENCY_INIT
+#endif
+
 typedef struct Communicator {
 	Object super;
 
-	// Buffered data, won't write anything if data is set to 0.
-	uint8_t data;
+	// Light states waiting for the transmitter, oldest at light_head.
+	struct LightState light[COM_LIGHTS];
+	uint8_t light_head;
+	uint8_t light_count;
 
 	// Controller to handle received data.
 	struct Traffichandler* ctrl;
+
+	// Configuration command being received (see config.h), CONFIG_NONE if none.
+	uint8_t command;
+	// Data bytes of the command still to come.
+	uint8_t data_left;
+	uint16_t value;
+
+#ifdef COM_LATENCY_STATS
+	struct LightLatency latency;
+#endif
+
+	// Report being sent, see com_write_report.
+	const uint8_t* report;
+	uint8_t report_left;    // bytes not yet in report_bits
+	uint8_t report_have;    // bits in report_bits
+	uint16_t report_bits;   // still to send, least significant first
+	uint8_t lights_sent;    // last light state written to UDR0
 } Communicator;
 
-#define initCommunicator(ctrl) { initObject(), 0, ctrl }
+#define initCommunicator(ctrl) { initObject(), {{0}}, 0, 0, ctrl, CONFIG_NONE, 0, 0, COM_LATENCY_INIT \
+                                 NULL, 0, 0, 0, (1 << NB_RED) | (1 << SB_RED) }
 
 // Interrupt handler for when data is ready to be read from the serial port register.
 int com_receive_ready(struct Communicator* self, int arg);
 
 // Interrupt handler for when data is ready to be written to the serial port register.
-// This writes the desired traffic light data if it is nonzero.
+// This sends the oldest waiting light state, or else the next byte of a report.
+// It posts no messages, so it may be installed with INSTALL_FAST.
 int com_data_register_ready(struct Communicator* self, int arg);
 
-// Writes data if possible, if the data register is not ready it will keep the data
-// passed and send when it can. Note that it wont send anything if the data register
-// is not ready to be written to and data is 0.
+// Send light state `lights`, decided at the current baseline. Called directly
+// by the controller; safe in any context but an INSTALL_FAST handler.
+void com_write_lights(struct Communicator* self, uint8_t lights);
+
+// com_write_lights as a message, for senders that are not in a hurry.
 int com_write_data(struct Communicator* self, int data);
 
+#ifdef COM_LATENCY_STATS
+// A copy of the latency statistics.
+void com_latency(struct Communicator* self, struct LightLatency* out);
+#endif
+
+// Send the `n` bytes at `raw` as a report. `raw` must stay as it is until
+// com_report_busy returns 0. Returns -1 and sends nothing if a report is
+// still going out. Posts no messages, so INSTALL_FAST handlers may call it.
+int com_write_report(struct Communicator* self, const uint8_t* raw, uint8_t n);
+
+// Nonzero while a report is going out.
+uint8_t com_report_busy(struct Communicator* self);
+
 
 
 #endif /* COMMUNICATOR_H_ */
\ No newline at end of file
@@ -0,0 +1,6 @@
+#include "config.h"
+
+int config_valid(const struct ConfigValues* v) {
+	return v->max_cars >= 1 && v->max_cars <= 255 &&
+	       v->light_switch <= CONFIG_MAX_DELAY && v->first_check <= CONFIG_MAX_DELAY;
+}
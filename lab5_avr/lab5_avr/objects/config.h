@@ -0,0 +1,59 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+/* Runtime configuration
+The tuning constants of common.h are only the defaults. The controller
+settings can be changed over the serial link without reflashing, and the
+last committed settings are kept in EEPROM and loaded again by initiate().
+
+A command is sent as bytes with bit 7 (CONFIG_FRAME) set, which the
+simulator never sets in a sensor byte, so sensor bytes may even arrive in
+the middle of a command:
+   1 start byte   CONFIG_FRAME | CONFIG_START | command (bits 0-3)
+   3 data bytes   CONFIG_FRAME | 6 bits of the value, high bits first
+CONFIG_COMMIT, CONFIG_DEFAULTS and CONFIG_CANCEL carry no data bytes. The
+value has 16 bits, so bits 4 and 5 of the first data byte are 0; a command
+with either of them set is dropped.
+
+CONFIG_MAX_CARS, CONFIG_LIGHT_SWITCH and CONFIG_FIRST_CHECK only stage a new
+value. CONFIG_COMMIT hands the staged set to the controller, which starts
+using all of it at once at the next light phase boundary (or right away if
+the bridge is idle), and then saves it (see storage.h). Values out of range
+are ignored.
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+#include "common.h"
+
+// Commands.
+#define CONFIG_MAX_CARS     0   // cars from one direction before switching
+#define CONFIG_LIGHT_SWITCH 1   // DELAY_LIGHT_SWITCH in ms
+#define CONFIG_FIRST_CHECK  2   // DELAY_FIRST_CHECK in ms
+#define CONFIG_COMMIT       13  // use and save the staged settings
+#define CONFIG_DEFAULTS     14  // stage the defaults of common.h
+#define CONFIG_CANCEL       15  // drop the staged settings
+#define CONFIG_NONE         0xff
+
+#define CONFIG_DATA_BYTES   3
+#define CONFIG_MAX_DELAY    30000   // ms
+
+// Controller settings as they are sent and saved.
+struct ConfigValues {
+	uint16_t max_cars;
+	uint16_t light_switch;   // ms
+	uint16_t first_check;    // ms
+};
+
+#define CONFIG_DEFAULT_VALUES { MAX_CARS_BEFORE_LIGHT_SWITCH, DELAY_LIGHT_SWITCH, DELAY_FIRST_CHECK }
+
+// A received command, from the Communicator to the controller.
+struct ConfigCommand {
+	uint8_t command;
+	uint16_t value;
+};
+
+// Whether `v` holds usable settings.
+int config_valid(const struct ConfigValues* v);
+
+#endif /* CONFIG_H_ */
@@ -0,0 +1,185 @@
+#include "display.h"
+#include "common.h"
+#include "lcd.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define PAGE_FRAMES   (DISPLAY_PAGE_TIME * DISPLAY_FRAME_RATE)
+#define RATE_FRAMES   (DISPLAY_RATE_TIME * DISPLAY_FRAME_RATE)
+#define RATE_SCALE    (3600 / DISPLAY_RATE_TIME)
+#define MAX_FIELD     9999
+
+#ifdef __AVR__
+struct Display display =
+#else
+_Thread_local struct Display display =
+#endif
+	{ initObject(), { { 0, 0 }, 0, { RED, RED }, 0, 0, 0 }, PAGE_QUEUES, 0, 0, 0, { 0 }, 0, 0, RATE_FRAMES, 0, 0 };
+
+// Two-letter names of the statistics pages, in flash.
+static const char labels[N_PAGES][2] PROGMEM = {
+	[PAGE_THROUGHPUT] = { 't', 'p' },
+	[PAGE_MAX_WAIT]   = { 'w', 'a' },
+	[PAGE_SWITCHES]   = { 's', 'w' },
+#ifdef TT_STATS
+	[PAGE_POOL]       = { 'p', 'o' },
+#endif
+};
+
+static uint16_t clamp(uint32_t v) {
+	return v < MAX_FIELD ? v : MAX_FIELD;
+}
+
+static uint16_t queue_length(int16_t n) {
+	return n > 0 ? n : 0;
+}
+
+// `v` as four BCD digits, 9999 if it is larger. Found by subtraction, at
+// most 27 of them: this runs in the frame interrupt, and a % 10 and / 10
+// per character would be two calls to the libgcc division helper.
+static uint16_t bcd(uint16_t v) {
+	static const uint16_t powers[3] = { 1000, 100, 10 };
+	uint16_t out = 0;
+	uint8_t i, digit;
+
+	if (v > MAX_FIELD) {
+		v = MAX_FIELD;
+	}
+	for (i = 0; i < 3; i++) {
+		for (digit = 0; v >= powers[i]; digit++) {
+			v -= powers[i];
+		}
+		out = (out << 4) | digit;
+	}
+	return (out << 4) | v;
+}
+
+static uint16_t page_value(struct Display* self) {
+	switch (self->page) {
+	case PAGE_THROUGHPUT:
+		return self->rate;
+	case PAGE_MAX_WAIT:
+		return clamp(self->values.max_wait);
+	case PAGE_SWITCHES:
+		return clamp(self->values.switches);
+#ifdef TT_STATS
+	case PAGE_POOL:
+		return MSG_HIGH_WATER();
+#endif
+	default:
+		return 0;
+	}
+}
+
+// The character at `pos`. Characters are asked for right to left, and each
+// field is loaded into `rest` in BCD at its rightmost digit and then taken
+// apart one digit per call.
+static char page_char(struct Display* self, uint8_t pos) {
+	char ch;
+	if (self->page == PAGE_QUEUES) {
+		// Northbound queue at 0-1, bridge at 2-3, southbound queue at 4-5.
+		if (pos == 5) {
+			self->rest = bcd(queue_length(self->values.in_queue[SOUTHBOUND]));
+		} else if (pos == 3) {
+			self->rest = bcd(self->values.on_bridge);
+		} else if (pos == 1) {
+			self->rest = bcd(queue_length(self->values.in_queue[NORTHBOUND]));
+		}
+	} else {
+		if (pos < 2) {
+			return pgm_read_byte(&labels[self->page][pos]);
+		}
+		if (pos == 5) {
+			self->rest = bcd(page_value(self));
+		}
+	}
+	ch = '0' + (self->rest & 0xf);
+	self->rest >>= 4;
+	return ch;
+}
+
+// Colons and light carets, at the end of every pass.
+static void draw_specials(struct Display* self) {
+	if (self->page == PAGE_QUEUES) {
+		LCDDR8 = LCDDR8 | 0x1;
+	} else {
+		LCDDR8 = LCDDR8 & ~0x1;
+	}
+	if (self->values.light[NORTHBOUND] == GREEN) {
+		LCDDR0 = (LCDDR0 & ~SPECIAL_MASK) | (1 << 2);
+	} else {
+		LCDDR0 = (LCDDR0 & ~SPECIAL_MASK) | (1 << 1);
+	}
+	if (self->values.light[SOUTHBOUND] == GREEN) {
+		LCDDR1 = (LCDDR1 & ~SPECIAL_MASK) | (1 << 1);
+	} else {
+		LCDDR1 = (LCDDR1 & ~SPECIAL_MASK) | (1 << 6);
+	}
+}
+
+void display_init(void) {
+	LCDCRA = LCDCRA | (1 << LCDIE);
+	// Joystick centre, pulled up, low while pressed.
+	PORTB = PORTB | (1 << PB4);
+	PCMSK1 = PCMSK1 | (1 << PCINT12);
+	EIMSK = EIMSK | (1 << PCIE1);
+}
+
+void display_note(const struct DisplayValues* v) {
+	uint8_t sreg = SREG;
+	cli();
+	if (!display.noted) {
+		// Cars restored from the journal are not from this window.
+		display.noted = 1;
+		display.rate_served = v->served;
+	}
+	display.values = *v;
+	SREG = sreg;
+}
+
+int display_frame(struct Display* self, __attribute__((unused)) int arg) {
+	char ch;
+
+	if (--self->rate_frames == 0) {
+		self->rate = clamp((self->values.served - self->rate_served) * RATE_SCALE);
+		self->rate_served = self->values.served;
+		self->rate_frames = RATE_FRAMES;
+	}
+
+	if (self->pos == 0) {
+		if (self->page_frames == 0) {
+			self->page = PAGE_QUEUES;
+		}
+		self->pos = DISPLAY_CHARS;
+	}
+	if (self->page_frames > 0) {
+		self->page_frames--;
+	}
+	if (self->bounce_frames > 0) {
+		self->bounce_frames--;
+	}
+
+	self->pos--;
+	ch = page_char(self, self->pos);
+	if (ch != self->shown[self->pos] && writeChar(ch, self->pos) == 0) {
+		self->shown[self->pos] = ch;
+	}
+	if (self->pos == 0) {
+		draw_specials(self);
+	}
+	return 0;
+}
+
+int display_button(struct Display* self, __attribute__((unused)) int arg) {
+	if ((PINB & (1 << PB4)) || self->bounce_frames > 0) {
+		// Released, or still bouncing.
+		return 0;
+	}
+	self->bounce_frames = DISPLAY_BOUNCE_TIME;
+	self->page = self->page + 1 < N_PAGES ? self->page + 1 : PAGE_QUEUES;
+	self->page_frames = self->page == PAGE_QUEUES ? 0 : PAGE_FRAMES;
+	// Start a new pass: the one under way may have drawn half the old page.
+	self->pos = 0;
+	return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+/* Statistics display
+The LCD shows the queues and the bridge, and a statistics page only when
+the joystick is pressed (centre, PB4): every press turns to the next one,
+and after DISPLAY_PAGE_TIME seconds without a press it goes back to the
+queues. The pages:
+   queues   northbound queue, cars on the bridge and southbound queue, two
+            digits each, with the light carets
+   "tp"     cars per hour over the last DISPLAY_RATE_TIME seconds
+   "wa"     longest time a queue waited with no car entering, in seconds
+   "sw"     changes of the green direction
+   "po"     most messages in use at once (TT_STATS builds only)
+Values that do not fit the four digits of a page show as 9999.
+
+The controller never draws anything itself. traffichandler_print only hands
+a copy of its figures to display_note, and the LCD frame interrupt
+(IRQ_LCD) draws the page one character per frame, right to left, skipping
+characters that are already showing. A full page takes six frames, about
+0.4 s, and the cost of the display is spread out in small interrupt handlers
+instead of holding up controller methods such as traffichandler_set_light.
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+
+// With the low power waveform of init_lcd, the LCD interrupt comes every
+// second frame of the 32 Hz frame rate.
+#define DISPLAY_FRAME_RATE  16
+#define DISPLAY_PAGE_TIME   4
+#define DISPLAY_RATE_TIME   225   // 1/16 hour
+#define DISPLAY_CHARS       6
+#define DISPLAY_BOUNCE_TIME 4     // frames, presses closer than this are contact bounce
+
+enum DisplayPage {
+	PAGE_QUEUES,
+	PAGE_THROUGHPUT,
+	PAGE_MAX_WAIT,
+	PAGE_SWITCHES,
+#ifdef TT_STATS
+	PAGE_POOL,
+#endif
+	N_PAGES
+};
+
+// Figures from the controller.
+struct DisplayValues {
+	int16_t in_queue[2];
+	uint16_t on_bridge;
+	uint8_t light[2];
+	uint32_t served;      // both directions
+	uint16_t max_wait;    // s
+	uint32_t switches;
+};
+
+struct Display {
+	Object super;
+
+	// Latest figures, written by display_note with interrupts off.
+	struct DisplayValues values;
+
+	uint8_t page;
+	uint8_t pos;                   // characters left to draw in this pass
+	uint16_t page_frames;          // frames left on this page
+	uint16_t rest;                 // BCD digits of the field being drawn
+	char shown[DISPLAY_CHARS];     // what the LCD shows now
+	uint8_t noted;                 // display_note has been called
+	uint8_t bounce_frames;         // frames until the next press counts
+
+	// Throughput, counted over windows of DISPLAY_RATE_TIME.
+	uint16_t rate_frames;          // frames left in the window
+	uint32_t rate_served;          // served when the window started
+	uint16_t rate;                 // cars per hour in the last window
+};
+
+// One per simulation thread on the host.
+#ifdef __AVR__
+extern struct Display display;
+#else
+extern _Thread_local struct Display display;
+#endif
+
+// Enable the LCD frame interrupt. Call after init_lcd().
+void display_init(void);
+
+// Hand new figures to the display. Only copies them, so it is cheap enough
+// to call on every change.
+void display_note(const struct DisplayValues* v);
+
+// IRQ_LCD handler, draws the next character. Posts no messages, so it can
+// be installed with INSTALL_FAST.
+int display_frame(struct Display* self, int arg);
+
+// IRQ_PCINT1 handler, turns to the next page when the joystick is pressed.
+// Posts no messages either.
+int display_button(struct Display* self, int arg);
+
+#endif /* DISPLAY_H_ */
@@ -0,0 +1,81 @@
+#include "profiler.h"
+
+#ifdef TT_PROFILE
+
+#include <avr/io.h>
+#include "communicator.h"
+
+// CTC mode at clk/1024: 8 MHz / 1024 / 79 = 98.9 samples a second.
+#define SAMPLE_COUNTS 79
+
+struct Profiler profiler = { initObject(), { { NULL, 0 } }, 0, 0, 0, 0, NULL, { 0 } };
+
+void profiler_init(struct Communicator* com) {
+	profiler.com = com;
+	TCCR0A = (1 << WGM01) | (1 << CS02) | (1 << CS00);
+	OCR0A = SAMPLE_COUNTS - 1;
+	TCNT0 = 0;
+	TIFR0 = 1 << OCF0A;
+	TIMSK0 = 1 << OCIE0A;
+}
+
+static uint8_t* put16(uint8_t* p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+// Write the table out as a report. Returns its length.
+static uint8_t make_report(struct Profiler* self) {
+	uint8_t* p = self->report;
+	uint8_t i, n, sum = 0;
+
+	*p++ = PROFILE_REPORT;
+	*p++ = self->used;
+	p = put16(p, self->samples);
+	p = put16(p, self->idle);
+	p = put16(p, self->other);
+	for (i = 0; i < self->used; i++) {
+		p = put16(p, (uint16_t)(uintptr_t)self->slot[i].method);
+		p = put16(p, self->slot[i].samples);
+	}
+	n = p - self->report;
+	for (i = 0; i < n; i++) {
+		sum += self->report[i];
+	}
+	*p = -sum;
+	return n + 1;
+}
+
+int profiler_sample(struct Profiler* self, __attribute__((unused)) int arg) {
+	Method m = CURRENT_METHOD();
+	uint8_t i;
+
+	if (m == NULL) {
+		self->idle++;
+	} else {
+		for (i = 0; i < self->used && self->slot[i].method != m; i++) {
+		}
+		if (i < self->used) {
+			self->slot[i].samples++;
+		} else if (i < PROFILE_SLOTS) {
+			self->slot[i].method = m;
+			self->slot[i].samples = 1;
+			self->used++;
+		} else {
+			self->other++;
+		}
+	}
+
+	// Should the last report still be going out, this one just gets longer.
+	if (++self->samples >= PROFILE_PERIOD && !com_report_busy(self->com)) {
+		com_write_report(self->com, self->report, make_report(self));
+		self->used = 0;
+		self->samples = 0;
+		self->idle = 0;
+		self->other = 0;
+	}
+	return 0;
+}
+
+#endif
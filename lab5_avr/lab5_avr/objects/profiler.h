@@ -0,0 +1,73 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+/* Sampling profiler
+Built with TT_PROFILE, TIMER0 interrupts about 99 times a second, and its
+handler notes the method the kernel was running at that instant
+(CURRENT_METHOD), or that the system was idle. The counts go into a small
+table, and every PROFILE_PERIOD samples the table is sent as a report over
+USART0 (com_write_report) and started afresh. host/profile reads the
+reports from a log of the serial line and names the methods from the
+symbols of the firmware ELF.
+
+The sample period of 79 TIMER0 counts is prime, so the samples do not keep
+falling on the same phase of the heartbeat or the LCD frames. The kernel and
+the interrupt handlers run with interrupts off, so a sample that comes due
+in one of them is taken when it returns, and counts for the method that runs
+next: the profile shows where the messages spend their time, with the
+handlers spread over them.
+
+Report: PROFILE_REPORT, the number of methods n, the samples of the report,
+of them the idle ones and those of methods that did not fit in the table,
+then n times a method (a word address) and its samples, all 16-bit values
+low byte first, and last a check byte that makes the sum of all bytes 0.
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+
+#define PROFILE_REPORT 0x50   // first byte, unlike the CRASH_ reasons
+#define PROFILE_SLOTS  12     // methods in one report
+#define PROFILE_PERIOD 990    // samples per report, about 10 s
+#define PROFILE_HEADER 8
+#define PROFILE_REPORT_SIZE (PROFILE_HEADER + 4 * PROFILE_SLOTS + 1)
+
+#ifdef TT_PROFILE
+
+struct Communicator;
+
+struct ProfileSlot {
+	Method method;
+	uint16_t samples;
+};
+
+struct Profiler {
+	Object super;
+
+	struct ProfileSlot slot[PROFILE_SLOTS];
+	uint8_t used;          // slots in use
+	uint16_t samples;      // taken since the last report
+	uint16_t idle;
+	uint16_t other;        // of methods that found no free slot
+
+	struct Communicator* com;
+	uint8_t report[PROFILE_REPORT_SIZE];   // being sent
+};
+
+extern struct Profiler profiler;
+
+// Start TIMER0, and send the reports through `com`. Call before the kernel
+// starts.
+void profiler_init(struct Communicator* com);
+
+// IRQ_TIMER0_COMP handler. Posts no messages, and must be installed with
+// INSTALL_FAST so that it sees the method it interrupted.
+int profiler_sample(struct Profiler* self, int arg);
+
+#else
+
+#define profiler_init(com)
+
+#endif
+
+#endif /* PROFILER_H_ */
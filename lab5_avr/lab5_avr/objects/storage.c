@@ -0,0 +1,162 @@
+#include "storage.h"
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define JOURNAL_IDLE sizeof(struct JournalRecord)
+
+#ifdef __AVR__
+struct Storage storage =
+#else
+_Thread_local struct Storage storage =
+#endif
+	{ initObject(), { 0 }, sizeof(struct ConfigRecord), { { { 0, 0 } }, 0 }, JOURNAL_IDLE, 0, { { 0, 0 } }, 0 };
+
+// Checksum of the `size` bytes before the check byte of a record.
+static uint8_t checksum(const void* data, uint8_t size) {
+	const uint8_t* p = data;
+	uint8_t sum = 0;
+	while (size--) {
+		sum += *p++;
+	}
+	return ~sum;
+}
+
+static uint8_t ee_read(uint16_t addr) {
+	EEAR = addr;
+	EECR = EECR | (1 << EERE);
+	return EEDR;
+}
+
+static void ee_read_block(void* data, uint16_t addr, uint8_t size) {
+	uint8_t* p = data;
+	// A write left over from before a reset has to finish first.
+	while (EECR & (1 << EEWE)) {
+	}
+	while (size--) {
+		*p++ = ee_read(addr++);
+	}
+}
+
+void storage_load_config(struct ConfigValues* v) {
+	struct ConfigRecord r;
+	const struct ConfigValues defaults = CONFIG_DEFAULT_VALUES;
+
+	ee_read_block(&r, CONFIG_EEPROM_ADDR, sizeof(r));
+	if (r.magic == CONFIG_MAGIC && r.check == checksum(&r, offsetof(struct ConfigRecord, check)) &&
+	    config_valid(&r.values)) {
+		*v = r.values;
+	} else {
+		*v = defaults;
+	}
+}
+
+static int journal_valid(const struct JournalRecord* r) {
+	return r->check == checksum(r, offsetof(struct JournalRecord, check)) &&
+	       r->state.last_green_direction <= SOUTHBOUND &&
+	       r->state.in_queue[NORTHBOUND] >= 0 && r->state.in_queue[SOUTHBOUND] >= 0;
+}
+
+int storage_load_journal(struct JournalState* s, const CrashRecord* last) {
+	struct JournalRecord r, next;
+	uint8_t i, valid, next_valid, first_valid;
+
+	ee_read_block(&next, JOURNAL_ADDR, sizeof(next));
+	first_valid = next_valid = journal_valid(&next);
+	for (i = 0; i < JOURNAL_SLOTS; i++) {
+		r = next;
+		valid = next_valid;
+		if (i + 1 < JOURNAL_SLOTS) {
+			ee_read_block(&next, JOURNAL_ADDR + (i + 1) * sizeof(next), sizeof(next));
+			next_valid = journal_valid(&next);
+		} else {
+			ee_read_block(&next, JOURNAL_ADDR, sizeof(next));
+			next_valid = first_valid;
+		}
+		if (valid && (!next_valid || next.seq != (uint8_t)(r.seq + 1))) {
+			// Carry on after this record.
+			storage.journal = r;
+			storage.journal_slot = i;
+			if (!last || (uint16_t)(UPTIME() - r.noted) > JOURNAL_MAX_AGE) {
+				return 0;
+			}
+			*s = r.state;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int storage_save_config(struct Storage* self, const struct ConfigValues* v) {
+	self->config.magic = CONFIG_MAGIC;
+	self->config.values = *v;
+	self->config.check = checksum(&self->config, offsetof(struct ConfigRecord, check));
+
+	// Start over, also if an older save is still being written; the bytes
+	// it already wrote are compared again.
+	self->config_next = 0;
+	EECR = EECR | (1 << EERIE);
+	return 0;
+}
+
+void storage_journal(const struct JournalState* s) {
+	uint8_t sreg = SREG;
+	uint8_t arm;
+	cli();
+	storage.pending = *s;
+	arm = !storage.journal_armed && memcmp(s, &storage.journal.state, sizeof(*s)) != 0;
+	if (arm) {
+		storage.journal_armed = 1;
+	}
+	SREG = sreg;
+	if (arm) {
+		AFTER(JOURNAL_INTERVAL, &storage, storage_journal_due, 0);
+	}
+}
+
+int storage_journal_due(struct Storage* self, __attribute__((unused)) int arg) {
+	self->journal_armed = 0;
+	// A record still being written is replaced in its slot, otherwise the
+	// next slot in the ring is taken.
+	if (self->journal_next == JOURNAL_IDLE) {
+		self->journal_slot = self->journal_slot + 1 < JOURNAL_SLOTS ? self->journal_slot + 1 : 0;
+		self->journal.seq++;
+	}
+	self->journal.state = self->pending;
+	self->journal.noted = UPTIME();
+	self->journal.check = checksum(&self->journal, offsetof(struct JournalRecord, check));
+	self->journal_next = 0;
+	EECR = EECR | (1 << EERIE);
+	return 0;
+}
+
+// Write the next byte of `data` that differs from the EEPROM at `addr`.
+// Returns 0 once all of it is there.
+static uint8_t write_next(uint8_t* next, const void* data, uint8_t size, uint16_t addr) {
+	const uint8_t* p = data;
+	while (*next < size) {
+		uint8_t i = (*next)++;
+		if (ee_read(addr + i) != p[i]) {
+			EEDR = p[i];
+			// EEWE must follow EEMWE within four cycles, interrupts are off here.
+			EECR = EECR | (1 << EEMWE);
+			EECR = EECR | (1 << EEWE);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int storage_ee_ready(struct Storage* self, __attribute__((unused)) int arg) {
+	if (write_next(&self->config_next, &self->config, sizeof(self->config), CONFIG_EEPROM_ADDR)) {
+		return 0;
+	}
+	if (write_next(&self->journal_next, &self->journal, sizeof(self->journal),
+	               JOURNAL_ADDR + self->journal_slot * sizeof(self->journal))) {
+		return 0;
+	}
+	// Nothing left to write.
+	EECR = EECR & ~(1 << EERIE);
+	return 0;
+}
@@ -0,0 +1,116 @@
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+/* EEPROM storage
+Everything that survives a reset goes through the Storage object: the
+settings of config.h and a journal of the controller state, so that after a
+crash the controller picks up the queues it was serving instead of starting
+from empty ones.
+
+The EEPROM is written one byte per IRQ_EE_READY interrupt, and only bytes
+that differ from what is already there are written, so nothing ever waits
+on the EEPROM while the controller runs. Every record carries a checksum,
+and one that was cut short by a reset is ignored when loading.
+
+The journal is a ring of JOURNAL_SLOTS records, each with a sequence number
+one higher than the one before it; the newest is the valid record whose
+successor does not continue the sequence. Changes are written at most once
+per JOURNAL_INTERVAL, so the restored state can miss the last few seconds,
+and consecutive records go to different slots to spread the wear: busy
+traffic rewrites a given slot about every two minutes, which the 100 000
+cycles of the EEPROM last for several months of nonstop changes.
+
+Only a watchdog or crash reset restores the journal, and only from a record
+written less than JOURNAL_MAX_AGE before it. After a power-on the cars that
+were counted may long be gone, and a queue that does not exist keeps its
+light green for good: the controller only looks at the other side when a car
+enters. Records carry the UPTIME() at which they were written, which counts
+from 0 again at power-on, and the controller journals its state as it starts,
+so a record from before a power-on is soon replaced.
+*/
+
+#include <stdint.h>
+#include "TinyTimber.h"
+#include "config.h"
+#include "traffichandler.h"
+
+#define EEPROM_SIZE         512     // ATmega169
+
+// Where the settings are kept.
+#define CONFIG_EEPROM_ADDR  0
+#define CONFIG_MAGIC        0x5a    // changed when struct ConfigValues changes
+
+// Where the journal is kept, after the settings.
+#define JOURNAL_ADDR        16
+#define JOURNAL_SLOTS       ((EEPROM_SIZE - JOURNAL_ADDR) / sizeof(struct JournalRecord))
+#define JOURNAL_INTERVAL    SEC(5)
+#define JOURNAL_MAX_AGE     15      // UPTIME() periods, about 30 s
+
+struct ConfigRecord {
+	uint8_t magic;
+	struct ConfigValues values;
+	uint8_t check;
+};
+
+// Controller state that is restored after a reset.
+struct JournalState {
+	int16_t in_queue[2];
+	uint8_t on_bridge;
+	uint8_t last_green_direction;
+	uint16_t passed_before_change;
+	struct TrafficStats stats;
+};
+
+struct JournalRecord {
+	struct JournalState state;
+	uint16_t noted;     // UPTIME() when the record was written
+	uint8_t seq;
+	uint8_t check;
+};
+
+struct Storage {
+	Object super;
+
+	// Records being written, and the offset of the next byte to compare.
+	struct ConfigRecord config;
+	uint8_t config_next;
+	struct JournalRecord journal;
+	uint8_t journal_next;
+	uint8_t journal_slot;
+
+	// Latest state from the controller, written when the interval is up.
+	struct JournalState pending;
+	uint8_t journal_armed;
+};
+
+// One per simulation thread on the host.
+#ifdef __AVR__
+extern struct Storage storage;
+#else
+extern _Thread_local struct Storage storage;
+#endif
+
+// Read the saved settings into `v`, or the defaults if there are none.
+// Blocks on the EEPROM, so call it before the kernel starts.
+void storage_load_config(struct ConfigValues* v);
+
+// Find the newest journal record, so that the journal carries on after it,
+// and read it into `s` if the reset was the crash `last` (LAST_CRASH()) and
+// the record is no older than JOURNAL_MAX_AGE. Returns 0 if nothing was
+// read. Blocks on the EEPROM, so call it before the kernel starts.
+int storage_load_journal(struct JournalState* s, const CrashRecord* last);
+
+// Save settings in the background.
+int storage_save_config(struct Storage* self, const struct ConfigValues* v);
+
+// Note the current controller state. Cheap enough to call on every change:
+// it only copies `s`, and the journal is written once the interval is up.
+void storage_journal(const struct JournalState* s);
+
+// Start writing the latest state noted by storage_journal.
+int storage_journal_due(struct Storage* self, int arg);
+
+// IRQ_EE_READY handler, writes the next byte that differs.
+int storage_ee_ready(struct Storage* self, int arg);
+
+#endif /* STORAGE_H_ */
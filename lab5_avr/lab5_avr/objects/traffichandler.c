@@ -1,15 +1,17 @@
-#include "Traffichandler.h"
-#include "Communicator.h"
+#include "traffichandler.h"
+#include "communicator.h"
+#include "storage.h"
+#include "display.h"
+#include "calibration.h"
 #include "common.h"
-#include "lcd.h"
 #include <avr/io.h>
 
-// What happen with this command? What's written and why while?
-#define ASSERT(expr) if (!(expr)) while(1) { LCDDR0 = 0xff; }
-
-#define NB_PRINT_POS 0
-#define SB_PRINT_POS 4
-#define BRIDGE_PRINT_POS 2
+// A failed assertion resets the controller through the watchdog, and it comes
+// back up with all lights red (see CRASH in TinyTimber.h and initiate()).
+// The host build provides its own ASSERT that reports the failure instead.
+#ifndef ASSERT
+#define ASSERT(expr) if (!(expr)) CRASH(CRASH_ASSERT, CRASH_AT(FILE_TRAFFICHANDLER, __LINE__))
+#endif
 
 #define NB_GREEN_MASK (1 << NB_GREEN)
 #define NB_RED_MASK (1 << NB_RED)
@@ -17,50 +19,188 @@
 #define SB_RED_MASK (1 << SB_RED)
 #define PACK_LIGHTS(N, S) (((N) == GREEN ? NB_GREEN_MASK : NB_RED_MASK) | ((S) == GREEN ? SB_GREEN_MASK : SB_RED_MASK))
 
+#ifdef __AVR__
+struct TrafficParams traffic_params = TRAFFIC_PARAMS_DEFAULT;
+#else
+_Thread_local struct TrafficParams traffic_params = TRAFFIC_PARAMS_DEFAULT;
+#endif
+
 #define NORTHBOUND_GREEN PACK_LIGHTS(GREEN, RED)
 #define SOUTHBOUND_GREEN PACK_LIGHTS(RED, GREEN)
 
+void traffic_params_set(const struct ConfigValues* v) {
+	int16_t scale = calibration_scale();
+	traffic_params.max_cars_before_light_switch = v->max_cars;
+	traffic_params.switch_window = calibrated(TICKS_CROSS_BRIDGE + MSEC(v->light_switch), scale);
+	traffic_params.first_check = calibrated(MSEC(v->first_check), scale);
+	traffic_params.cross_bridge = calibrated(TICKS_CROSS_BRIDGE, scale);
+	traffic_params.scale = scale;
+}
+
+// Start using committed settings, or a new clock correction. Called where
+// one light phase ends and the next has not begun, so that a phase never
+// sees a mix of old and new ones.
+static void apply_settings(struct Traffichandler* self) {
+	if (self->commit_pending) {
+		self->commit_pending = false;
+		self->settings = self->committed;
+		traffic_params_set(&self->settings);
+		ASYNC_BLOCK(&storage, storage_save_config, &self->settings);
+	} else if (traffic_params.scale != calibration_scale()) {
+		traffic_params_set(&self->settings);
+	}
+}
+
+// Hand the state to the journal, which writes it out now and then.
+static void journal(struct Traffichandler* self) {
+	struct JournalState s;
+	s.in_queue[NORTHBOUND] = self->lane[NORTHBOUND].in_queue;
+	s.in_queue[SOUTHBOUND] = self->lane[SOUTHBOUND].in_queue;
+	s.on_bridge = self->on_bridge;
+	s.last_green_direction = self->last_green_direction;
+	s.passed_before_change = self->passed_before_change;
+	s.stats = self->stats;
+	storage_journal(&s);
+}
+
+// Whole seconds in `t`, at most UINT16_MAX. Binary long division by
+// shifting and subtracting, 16 steps: SEC_OF would call the 32-bit division
+// helper of libgcc for every car that enters.
+static uint16_t whole_seconds(Time t) {
+	int32_t left, step = (int32_t)TICKS_PER_SEC << 15;
+	uint16_t bit, seconds = 0;
+
+	if (t >= (int32_t)UINT16_MAX * TICKS_PER_SEC) {
+		return UINT16_MAX;
+	}
+	left = t;
+	for (bit = 0x8000; bit != 0; bit >>= 1, step >>= 1) {
+		if (left >= step) {
+			left -= step;
+			seconds |= bit;
+		}
+	}
+	return seconds;
+}
+
+// A car from `direction` enters: the queue has waited since the car before
+// it entered, or since it formed.
+static void note_wait(struct Traffichandler* self, int direction) {
+	struct Lane* lane = &self->lane[direction];
+	Time now = CURRENT_BASELINE();
+	if (lane->in_queue > 0) {
+		uint16_t wait = whole_seconds(now - lane->waiting_since);
+		if (wait > self->stats.max_wait) {
+			self->stats.max_wait = wait;
+		}
+	}
+	lane->waiting_since = now;
+}
+
+// Time until the other side may get green: the light switch margin after
+// the bridge is clear. Not more than PARAM_SWITCH_WINDOW, as the last car
+// entered no later than now, and less when it entered some time ago.
+static Time until_clear(struct Traffichandler* self) {
+	return self->clear_at + (PARAM_SWITCH_WINDOW - PARAM_CROSS_BRIDGE) - CURRENT_BASELINE();
+}
+
+// Change of direction: red now, and green for the other side at the
+// earliest instant that is safe for the cars on the bridge.
+static void switch_direction(struct Traffichandler* self, uint8_t lights) {
+	Time wait = until_clear(self);
+	ASYNC(self, traffichandler_set_red_light, 0);
+	self->light_update_pending = true;
+	AFTER(wait > 0 ? wait : 0, self, traffichandler_switch_light, lights);
+}
+
+static bool idle(struct Traffichandler* self) {
+	return self->lane[NORTHBOUND].in_queue == 0 && self->lane[SOUTHBOUND].in_queue == 0 &&
+	       self->on_bridge == 0 && !self->light_update_pending;
+}
+
+int traffichandler_sensors(struct Traffichandler* self, const struct SensorBatch* batch) {
+	if (batch->sensors & (1 << NB_CAR_ARRIVAL)) {
+		traffichandler_queue(self, NORTHBOUND);
+	}
+	if (batch->sensors & (1 << SB_CAR_ARRIVAL)) {
+		traffichandler_queue(self, SOUTHBOUND);
+	}
+	if (batch->sensors & (1 << NB_BRIDGE_ENTRY)) {
+		traffichandler_bridge(self, NORTHBOUND);
+	}
+	if (batch->sensors & (1 << SB_BRIDGE_ENTRY)) {
+		traffichandler_bridge(self, SOUTHBOUND);
+	}
+	return 0;
+}
+
 int traffichandler_queue(struct Traffichandler* self, int direction) {
 	ASSERT(direction == SOUTHBOUND || direction == NORTHBOUND);
 	
 	if (self->lane[NORTHBOUND].in_queue == 0 && self->lane[SOUTHBOUND].in_queue == 0 && self->on_bridge == 0) {
-		AFTER(MSEC(500), self, traffichandler_check_lights, 0);
+		apply_settings(self);
+		AFTER(PARAM_FIRST_CHECK, self, traffichandler_check_lights, CHECK_EVENT);
+	}
+	if (self->lane[direction].in_queue <= 0) {
+		self->lane[direction].waiting_since = CURRENT_BASELINE();
 	}
 	self->lane[direction].in_queue += 1;
+	journal(self);
 	ASYNC(self, traffichandler_print, 0);
 	return 0;
 }
 
 int traffichandler_bridge(struct Traffichandler* self, int direction) {
 	ASSERT(direction == SOUTHBOUND || direction == NORTHBOUND);
+	note_wait(self, direction);
 	self->lane[direction].in_queue -= 1;
 	self->on_bridge += 1;
 	self->passed_before_change += 1;
+	self->stats.served[direction] += 1;
+	self->clear_at = CURRENT_BASELINE() + PARAM_CROSS_BRIDGE;
+	journal(self);
 
-	AFTER(MSEC(TIME_CROSS_BRIDGE), self, traffichandler_leave_bridge, direction);
+	AFTER(PARAM_CROSS_BRIDGE, self, traffichandler_leave_bridge, direction);
 	ASYNC(self, traffichandler_print, 0);
 
 	// When a car has begun to cross the bridge, set the lights to red and check
 	// which lights to set.
 	// AFTER(MSEC(DELAY_SWITCH_TO_RED), self, traffichandler_set_red_light, 0); // Don't need a delay, but makes it easier to check in GUI.
-	// AFTER(MSEC(DELAY_CROSSING), self, traffichandler_check_lights, 0);
+	// AFTER(MSEC(DELAY_CROSSING), self, traffichandler_check_lights, CHECK_EVENT);
 	
 	// Check directly if the traffic lights need to change.
-	ASYNC(self, traffichandler_check_lights, 0);
+	ASYNC(self, traffichandler_check_lights, CHECK_EVENT);
 	return 0;
 }
 
 int traffichandler_leave_bridge(struct Traffichandler* self, __attribute__((unused)) int direction) {
 	self->on_bridge -= 1;
+	journal(self);
 	ASYNC(self, traffichandler_print, 0);
 	return 0;
 }
 
-int traffichandler_check_lights(struct Traffichandler* self, __attribute__((unused)) int arg) {
+int traffichandler_check_lights(struct Traffichandler* self, int arg) {
 	struct Lane* north = &self->lane[NORTHBOUND];
 	struct Lane* south = &self->lane[SOUTHBOUND];
 	
-	ASSERT(self->light_update_pending == false);
+	ASSERT(arg == CHECK_EVENT || arg == CHECK_POLL || arg == CHECK_RESET);
+	if (arg == CHECK_POLL) {
+		// Only one poll is ever scheduled; a second one would be a new chain.
+		ASSERT(self->poll_pending);
+		self->poll_pending = false;
+	}
+	if (arg == CHECK_RESET) {
+		// The all-red hold after a reset is over.
+		self->light_update_pending = false;
+	}
+	// A light change is already scheduled and will be followed by a new decision.
+	// Checks can still arrive here, e.g. from a car that entered just as the light
+	// turned red, or the poll that was scheduled before the change, so this must
+	// not be an assertion.
+	if (self->light_update_pending) {
+		return 0;
+	}
 	
 	if (self->on_bridge == 0) {
 		// No cars on the bridge. Just put a green light!
@@ -70,17 +210,13 @@ int traffichandler_check_lights(struct Traffichandler* self, __attribute__((unus
 			ASYNC(self, traffichandler_set_light, SOUTHBOUND_GREEN);
 		}
 	} else {
-		if (self->passed_before_change >= MAX_CARS_BEFORE_LIGHT_SWITCH) {
+		if (self->passed_before_change >= PARAM_MAX_CARS) {
 			// When too many cars have passed on one side, switch over the light.
 			if (self->last_green_direction == NORTHBOUND && south->in_queue > 0) {
-				ASYNC(self, traffichandler_set_red_light, 0);
-				self->light_update_pending = true;
-				AFTER(MSEC(TIME_CROSS_BRIDGE + DELAY_LIGHT_SWITCH), self, traffichandler_set_light, SOUTHBOUND_GREEN);
+				switch_direction(self, SOUTHBOUND_GREEN);
 				return 0;
 			} else if (self->last_green_direction == SOUTHBOUND && north->in_queue > 0) {
-				ASYNC(self, traffichandler_set_red_light, 0);
-				self->light_update_pending = true;
-				AFTER(MSEC(TIME_CROSS_BRIDGE + DELAY_LIGHT_SWITCH), self, traffichandler_set_light, NORTHBOUND_GREEN);
+				switch_direction(self, NORTHBOUND_GREEN);
 				return 0;
 			}
 		}
@@ -95,17 +231,16 @@ int traffichandler_check_lights(struct Traffichandler* self, __attribute__((unus
 			uint8_t lights = active_direction == NORTHBOUND ? NORTHBOUND_GREEN : SOUTHBOUND_GREEN;
 			ASYNC(self, traffichandler_set_light, lights);
 		} else if (self->lane[other_direction].in_queue > 0) {
-			// If this is true, we need to change traffic lights to other direction, but we need to wait 5 sec before we can 
-			// change traffic lights to green on other side, so that the car at the bridge get time to pass.
-			ASYNC(self, traffichandler_set_red_light, 0);
-			self->light_update_pending = true;
+			// If this is true, we need to change traffic lights to other direction, but the cars on the bridge
+			// must get time to pass. When the other car was only noticed by a poll, the last car entered a
+			// while ago and the wait is shorter than the full switch window.
 			uint8_t other_lights = active_direction == NORTHBOUND ? SOUTHBOUND_GREEN : NORTHBOUND_GREEN;
-			
-			AFTER(MSEC(TIME_CROSS_BRIDGE + DELAY_LIGHT_SWITCH), self, traffichandler_set_light, other_lights);
-		} else {
+			switch_direction(self, other_lights);
+		} else if (!self->poll_pending) {
 			// If no cars are currently queued on either side, but a car is on the bridge then wait for more cars
 			// to possible join the queue before making a decision.
-			AFTER(MSEC(10), self, traffichandler_check_lights, 0);
+			self->poll_pending = true;
+			AFTER(TICKS_IDLE_POLL, self, traffichandler_check_lights, CHECK_POLL);
 		}
 	}
 	return 0;
@@ -120,6 +255,8 @@ int traffichandler_set_light(struct Traffichandler* self, int packed_data) {
 	if ((nb_green && self->last_green_direction != NORTHBOUND) ||
 	    (sb_green && self->last_green_direction != SOUTHBOUND)) {
 		self->passed_before_change = 0;
+		self->stats.switches += 1;
+		apply_settings(self);
 	}
 	
 	self->lane[NORTHBOUND].light = nb_green;
@@ -131,15 +268,27 @@ int traffichandler_set_light(struct Traffichandler* self, int packed_data) {
 	} else {
 		self->last_green_direction = SOUTHBOUND;
 	}
+	journal(self);
 	
-	ASYNC(self->com, com_write_data, packed_data); // Write data to serial port.
+	com_write_lights(self->com, packed_data); // Write data to serial port.
 
 	ASYNC(self, traffichandler_print, 0);
 	return 0;
 }
 
+int traffichandler_switch_light(struct Traffichandler* self, int packed_data) {
+	// A car that entered just as the light turned red moved clear_at after
+	// the switch was planned; wait for it too.
+	Time wait = until_clear(self);
+	if (wait > 0) {
+		AFTER(wait, self, traffichandler_switch_light, packed_data);
+		return 0;
+	}
+	return traffichandler_set_light(self, packed_data);
+}
+
 int traffichandler_set_red_light(struct Traffichandler* self, __attribute__((unused)) int direction) {
-	ASYNC(self->com, com_write_data, PACK_LIGHTS(RED, RED));
+	com_write_lights(self->com, PACK_LIGHTS(RED, RED));
 	// Set last green direction, for future reference in check_traffic_lights.
 	if (self->lane[NORTHBOUND].light == GREEN) {
 		self->last_green_direction = NORTHBOUND;
@@ -148,16 +297,13 @@ int traffichandler_set_red_light(struct Traffichandler* self, __attribute__((unu
 	}
 	self->lane[NORTHBOUND].light = RED;
 	self->lane[SOUTHBOUND].light = RED;
+	apply_settings(self);
+	journal(self);
 	
 	ASYNC(self, traffichandler_print, 0);
 	return 0;
 }
 
-int traffichandler_write_lights(struct Traffichandler* self, int packed_data) {
-	ASYNC(self->com, com_write_data, packed_data);
-	return 0;
-}
-
 int traffichandler_print(struct Traffichandler* self, __attribute__((unused)) int arg) {
 	/* Controller user interface
 	The display of the AVR butterfly should print at least the following information:
@@ -165,30 +311,98 @@ int traffichandler_print(struct Traffichandler* self, __attribute__((unused)) in
 	2. The length of the queue of cars waiting to enter the bridge in southbound direction.
 	3. The number of cars currently on the bridge.
 	This can be achieved by conceptually dividing the display in three parts, with two digits each.
+	The display object draws these, and the statistics pages, from the LCD frame interrupt.
 	*/
-	printAt(self->lane[NORTHBOUND].in_queue, NB_PRINT_POS);
-	printAt(self->lane[SOUTHBOUND].in_queue, SB_PRINT_POS);
-	printAt(self->on_bridge, BRIDGE_PRINT_POS);
-	
-	// Display colons.
-	LCDDR8 = (LCDDR8 & ~0x1) | 0x1;
-	
-	if (self->lane[NORTHBOUND].light == GREEN) {
-		LCDDR0 = (LCDDR0 & ~SPECIAL_MASK) | (1 << 2);
-		} else {
-		LCDDR0 = (LCDDR0 & ~SPECIAL_MASK) | (1 << 1);
+	struct DisplayValues v;
+	v.in_queue[NORTHBOUND] = self->lane[NORTHBOUND].in_queue;
+	v.in_queue[SOUTHBOUND] = self->lane[SOUTHBOUND].in_queue;
+	v.on_bridge = self->on_bridge;
+	v.light[NORTHBOUND] = self->lane[NORTHBOUND].light;
+	v.light[SOUTHBOUND] = self->lane[SOUTHBOUND].light;
+	v.served = self->stats.served[NORTHBOUND] + self->stats.served[SOUTHBOUND];
+	v.max_wait = self->stats.max_wait;
+	v.switches = self->stats.switches;
+	display_note(&v);
+	return 0;
+}
+
+int traffichandler_configure(struct Traffichandler* self, const struct ConfigCommand* cmd) {
+	const struct ConfigValues defaults = CONFIG_DEFAULT_VALUES;
+	struct ConfigValues next;
+
+	if (cmd->command == CONFIG_CANCEL) {
+		self->staging = false;
+		return 0;
 	}
-	
-	if (self->lane[SOUTHBOUND].light == GREEN) {
-		LCDDR1 = (LCDDR1 & ~SPECIAL_MASK) | (1 << 1);
-		} else {
-		LCDDR1 = (LCDDR1 & ~SPECIAL_MASK) | (1 << 6);
+	if (cmd->command == CONFIG_COMMIT) {
+		if (self->staging) {
+			self->staging = false;
+			self->committed = self->staged;
+			self->commit_pending = true;
+			if (idle(self)) {
+				apply_settings(self);
+			}
+		}
+		return 0;
+	}
+
+	// Changes start from the settings in use.
+	next = self->staging ? self->staged : self->settings;
+	switch (cmd->command) {
+	case CONFIG_MAX_CARS:
+		next.max_cars = cmd->value;
+		break;
+	case CONFIG_LIGHT_SWITCH:
+		next.light_switch = cmd->value;
+		break;
+	case CONFIG_FIRST_CHECK:
+		next.first_check = cmd->value;
+		break;
+	case CONFIG_DEFAULTS:
+		next = defaults;
+		break;
+	default:
+		return 0;
+	}
+	if (config_valid(&next)) {
+		self->staged = next;
+		self->staging = true;
 	}
-	
 	return 0;
 }
 
+// At most one car a second enters, so no more than this can be on the bridge.
+#define MAX_ON_BRIDGE (TIME_CROSS_BRIDGE / DELAY_CROSSING + 1)
+
+void traffichandler_restore(struct Traffichandler* self, const struct JournalState* s) {
+	self->lane[NORTHBOUND].in_queue = s->in_queue[NORTHBOUND];
+	self->lane[SOUTHBOUND].in_queue = s->in_queue[SOUTHBOUND];
+	self->on_bridge = s->on_bridge < MAX_ON_BRIDGE ? s->on_bridge : MAX_ON_BRIDGE;
+	self->last_green_direction = s->last_green_direction;
+	self->passed_before_change = s->passed_before_change;
+	self->stats = s->stats;
+}
+
 int traffichandler_init(struct Traffichandler* self, int arg) {
+	uint16_t i;
+
 	ASYNC(self, traffichandler_print, 0);
-	ASYNC(self->com, com_write_data, PACK_LIGHTS(RED, RED));
+	com_write_lights(self->com, PACK_LIGHTS(RED, RED));
+
+	self->lane[NORTHBOUND].waiting_since = CURRENT_BASELINE();
+	self->lane[SOUTHBOUND].waiting_since = CURRENT_BASELINE();
+
+	// Cars may have entered on a green from before the reset, whether or not
+	// the journal saw them. Keep all lights red for a whole switch window,
+	// as after a change of direction, before the first decision.
+	self->clear_at = CURRENT_BASELINE() + PARAM_CROSS_BRIDGE;
+	for (i = 0; i < self->on_bridge; i++) {
+		AFTER(PARAM_CROSS_BRIDGE, self, traffichandler_leave_bridge, self->last_green_direction);
+	}
+	self->light_update_pending = true;
+	AFTER(PARAM_SWITCH_WINDOW, self, traffichandler_check_lights, CHECK_RESET);
+
+	// After a power-on, replace the journal record from before it.
+	journal(self);
+	return 0;
 }
\ No newline at end of file
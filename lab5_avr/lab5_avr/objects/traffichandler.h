@@ -28,12 +28,71 @@ the following requirements:
 #include <stdbool.h>
 #include <stdint.h>
 #include "TinyTimber.h"
+#include "common.h"
+#include "config.h"
 
 struct Communicator;
 
+#define CHECK_EVENT 0
+#define CHECK_POLL 1
+#define CHECK_RESET 2   // end of the all-red hold after a reset
+
+/* Controller parameters
+The tuning constants of common.h are only the defaults; the controller reads
+them from `traffic_params`, which configuration commands on the serial link
+change at run time (see config.h). The delays are corrected for the drift
+of the system clock (see calibration.h). On the host the variable is
+thread-local, so that each simulation thread can try its own settings.
+*/
+struct TrafficParams {
+   // MAX_CARS_BEFORE_LIGHT_SWITCH.
+   uint16_t max_cars_before_light_switch;
+   // TICKS_SWITCH_WINDOW, i.e. crossing time + DELAY_LIGHT_SWITCH.
+   Time switch_window;
+   // TICKS_FIRST_CHECK.
+   Time first_check;
+   // TICKS_CROSS_BRIDGE.
+   Time cross_bridge;
+   // Clock correction the delays were computed with.
+   int16_t scale;
+};
+
+#define TRAFFIC_PARAMS_DEFAULT { MAX_CARS_BEFORE_LIGHT_SWITCH, TICKS_SWITCH_WINDOW, TICKS_FIRST_CHECK, \
+                                 TICKS_CROSS_BRIDGE, 0 }
+
+#ifdef __AVR__
+extern struct TrafficParams traffic_params;
+#else
+extern _Thread_local struct TrafficParams traffic_params;
+#endif
+
+#define PARAM_MAX_CARS      (traffic_params.max_cars_before_light_switch)
+#define PARAM_SWITCH_WINDOW (traffic_params.switch_window)
+#define PARAM_FIRST_CHECK   (traffic_params.first_check)
+#define PARAM_CROSS_BRIDGE  (traffic_params.cross_bridge)
+
+// Set traffic_params from settings in milliseconds and the current clock
+// correction.
+void traffic_params_set(const struct ConfigValues* v);
+
+// Counters kept for the display and carried over resets.
+struct TrafficStats {
+   uint32_t served[2];   // cars that entered the bridge, per direction
+   uint32_t switches;    // changes of the green direction
+   uint16_t max_wait;    // longest a queue waited with no car entering, s
+};
+
 struct Lane {
    int16_t in_queue;
    uint8_t light;
+   // When the car at the head of the queue started waiting for its turn.
+   Time waiting_since;
+};
+
+// All sensor bits from one byte received from the simulator, handed over
+// in a single message (see ASYNC_BLOCK).
+struct SensorBatch {
+   uint8_t sensors;   // NB_CAR_ARRIVAL, NB_BRIDGE_ENTRY, ... bits.
 };
 
 struct Traffichandler {
@@ -53,14 +112,38 @@ struct Traffichandler {
    // any decisions about changing them.
    bool light_update_pending;
 
+   // If a poll of the lights is already scheduled, so that at most one
+   // polling chain is ever running.
+   bool poll_pending;
+
+   // When the car that entered last is off the bridge, going by
+   // PARAM_CROSS_BRIDGE. A change of direction gives the other side green
+   // the light switch margin after this.
+   Time clear_at;
+
    uint8_t last_green_direction;
 
    // Pointer to the serial object as we have to write the light
    // data to it.
    struct Communicator* com;
+
+   // Settings in use, being changed by configuration commands, and
+   // committed but waiting for the next light phase.
+   struct ConfigValues settings;
+   struct ConfigValues staged;
+   struct ConfigValues committed;
+   bool staging;
+   bool commit_pending;
+
+   struct TrafficStats stats;
 };
 
-#define initTraffichandler(com) { initObject(), {{0,0}, {0,0}}, 0, 0, false, 0, com }
+#define initTraffichandler(com) { initObject(), {{0,0,0}, {0,0,0}}, 0, 0, false, false, 0, 0, com, \
+                                  CONFIG_DEFAULT_VALUES, CONFIG_DEFAULT_VALUES, CONFIG_DEFAULT_VALUES, false, false, {{0, 0}, 0, 0} }
+
+// Handle every sensor activation in `batch`, in the same order as the
+// separate queue/bridge messages would have been handled.
+int traffichandler_sensors(struct Traffichandler* self, const struct SensorBatch* batch);
 
 // Sensor activation for when a car enters the queue.
 int traffichandler_queue(struct Traffichandler* self, int direction);
@@ -71,20 +154,34 @@ int traffichandler_bridge(struct Traffichandler* self, int direction);
 // Handler for when a car *should* have left bridge.
 int traffichandler_leave_bridge(struct Traffichandler* self, int direction);
 
+// Decide on the lights. `arg` is CHECK_POLL for the periodic poll while only
+// the bridge is occupied, CHECK_RESET at the end of the all-red hold after a
+// reset, CHECK_EVENT otherwise.
 int traffichandler_check_lights(struct Traffichandler* self, int arg);
 
 // Set the light in `direction` to green, automatically sets the other directions light to red.
 int traffichandler_set_light(struct Traffichandler* self, int direction);
 
+// traffichandler_set_light for the other side after a change of direction,
+// once the bridge is clear (see clear_at).
+int traffichandler_switch_light(struct Traffichandler* self, int direction);
+
 // Set light to red in the specified direction.
 int traffichandler_set_red_light(struct Traffichandler* self, int direction);
 
-// Write the status of the lights to the serial port.
-int traffichandler_write_lights(struct Traffichandler* self, int arg);
-
-// Display number of cars in each queue and cars on the bridge on the LCD.
+// Hand the number of cars in each queue and on the bridge, the lights and
+// the statistics to the display.
 int traffichandler_print(struct Traffichandler* self, int arg);
 
+// Configuration command from the Communicator (see config.h).
+int traffichandler_configure(struct Traffichandler* self, const struct ConfigCommand* cmd);
+
+struct JournalState;
+
+// Take over the state saved before a crash (see storage.h). Call before
+// the kernel starts; traffichandler_init then resumes from it.
+void traffichandler_restore(struct Traffichandler* self, const struct JournalState* s);
+
 int traffichandler_init(struct Traffichandler* self, int arg);
 
 